@@ -0,0 +1,684 @@
+/*  - FOX - A tool for testing Open-Channel SSDs
+ *      - Backend: file-backed Open-Channel SSD emulator
+ *
+ * Copyright (C) 2017, IT University of Copenhagen. All rights reserved.
+ * Written by Ivan Luiz Picoli <ivpi@itu.dk>
+ *
+ * Funding support provided by CAPES Foundation, Ministry of Education
+ * of Brazil, Brasilia - DF 70040-020, Brazil.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Backend: Open-Channel SSD emulator
+ *
+ * Emulates an Open-Channel SSD on top of a sparse file, allowing FOX to run
+ * without a physical device. Device name format:
+ *
+ *   emu:<file>[?<key>=<value>[&<key>=<value>...]]
+ *
+ *   ch    - channels              (default 1)
+ *   lun   - LUNs per channel      (default 1)
+ *   pl    - planes per LUN        (default 1)
+ *   blk   - blocks per plane      (default 128)
+ *   pg    - pages per block       (default 128)
+ *   sec   - sectors per page      (default 4)
+ *   secsz - bytes per sector      (default 4096)
+ *   bad   - factory bad blocks per thousand, set when the file is created
+ *   grow  - programs and erases per million that fail and turn their block
+ *           bad (grown bad blocks), not kept in the file
+ *
+ *   e.g: emu:/tmp/fox.img?ch=8&lun=4&blk=1024&pg=512
+ *
+ * The file is created if it does not exist. An existing file keeps its
+ * geometry, bad block table and data between runs. File layout:
+ *
+ *   [ header | bad block table | block write pointers | data ]
+ *
+ * Data is laid out as channel, LUN, block and page, each page holding all
+ * its planes contiguously. The block write pointer enforces the NAND rules:
+ * pages of a block are programmed in order, once after each erase, and only
+ * programmed pages can be read. Erases punch the block out
+ * of the file, so the image only takes disk space for programmed pages.
+ *
+ * A block is accessed by a single thread at a time, as FOX distributes
+ * blocks among nodes, so no locking is performed per I/O. Asynchronous
+ * commands run on the provisioning service threads, as with liblightnvm, so
+ * commands to different LUNs are copied in parallel and -q is honored.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/falloc.h>
+#include <liblightnvm.h>
+#include "../fox.h"
+
+#define EMU_MAGIC       0x554d45584f46ULL /* "FOXEMU" */
+#define EMU_VERSION     0x1
+#define EMU_ALIGN       4096
+#define EMU_PATH_LEN    256
+#define EMU_MAX_NADDRS  128
+
+struct emu_hdr {
+    uint64_t    magic;
+    uint32_t    version;
+    uint32_t    nchannels;
+    uint32_t    nluns;
+    uint32_t    nplanes;
+    uint32_t    nblocks;
+    uint32_t    npages;
+    uint32_t    nsectors;
+    uint32_t    sector_nbytes;
+    uint64_t    bbt_off;
+    uint64_t    wp_off;
+    uint64_t    data_off;
+    uint64_t    file_sz;
+};
+
+struct emu_dev {
+    char            path[EMU_PATH_LEN];
+    int             fd;
+    uint8_t         *map;
+    size_t          map_sz;
+    struct emu_hdr  *hdr;
+    uint8_t         *bbt;   /* 1 byte per plane, per block */
+    uint32_t        *wp;    /* Next programmable page, per block */
+    uint8_t         *data;
+    uint32_t        bad_pm;
+    uint32_t        grow_ppm;
+    uint64_t        grow_ops;   /* programs and erases, for 'grow' */
+    struct nvm_geo  geo;
+    struct nvm_bbt  *bbts;  /* One per LUN */
+};
+
+#define EMU_DEV(d) ((struct emu_dev *) (d))
+
+static uint64_t emu_align (uint64_t val)
+{
+    return (val + EMU_ALIGN - 1) & ~((uint64_t) EMU_ALIGN - 1);
+}
+
+static int emu_parse (const char *dev_path, struct emu_dev *emu,
+                                                         struct emu_hdr *want)
+{
+    char opts[EMU_PATH_LEN];
+    char *key, *val, *save, *q;
+    unsigned long num;
+
+    q = strchr(dev_path, '?');
+    if (strlen(dev_path) >= EMU_PATH_LEN || dev_path[0] == '?' ||
+                                                           dev_path[0] == 0)
+        goto ERR;
+
+    memset (opts, 0, EMU_PATH_LEN);
+    if (q) {
+        memcpy (emu->path, dev_path, q - dev_path);
+        emu->path[q - dev_path] = 0;
+        strcpy (opts, q + 1);
+    } else
+        strcpy (emu->path, dev_path);
+
+    for (key = strtok_r(opts, "&", &save); key;
+                                          key = strtok_r(NULL, "&", &save)) {
+        val = strchr(key, '=');
+        if (!val)
+            goto ERR;
+        *val = 0;
+        val++;
+        num = strtoul(val, NULL, 10);
+
+        if (strcmp(key, "ch") == 0)
+            want->nchannels = num;
+        else if (strcmp(key, "lun") == 0)
+            want->nluns = num;
+        else if (strcmp(key, "pl") == 0)
+            want->nplanes = num;
+        else if (strcmp(key, "blk") == 0)
+            want->nblocks = num;
+        else if (strcmp(key, "pg") == 0)
+            want->npages = num;
+        else if (strcmp(key, "sec") == 0)
+            want->nsectors = num;
+        else if (strcmp(key, "secsz") == 0)
+            want->sector_nbytes = num;
+        else if (strcmp(key, "bad") == 0)
+            emu->bad_pm = num;
+        else if (strcmp(key, "grow") == 0)
+            emu->grow_ppm = num;
+        else {
+            printf (" emu: Unknown parameter '%s'.\n", key);
+            return -1;
+        }
+    }
+
+    return 0;
+
+ERR:
+    printf (" emu: Invalid device name. "
+                                    "e.g: emu:/tmp/fox.img?ch=8&lun=4\n");
+    return -1;
+}
+
+/* Fills zeroed parameters with defaults and checks the address format */
+static int emu_check_geo (struct emu_hdr *hdr)
+{
+    hdr->nchannels = (!hdr->nchannels) ? 1 : hdr->nchannels;
+    hdr->nluns = (!hdr->nluns) ? 1 : hdr->nluns;
+    hdr->nplanes = (!hdr->nplanes) ? 1 : hdr->nplanes;
+    hdr->nblocks = (!hdr->nblocks) ? 128 : hdr->nblocks;
+    hdr->npages = (!hdr->npages) ? 128 : hdr->npages;
+    hdr->nsectors = (!hdr->nsectors) ? 4 : hdr->nsectors;
+    hdr->sector_nbytes = (!hdr->sector_nbytes) ? 4096 : hdr->sector_nbytes;
+
+    if (hdr->nchannels > (1 << NVM_CH_BITS) ||
+                hdr->nluns > (1 << NVM_LUN_BITS) ||
+                hdr->nplanes > (1 << NVM_PL_BITS) ||
+                hdr->nblocks > (1 << NVM_BLK_BITS) ||
+                hdr->npages > (1 << NVM_PG_BITS) ||
+                hdr->nsectors > (1 << NVM_SEC_BITS) ||
+                hdr->sector_nbytes % 512 != 0) {
+        printf (" emu: Geometry does not fit the address format.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void emu_set_layout (struct emu_hdr *hdr)
+{
+    uint64_t nblks, vpg_sz;
+
+    nblks = (uint64_t) hdr->nchannels * hdr->nluns * hdr->nblocks;
+    vpg_sz = (uint64_t) hdr->nplanes * hdr->nsectors * hdr->sector_nbytes;
+
+    hdr->bbt_off = emu_align(sizeof (struct emu_hdr));
+    hdr->wp_off = emu_align(hdr->bbt_off + nblks * hdr->nplanes);
+    hdr->data_off = emu_align(hdr->wp_off + nblks * sizeof (uint32_t));
+    hdr->file_sz = hdr->data_off + nblks * hdr->npages * vpg_sz;
+}
+
+/* Factory bad blocks, spread deterministically among the LUNs */
+static void emu_factory_bbt (struct emu_dev *emu)
+{
+    uint64_t blk_i, nblks, x = 0x9e3779b97f4a7c15ULL;
+    uint32_t pl;
+
+    if (!emu->bad_pm)
+        return;
+
+    nblks = (uint64_t) emu->hdr->nchannels * emu->hdr->nluns *
+                                                          emu->hdr->nblocks;
+    for (blk_i = 0; blk_i < nblks; blk_i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        if (x % 1000 < emu->bad_pm)
+            for (pl = 0; pl < emu->hdr->nplanes; pl++)
+                emu->bbt[blk_i * emu->hdr->nplanes + pl] = 0x1;
+    }
+}
+
+static int emu_map (struct emu_dev *emu, struct emu_hdr *hdr, int create)
+{
+    if (create && ftruncate(emu->fd, hdr->file_sz) < 0)
+        return -1;
+
+    emu->map_sz = hdr->file_sz;
+    emu->map = mmap(NULL, emu->map_sz, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                                                  emu->fd, 0);
+    if (emu->map == MAP_FAILED)
+        return -1;
+
+    emu->hdr = (struct emu_hdr *) emu->map;
+    if (create)
+        memcpy (emu->hdr, hdr, sizeof (struct emu_hdr));
+
+    emu->bbt = emu->map + emu->hdr->bbt_off;
+    emu->wp = (uint32_t *) (emu->map + emu->hdr->wp_off);
+    emu->data = emu->map + emu->hdr->data_off;
+
+    if (create)
+        emu_factory_bbt (emu);
+
+    return 0;
+}
+
+static int emu_open_file (struct emu_dev *emu, struct emu_hdr *want)
+{
+    struct emu_hdr hdr;
+    struct stat st;
+    int create;
+
+    emu->fd = open(emu->path, O_RDWR | O_CREAT, 0644);
+    if (emu->fd < 0)
+        return -1;
+
+    if (fstat(emu->fd, &st) < 0)
+        goto CLOSE;
+
+    create = (st.st_size == 0);
+
+    if (create) {
+        memcpy (&hdr, want, sizeof (struct emu_hdr));
+        if (emu_check_geo (&hdr))
+            goto CLOSE;
+
+        hdr.magic = EMU_MAGIC;
+        hdr.version = EMU_VERSION;
+        emu_set_layout (&hdr);
+    } else {
+        if (pread(emu->fd, &hdr, sizeof (struct emu_hdr), 0) !=
+                                                     sizeof (struct emu_hdr) ||
+                    hdr.magic != EMU_MAGIC || hdr.version != EMU_VERSION ||
+                    hdr.file_sz != st.st_size) {
+            printf (" emu: '%s' is not a valid image.\n", emu->path);
+            goto CLOSE;
+        }
+
+        if ((want->nchannels && want->nchannels != hdr.nchannels) ||
+                (want->nluns && want->nluns != hdr.nluns) ||
+                (want->nplanes && want->nplanes != hdr.nplanes) ||
+                (want->nblocks && want->nblocks != hdr.nblocks) ||
+                (want->npages && want->npages != hdr.npages) ||
+                (want->nsectors && want->nsectors != hdr.nsectors) ||
+                (want->sector_nbytes &&
+                                  want->sector_nbytes != hdr.sector_nbytes)) {
+            printf (" emu: Geometry differs from image '%s'. "
+                                 "Remove the file to recreate it.\n", emu->path);
+            goto CLOSE;
+        }
+    }
+
+    if (emu_map (emu, &hdr, create))
+        goto CLOSE;
+
+    return 0;
+
+CLOSE:
+    close (emu->fd);
+    return -1;
+}
+
+static void emu_set_geo (struct emu_dev *emu)
+{
+    struct nvm_geo *geo = &emu->geo;
+
+    geo->nchannels = emu->hdr->nchannels;
+    geo->nluns = emu->hdr->nluns;
+    geo->nplanes = emu->hdr->nplanes;
+    geo->nblocks = emu->hdr->nblocks;
+    geo->npages = emu->hdr->npages;
+    geo->nsectors = emu->hdr->nsectors;
+    geo->sector_nbytes = emu->hdr->sector_nbytes;
+    geo->page_nbytes = geo->nsectors * geo->sector_nbytes;
+    geo->meta_nbytes = 0;
+    geo->vpg_nbytes = geo->page_nbytes * geo->nplanes;
+    geo->vblk_nbytes = geo->vpg_nbytes * geo->npages;
+    geo->tbytes = geo->vblk_nbytes * geo->nblocks * geo->nluns *
+                                                               geo->nchannels;
+}
+
+static int emu_set_bbts (struct emu_dev *emu)
+{
+    int lun, nluns = emu->geo.nchannels * emu->geo.nluns;
+    size_t lun_nblks = emu->geo.nblocks * emu->geo.nplanes;
+
+    emu->bbts = calloc (nluns, sizeof (struct nvm_bbt));
+    if (!emu->bbts)
+        return -1;
+
+    for (lun = 0; lun < nluns; lun++) {
+        emu->bbts[lun].dev = (struct nvm_dev *) emu;
+        emu->bbts[lun].addr.ppa = 0;
+        emu->bbts[lun].addr.g.ch = lun / emu->geo.nluns;
+        emu->bbts[lun].addr.g.lun = lun % emu->geo.nluns;
+        emu->bbts[lun].nblks = lun_nblks;
+        emu->bbts[lun].blks = emu->bbt + lun * lun_nblks;
+    }
+
+    return 0;
+}
+
+static struct nvm_dev *emu_dev_open (const char *dev_path)
+{
+    struct emu_dev *emu;
+    struct emu_hdr want;
+
+    emu = calloc (1, sizeof (struct emu_dev));
+    if (!emu)
+        return NULL;
+
+    memset (&want, 0, sizeof (struct emu_hdr));
+    if (emu_parse (dev_path, emu, &want))
+        goto FREE;
+
+    if (emu_open_file (emu, &want)) {
+        printf (" emu: Failed to open image '%s'.\n", emu->path);
+        goto FREE;
+    }
+
+    emu_set_geo (emu);
+
+    if (emu_set_bbts (emu))
+        goto UNMAP;
+
+    return (struct nvm_dev *) emu;
+
+UNMAP:
+    munmap (emu->map, emu->map_sz);
+    close (emu->fd);
+FREE:
+    free (emu);
+    return NULL;
+}
+
+static void emu_dev_close (struct nvm_dev *dev)
+{
+    struct emu_dev *emu = EMU_DEV(dev);
+
+    if (!emu)
+        return;
+
+    free (emu->bbts);
+    munmap (emu->map, emu->map_sz);
+    close (emu->fd);
+    free (emu);
+}
+
+static const struct nvm_geo *emu_get_geo (struct nvm_dev *dev)
+{
+    return &EMU_DEV(dev)->geo;
+}
+
+static const struct nvm_bbt *emu_get_bbt (struct nvm_dev *dev,
+                                    struct nvm_addr addr, struct nvm_ret *ret)
+{
+    struct emu_dev *emu = EMU_DEV(dev);
+
+    ret->status = 0;
+    ret->result = 0;
+
+    if (addr.g.ch >= emu->geo.nchannels || addr.g.lun >= emu->geo.nluns) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return &emu->bbts[addr.g.ch * emu->geo.nluns + addr.g.lun];
+}
+
+static uint64_t emu_blk_idx (struct emu_dev *emu, struct nvm_addr addr)
+{
+    return ((uint64_t) addr.g.ch * emu->geo.nluns + addr.g.lun) *
+                                                 emu->geo.nblocks + addr.g.blk;
+}
+
+static int emu_blk_is_bad (struct emu_dev *emu, uint64_t blk_idx)
+{
+    uint32_t pl;
+
+    for (pl = 0; pl < emu->geo.nplanes; pl++)
+        if (emu->bbt[blk_idx * emu->geo.nplanes + pl])
+            return 1;
+
+    return 0;
+}
+
+/* With 'grow', a program or erase fails now and then and its block turns
+ * bad. The choice is a hash of the operation count, shared by all threads */
+static int emu_blk_grow (struct emu_dev *emu, uint64_t blk_idx)
+{
+    uint64_t x;
+    uint32_t pl;
+
+    if (!emu->grow_ppm)
+        return 0;
+
+    x = __atomic_fetch_add (&emu->grow_ops, 1, __ATOMIC_RELAXED) +
+                                                    0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+
+    if (x % 1000000 >= emu->grow_ppm)
+        return 0;
+
+    for (pl = 0; pl < emu->geo.nplanes; pl++)
+        emu->bbt[blk_idx * emu->geo.nplanes + pl] = 0x1;
+
+    return 1;
+}
+
+/* Marks all the planes of the given blocks */
+static int emu_bbt_mark (struct nvm_dev *dev, struct nvm_addr *addrs,
+                              int naddrs, uint16_t flags, struct nvm_ret *ret)
+{
+    struct emu_dev *emu = EMU_DEV(dev);
+    uint64_t blk_idx;
+    uint32_t pl;
+    int i;
+
+    ret->status = 0;
+    ret->result = 0;
+
+    for (i = 0; i < naddrs; i++) {
+        blk_idx = emu_blk_idx(emu, addrs[i]);
+        for (pl = 0; pl < emu->geo.nplanes; pl++)
+            emu->bbt[blk_idx * emu->geo.nplanes + pl] = flags;
+    }
+
+    return 0;
+}
+
+static int emu_set_meta_mode (struct nvm_dev *dev, int mode)
+{
+    return 0;
+}
+
+static struct nvm_vblk *emu_vblk_alloc (struct nvm_dev *dev,
+                                          struct nvm_addr *addrs, int naddrs)
+{
+    struct emu_dev *emu = EMU_DEV(dev);
+    struct nvm_vblk *vblk;
+    int i;
+
+    if (naddrs < 1 || naddrs > EMU_MAX_NADDRS)
+        goto EINV;
+
+    for (i = 0; i < naddrs; i++)
+        if (addrs[i].g.ch >= emu->geo.nchannels ||
+                                    addrs[i].g.lun >= emu->geo.nluns ||
+                                    addrs[i].g.blk >= emu->geo.nblocks)
+            goto EINV;
+
+    vblk = calloc (1, sizeof (struct nvm_vblk));
+    if (!vblk)
+        return NULL;
+
+    vblk->dev = dev;
+    for (i = 0; i < naddrs; i++)
+        vblk->blks[i] = addrs[i];
+    vblk->nblks = naddrs;
+    vblk->nbytes = naddrs * emu->geo.vblk_nbytes;
+
+    return vblk;
+
+EINV:
+    errno = EINVAL;
+    return NULL;
+}
+
+static void emu_vblk_free (struct nvm_vblk *vblk)
+{
+    free (vblk);
+}
+
+/* Virtual pages are striped among the blocks of a vblk */
+static uint8_t *emu_vpg (struct emu_dev *emu, struct nvm_vblk *vblk,
+                                          size_t vpg, uint64_t *blk, uint32_t *pg)
+{
+    *blk = emu_blk_idx(emu, vblk->blks[vpg % vblk->nblks]);
+    *pg = vpg / vblk->nblks;
+
+    return emu->data + (*blk * emu->geo.npages + *pg) * emu->geo.vpg_nbytes;
+}
+
+static int emu_check_io (struct emu_dev *emu, struct nvm_vblk *vblk,
+                                                   size_t count, size_t offset)
+{
+    if (count % emu->geo.vpg_nbytes || offset % emu->geo.vpg_nbytes ||
+                                             offset + count > vblk->nbytes) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static ssize_t emu_vblk_pread (struct nvm_vblk *vblk, void *buf,
+                                                   size_t count, size_t offset)
+{
+    struct emu_dev *emu = EMU_DEV(vblk->dev);
+    size_t vpg, nvpgs;
+    uint64_t blk;
+    uint32_t pg;
+    uint8_t *src;
+
+    if (emu_check_io (emu, vblk, count, offset))
+        return -1;
+
+    nvpgs = count / emu->geo.vpg_nbytes;
+    for (vpg = 0; vpg < nvpgs; vpg++) {
+        src = emu_vpg (emu, vblk, offset / emu->geo.vpg_nbytes + vpg,
+                                                                   &blk, &pg);
+        if (emu_blk_is_bad (emu, blk) || pg >= emu->wp[blk]) {
+            errno = EIO;
+            return -1;
+        }
+
+        memcpy ((uint8_t *) buf + vpg * emu->geo.vpg_nbytes, src,
+                                                         emu->geo.vpg_nbytes);
+    }
+
+    return count;
+}
+
+static ssize_t emu_vblk_pwrite (struct nvm_vblk *vblk, const void *buf,
+                                                   size_t count, size_t offset)
+{
+    struct emu_dev *emu = EMU_DEV(vblk->dev);
+    size_t vpg, nvpgs;
+    uint64_t blk;
+    uint32_t pg;
+    uint8_t *dst;
+
+    if (emu_check_io (emu, vblk, count, offset))
+        return -1;
+
+    nvpgs = count / emu->geo.vpg_nbytes;
+    for (vpg = 0; vpg < nvpgs; vpg++) {
+        dst = emu_vpg (emu, vblk, offset / emu->geo.vpg_nbytes + vpg,
+                                                                   &blk, &pg);
+        /* Pages of a block are programmed in order */
+        if (emu_blk_is_bad (emu, blk) || pg != emu->wp[blk] ||
+                                                    emu_blk_grow (emu, blk)) {
+            errno = EIO;
+            return -1;
+        }
+
+        memcpy (dst, (uint8_t *) buf + vpg * emu->geo.vpg_nbytes,
+                                                         emu->geo.vpg_nbytes);
+        emu->wp[blk] = pg + 1;
+    }
+
+    return count;
+}
+
+static ssize_t emu_vblk_erase (struct nvm_vblk *vblk)
+{
+    struct emu_dev *emu = EMU_DEV(vblk->dev);
+    uint64_t blk, off;
+    int i;
+
+    for (i = 0; i < vblk->nblks; i++) {
+        blk = emu_blk_idx(emu, vblk->blks[i]);
+        if (emu_blk_is_bad (emu, blk) || emu_blk_grow (emu, blk)) {
+            errno = EIO;
+            return -1;
+        }
+
+        off = emu->hdr->data_off + blk * emu->geo.vblk_nbytes;
+        if (fallocate(emu->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                               off, emu->geo.vblk_nbytes) < 0)
+            memset (emu->map + off, 0x0, emu->geo.vblk_nbytes);
+
+        emu->wp[blk] = 0;
+    }
+
+    return vblk->nbytes;
+}
+
+/* Blocks are erased one by one, each is its own command */
+static int emu_vblk_erase_v (struct nvm_vblk **vblks, int n, int *err,
+                                                                uint64_t *ns)
+{
+    uint64_t tstart;
+    int i, nfail = 0;
+
+    for (i = 0; i < n; i++) {
+        tstart = fox_timestamp_now ();
+        err[i] = (emu_vblk_erase(vblks[i]) < 0);
+        ns[i] = fox_timestamp_now () - tstart;
+        nfail += err[i];
+    }
+
+    return nfail;
+}
+
+static struct prov_backend emu_backend = {
+    .name           = "emulator",
+    .prefix         = "emu:",
+    .dev_open       = emu_dev_open,
+    .dev_close      = emu_dev_close,
+    .get_geo        = emu_get_geo,
+    .get_bbt        = emu_get_bbt,
+    .bbt_mark       = emu_bbt_mark,
+    .set_meta_mode  = emu_set_meta_mode,
+    .vblk_alloc     = emu_vblk_alloc,
+    .vblk_free      = emu_vblk_free,
+    .vblk_pread     = emu_vblk_pread,
+    .vblk_pwrite    = emu_vblk_pwrite,
+    .vblk_erase     = emu_vblk_erase,
+    .vblk_erase_v   = emu_vblk_erase_v,
+    .vblk_submit    = NULL,
+};
+
+int prov_emu_init (void)
+{
+    return prov_backend_register(&emu_backend);
+}
@@ -0,0 +1,209 @@
+/*  - FOX - A tool for testing Open-Channel SSDs
+ *      - Backend: liblightnvm
+ *
+ * Copyright (C) 2017, IT University of Copenhagen. All rights reserved.
+ * Written by Ivan Luiz Picoli <ivpi@itu.dk>
+ *
+ * Funding support provided by CAPES Foundation, Ministry of Education
+ * of Brazil, Brasilia - DF 70040-020, Brazil.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Backend: liblightnvm
+ *
+ * Default backend. Forwards all device operations to liblightnvm, used when
+ * the device name has no backend prefix, e.g: /dev/nvme0n1
+ *
+ * liblightnvm only offers synchronous vblk commands. Asynchronous commands
+ * are served by the provisioning service threads (see prov_io_submit).
+ */
+
+#include <liblightnvm.h>
+#include "../fox.h"
+
+static struct nvm_dev *lnvm_dev_open (const char *dev_path)
+{
+    return nvm_dev_open(dev_path);
+}
+
+static void lnvm_dev_close (struct nvm_dev *dev)
+{
+    nvm_dev_close(dev);
+}
+
+static const struct nvm_geo *lnvm_get_geo (struct nvm_dev *dev)
+{
+    return nvm_dev_get_geo(dev);
+}
+
+static const struct nvm_bbt *lnvm_get_bbt (struct nvm_dev *dev,
+                                  struct nvm_addr addr, struct nvm_ret *ret)
+{
+    return nvm_bbt_get(dev, addr, ret);
+}
+
+static int lnvm_bbt_mark (struct nvm_dev *dev, struct nvm_addr *addrs,
+                              int naddrs, uint16_t flags, struct nvm_ret *ret)
+{
+    return nvm_bbt_mark(dev, addrs, naddrs, flags, ret);
+}
+
+static int lnvm_set_meta_mode (struct nvm_dev *dev, int mode)
+{
+    return nvm_dev_set_meta_mode(dev, mode);
+}
+
+static struct nvm_vblk *lnvm_vblk_alloc (struct nvm_dev *dev,
+                                          struct nvm_addr *addrs, int naddrs)
+{
+    return nvm_vblk_alloc(dev, addrs, naddrs);
+}
+
+static void lnvm_vblk_free (struct nvm_vblk *vblk)
+{
+    nvm_vblk_free(vblk);
+}
+
+static ssize_t lnvm_vblk_pread (struct nvm_vblk *vblk, void *buf,
+                                                   size_t count, size_t offset)
+{
+    return nvm_vblk_pread(vblk, buf, count, offset);
+}
+
+static ssize_t lnvm_vblk_pwrite (struct nvm_vblk *vblk, const void *buf,
+                                                   size_t count, size_t offset)
+{
+    return nvm_vblk_pwrite(vblk, buf, count, offset);
+}
+
+/* Erases are issued in single plane mode, one address per plane of each
+ * block, with the mode carried by the command. The device plane mode is
+ * never switched: background erases run on the service threads while the
+ * reads and writes of the jobs are in flight */
+static ssize_t lnvm_vblk_erase (struct nvm_vblk *vblk)
+{
+    struct nvm_addr addrs[NVM_NADDR_MAX];
+    struct nvm_ret ret;
+    size_t nplanes = nvm_dev_get_geo(vblk->dev)->nplanes;
+    int blk, pl, naddrs = 0;
+
+    for (blk = 0; blk < vblk->nblks; blk++) {
+        for (pl = 0; pl < nplanes; pl++) {
+            addrs[naddrs] = vblk->blks[blk];
+            addrs[naddrs].g.pl = pl;
+            if (++naddrs < NVM_NADDR_MAX)
+                continue;
+
+            if (nvm_addr_erase(vblk->dev, addrs, naddrs,
+                                            NVM_FLAG_PMODE_SNGL, &ret) < 0)
+                return -1;
+            naddrs = 0;
+        }
+    }
+
+    if (naddrs && nvm_addr_erase(vblk->dev, addrs, naddrs,
+                                            NVM_FLAG_PMODE_SNGL, &ret) < 0)
+        return -1;
+
+    return vblk->nbytes;
+}
+
+/* Erases the blocks of several vblks in vectors of up to NVM_NADDR_MAX
+ * addresses, one per plane of each block, with the single plane flag. If a
+ * vector fails, its vblks are erased one by one with lnvm_vblk_erase to find
+ * the failing ones. ns[i] is the latency of the vector, or of the single
+ * erase, of vblks[i] */
+static int lnvm_vblk_erase_v (struct nvm_vblk **vblks, int n, int *err,
+                                                                uint64_t *ns)
+{
+    struct nvm_addr addrs[NVM_NADDR_MAX];
+    struct nvm_dev *dev = vblks[0]->dev;
+    struct nvm_ret ret;
+    size_t nplanes = nvm_dev_get_geo(dev)->nplanes;
+    uint64_t tstart, t;
+    int i, first, blk, pl, naddrs, nfail = 0;
+
+    i = 0;
+    while (i < n) {
+        first = i;
+        naddrs = 0;
+
+        /* A vblk is never split over two vectors */
+        while (i < n && naddrs + vblks[i]->nblks * nplanes <= NVM_NADDR_MAX) {
+            for (blk = 0; blk < vblks[i]->nblks; blk++) {
+                for (pl = 0; pl < nplanes; pl++) {
+                    addrs[naddrs] = vblks[i]->blks[blk];
+                    addrs[naddrs].g.pl = pl;
+                    naddrs++;
+                }
+            }
+            err[i++] = 0;
+        }
+
+        if (i > first) {
+            tstart = fox_timestamp_now ();
+            if (nvm_addr_erase(dev, addrs, naddrs, NVM_FLAG_PMODE_SNGL,
+                                                                &ret) >= 0) {
+                t = fox_timestamp_now () - tstart;
+                for (; first < i; first++)
+                    ns[first] = t;
+                continue;
+            }
+        }
+
+        /* The vector failed, or a single vblk does not fit in one */
+        if (i == first)
+            i++;
+
+        for (; first < i; first++) {
+            tstart = fox_timestamp_now ();
+            err[first] = (lnvm_vblk_erase(vblks[first]) < 0);
+            ns[first] = fox_timestamp_now () - tstart;
+            nfail += err[first];
+        }
+    }
+
+    return nfail;
+}
+
+static struct prov_backend lnvm_backend = {
+    .name           = "liblightnvm",
+    .prefix         = NULL,
+    .dev_open       = lnvm_dev_open,
+    .dev_close      = lnvm_dev_close,
+    .get_geo        = lnvm_get_geo,
+    .get_bbt        = lnvm_get_bbt,
+    .bbt_mark       = lnvm_bbt_mark,
+    .set_meta_mode  = lnvm_set_meta_mode,
+    .vblk_alloc     = lnvm_vblk_alloc,
+    .vblk_free      = lnvm_vblk_free,
+    .vblk_pread     = lnvm_vblk_pread,
+    .vblk_pwrite    = lnvm_vblk_pwrite,
+    .vblk_erase     = lnvm_vblk_erase,
+    .vblk_erase_v   = lnvm_vblk_erase_v,
+    .vblk_submit    = NULL,
+};
+
+int prov_lnvm_init (void)
+{
+    return prov_backend_register(&lnvm_backend);
+}
@@ -70,12 +70,18 @@ static int iso_get_th_type (struct fox_node *node)
     return th_type;
 }
 
-static int iso_read_prepare (struct fox_node *node, struct fox_blkbuf *bufblk)
+static int iso_read_prepare (struct fox_node *node)
 {
-    int ch_i, lun_i, blk_i, blkoff, pg_i, cmd_pgs;
+    int ch_i, lun_i, blk_i, pg_i, cmd_pgs, ret = -1;
     size_t tot_bytes;
     size_t vpg_sz = node->wl->geo->page_nbytes * node->wl->geo->nplanes;
-    uint64_t vwpg;
+    struct nvm_addr ppa;
+    uint8_t *buf;
+
+    buf = aligned_alloc (node->wl->geo->sector_nbytes,
+                            node->wl->nppas * node->wl->geo->sector_nbytes);
+    if (!buf)
+        return -1;
 
     /* Write all blocks for reading threads */
     for (ch_i = 0; ch_i < node->nchs; ch_i++) {
@@ -85,41 +91,35 @@ static int iso_read_prepare (struct fox_node *node, struct fox_blkbuf *bufblk)
                 fox_vblk_tgt(node, node->ch[ch_i], node->lun[lun_i], blk_i);
                 cmd_pgs = node->wl->nppas /(node->wl->geo->nsectors *
                                                         node->wl->geo->nplanes);
-                blkoff = (ch_i * node->nluns) + lun_i;
 
                 for (pg_i = 0; pg_i < node->npgs; pg_i += cmd_pgs) {
                     cmd_pgs = (pg_i + cmd_pgs > node->npgs) ? node->npgs - pg_i
                                                                      : cmd_pgs;
                     tot_bytes = vpg_sz * cmd_pgs;
 
-                    /* Set page in vblk for possible memory comparison */
-                    vwpg = node->vblk_tgt.vblk->blks[0].g.pg;
-                    node->vblk_tgt.vblk->blks[0].g.pg = pg_i;
-
                     /* Fill the buffer with the ppa related data */
-                    fox_wb_geo (bufblk[blkoff].buf_w + vpg_sz * pg_i, tot_bytes,
-                      node->wl->geo, node->vblk_tgt.vblk->blks[0], WB_GEO_FILL);
-
-                    if (prov_vblk_pwrite(node->vblk_tgt.vblk,
-                                        bufblk[blkoff].buf_w + vpg_sz * pg_i,
-                                        tot_bytes,
-                                        vpg_sz * pg_i)!=tot_bytes){
-                        node->vblk_tgt.vblk->blks[0].g.pg = vwpg;
-                        printf ("Engine 3: error when writing to vblk page.n");
-                        return -1;
+                    ppa.ppa = node->vblk_tgt.vblk->blks[0].ppa;
+                    ppa.g.pg = pg_i;
+                    fox_wb_fill (node->wl, 0, buf, tot_bytes, ppa);
+
+                    if (prov_vblk_pwrite(node->vblk_tgt.vblk, buf, tot_bytes,
+                                            vpg_sz * pg_i) != tot_bytes) {
+                        printf ("Engine 3: error when writing to vblk page.\n");
+                        goto FREE;
                     }
-
-                    /* Set page in vblk back to previous position */
-                    node->vblk_tgt.vblk->blks[0].g.pg = vwpg;
                 }
             }
         }
     }
 
-    return 0;
+    ret = 0;
+
+FREE:
+    free (buf);
+    return ret;
 }
 
-static int iso_rw(struct fox_node *node, struct fox_blkbuf *bufblk, uint8_t dir)
+static int iso_rw(struct fox_node *node, uint8_t dir)
 {
     int blk_i, pg_i, lun_i, ch_i, end, ret;
     struct fox_rw_iterator *it;
@@ -139,8 +139,8 @@ static int iso_rw(struct fox_node *node, struct fox_blkbuf *bufblk, uint8_t dir)
             fox_vblk_tgt(node, node->ch[ch_i], node->lun[lun_i], blk_i);
 
             ret = (dir == FOX_READ) ?
-                fox_read_blk(&node->vblk_tgt, node, &bufblk[it->col_w],1,pg_i) :
-                fox_write_blk(&node->vblk_tgt, node, &bufblk[it->col_w],1,pg_i);
+                fox_read_blk(&node->vblk_tgt, node, 1, pg_i) :
+                fox_write_blk(&node->vblk_tgt, node, 1, pg_i);
             if (ret)
                 goto RETURN;
 
@@ -165,88 +165,44 @@ RETURN:
 
 static int iso_read (struct fox_node *node)
 {
-    int ret, blk_i;
-    struct fox_blkbuf *bufblk;
     int totblk = node->nchs * node->nluns * node->nblks;
 
-    bufblk = malloc(sizeof (struct fox_blkbuf) * node->nchs * node->nluns);
-    if (!bufblk)
-        return -1;
-
-    for (blk_i = 0; blk_i < node->nchs * node->nluns; blk_i++) {
-        if (fox_alloc_blk_buf (node, &bufblk[blk_i])) {
-            fox_free_blkbuf(bufblk, blk_i);
-            goto BUFBLK;
-        }
-    }
-
     printf(" - TID %d: READ", node->nid);
 
     /* If 100 % reads, FOX already prepared the blocks */
     if (node->wl->w_factor > 0) {
         printf(" - Filling up %d blocks...\n", totblk);
-        ret = iso_read_prepare (node, bufblk);
-        if (ret)
-            goto FREE_BUF;
+        if (iso_read_prepare (node))
+            return -1;
     } else
         printf("\n");
 
     fox_start_node (node);
 
-    if (iso_rw (node, bufblk, FOX_READ)) {
+    if (iso_rw (node, FOX_READ)) {
         fox_end_node (node);
-        goto FREE_BUF;
+        return -1;
     }
 
     fox_end_node (node);
-    fox_free_blkbuf (bufblk, node->nchs * node->nluns);
-    free (bufblk);
 
     return 0;
-
-FREE_BUF:
-    fox_free_blkbuf(bufblk, node->nchs * node->nluns);
-BUFBLK:
-    free (bufblk);
-    return -1;
 }
 
 static int iso_write (struct fox_node *node)
 {
-    int blk_i;
-    struct fox_blkbuf *bufblk;
-
-    bufblk = malloc(sizeof (struct fox_blkbuf) * node->nchs * node->nluns);
-    if (!bufblk)
-        return -1;
-
-    for (blk_i = 0; blk_i < node->nchs * node->nluns; blk_i++) {
-        if (fox_alloc_blk_buf (node, &bufblk[blk_i])) {
-            fox_free_blkbuf(bufblk, blk_i);
-            goto BUFBLK;
-        }
-    }
-
     printf(" - TID %d: WRITE\n", node->nid);
 
     fox_start_node (node);
 
-    if (iso_rw (node, bufblk, FOX_WRITE)) {
+    if (iso_rw (node, FOX_WRITE)) {
         fox_end_node (node);
-        goto FREE_BUF;
+        return -1;
     }
 
     fox_end_node (node);
-    fox_free_blkbuf (bufblk, node->nchs * node->nluns);
-    free (bufblk);
 
     return 0;
-
-FREE_BUF:
-    fox_free_blkbuf(bufblk, node->nchs * node->nluns);
-BUFBLK:
-    free (bufblk);
-    return -1;
 }
 
 static int iso_start (struct fox_node *node)
@@ -44,7 +44,6 @@
 #include <stdlib.h>
 #include "../fox.h"
 
-#define BUF_SBLK_COUNT 0x4
 #define BUF_DELAY_READ 0x0
 
 struct rr_var {
@@ -60,7 +59,6 @@ struct rr_var {
     int w_i;
     uint8_t end;
     struct fox_rw_iterator *it;
-    struct fox_blkbuf *bufblk;
 };
 
 static int rr_write_factor (struct fox_node *node, struct rr_var *var)
@@ -74,8 +72,7 @@ static int rr_write_factor (struct fox_node *node, struct rr_var *var)
         fox_vblk_tgt(node, node->ch[var->ch_i], node->lun[var->lun_i],
                                                                     var->blk_i);
 
-        if (fox_write_blk(&node->vblk_tgt, node, &var->bufblk[var->it->col_w],
-                                                                 1, var->pg_i))
+        if (fox_write_blk(&node->vblk_tgt, node, 1, var->pg_i))
             return -1;
 
         if (fox_iterator_next(var->it, FOX_WRITE)) {
@@ -89,8 +86,6 @@ static int rr_write_factor (struct fox_node *node, struct rr_var *var)
 
 static int rr_read_factor (struct fox_node *node, struct rr_var *var)
 {
-    uint16_t sblk_pgs = var->pgs_sblk * BUF_SBLK_COUNT;
-
     while (var->roff < node->wl->r_factor) {
         var->w_i = (var->it->row_w * var->ncol) + var->it->col_w;
         var->r_i = (var->it->row_r * var->ncol) + var->it->col_r;
@@ -98,22 +93,15 @@ static int rr_read_factor (struct fox_node *node, struct rr_var *var)
         if (BUF_DELAY_READ && var->w_i < var->pgs_sblk)
             return 0;
 
-        /* (1)Avoiding reading pages that are not programmed yet.
-         * (2)The buffer size is var->pgs_sblk * BUF_SBLK_COUNT.
-         *    To perform memcmp correctly, it keeps the read pointer
-         *    within var->pgs_sblk previous pages.  */
+        /* Avoiding reading pages that are not programmed yet. The expected
+         * data is rebuilt from the page address, so any programmed page can
+         * be read. When reads catch up, they restart one superblock behind */
         if (var->r_i >= var->w_i && !var->end) {
             do {
                 fox_iterator_prior(var->it, FOX_READ);
                 var->w_i = (var->it->row_w * var->ncol) + var->it->col_w;
                 var->r_i = (var->it->row_r * var->ncol) + var->it->col_r;
-            } while (var->r_i > 0 && var->r_i > var->w_i - sblk_pgs);
-        } else if (var->r_i < var->w_i - sblk_pgs) {
-            do {
-                fox_iterator_next(var->it, FOX_READ);
-                var->w_i = (var->it->row_w * var->ncol) + var->it->col_w;
-                var->r_i = (var->it->row_r * var->ncol) + var->it->col_r;
-            } while (var->r_i < var->w_i - sblk_pgs);
+            } while (var->r_i > 0 && var->r_i > var->w_i - var->pgs_sblk);
         }
 
         var->pg_i = var->it->row_r % node->npgs;
@@ -123,8 +111,7 @@ static int rr_read_factor (struct fox_node *node, struct rr_var *var)
 
         fox_vblk_tgt(node, node->ch[var->ch_i], node->lun[var->lun_i],
                                                                    var->blk_i);
-        if (fox_read_blk(&node->vblk_tgt, node, &var->bufblk[var->it->col_r], 1,
-                                                                    var->pg_i))
+        if (fox_read_blk(&node->vblk_tgt, node, 1, var->pg_i))
             return -1;
 
         fox_iterator_next(var->it, FOX_READ);
@@ -144,8 +131,7 @@ static int rr_read_100 (struct fox_node *node, struct rr_var *var)
 
         fox_vblk_tgt(node, node->ch[var->ch_i], node->lun[var->lun_i],
                                                                    var->blk_i);
-        if (fox_read_blk(&node->vblk_tgt, node, &var->bufblk[var->it->col_w],
-                                                                 1, var->pg_i))
+        if (fox_read_blk(&node->vblk_tgt, node, 1, var->pg_i))
             return -1;
 
         if (fox_iterator_next(var->it, FOX_READ))
@@ -158,35 +144,15 @@ static int rr_read_100 (struct fox_node *node, struct rr_var *var)
 
 static int rr_init_var (struct fox_node *node, struct rr_var *var)
 {
-    uint16_t blks = node->nchs * node->nluns * BUF_SBLK_COUNT;
-
     node->stats.pgs_done = 0;
     var->ncol = node->nluns * node->nchs;
     var->pgs_sblk = var->ncol * node->npgs;
 
     var->it = fox_iterator_new(node);
     if (!var->it)
-        goto OUT;
-
-    var->bufblk = malloc(sizeof(struct fox_blkbuf) * blks);
-    if (!var->bufblk)
-        goto ITERATOR;
-
-    for (var->blk_i = 0; var->blk_i < blks; var->blk_i++) {
-        if (fox_alloc_blk_buf (node, &var->bufblk[var->blk_i])) {
-            fox_free_blkbuf(var->bufblk, var->blk_i);
-            goto BUFBLK;
-        }
-    }
+        return -1;
 
     return 0;
-
-BUFBLK:
-    free (var->bufblk);
-ITERATOR:
-    fox_iterator_free(var->it);
-OUT:
-    return -1;
 }
 
 static int rr_start (struct fox_node *node)
@@ -237,7 +203,7 @@ BREAK:
     } while (1);
 
     fox_end_node (node);
-    fox_free_blkbuf(var.bufblk, node->nchs * node->nluns);
+    fox_iterator_free(var.it);
 
     return 0;
 }
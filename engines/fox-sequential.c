@@ -50,16 +50,12 @@ static int seq_start (struct fox_node *node)
     uint16_t t_luns, blk_lun, blk_ch, pgoff_r, pgoff_w, npgs, aux_r;
     int ch_i, lun_i, blk_i;
     node->stats.pgs_done = 0;
-    struct fox_blkbuf nbuf;
 
     t_luns = node->nluns * node->nchs;
     t_blks = node->nblks * t_luns;
     blk_lun = t_blks / t_luns;
     blk_ch = blk_lun * node->nluns;
 
-    if (fox_alloc_blk_buf (node, &nbuf))
-        goto OUT;
-
     fox_start_node (node);
 
     do {
@@ -81,7 +77,7 @@ static int seq_start (struct fox_node *node)
                     npgs = (pgoff_w + node->wl->w_factor > node->npgs) ?
                                     node->npgs - pgoff_w : node->wl->w_factor;
 
-                if (fox_write_blk(&node->vblk_tgt,node,&nbuf,npgs,pgoff_w))
+                if (fox_write_blk(&node->vblk_tgt,node,npgs,pgoff_w))
                     goto BREAK;
                 pgoff_w += npgs;
 
@@ -92,7 +88,7 @@ static int seq_start (struct fox_node *node)
                     npgs = (pgoff_r + node->wl->r_factor > pgoff_w) ?
                                     pgoff_w - pgoff_r : node->wl->r_factor;
 
-                    if (fox_read_blk(&node->vblk_tgt,node,&nbuf,npgs,pgoff_r))
+                    if (fox_read_blk(&node->vblk_tgt,node,npgs,pgoff_r))
                         goto BREAK;
 
                     aux_r += npgs;
@@ -104,11 +100,9 @@ static int seq_start (struct fox_node *node)
 READ:
             /* 100 % reads */
             if (node->wl->w_factor == 0) {
-                if (fox_read_blk (&node->vblk_tgt,node,&nbuf,node->npgs,0))
+                if (fox_read_blk (&node->vblk_tgt,node,node->npgs,0))
                     goto BREAK;
             }
-            if (node->wl->r_factor > 0)
-                fox_blkbuf_reset(node, &nbuf);
         }
 
 BREAK:
@@ -123,11 +117,7 @@ BREAK:
     } while (1);
 
     fox_end_node (node);
-    fox_free_blkbuf (&nbuf, 1);
     return 0;
-
-OUT:
-    return -1;
 }
 
 static void seq_exit (void)
@@ -15,6 +15,7 @@ static char doc_global[] = "\n*** FOX v1.2 ***\n"
         "  erase            Erases a specific range of physical blocks.\n"
         "  write            Writes to a specific range of physical pages.\n"
         "  read             Reads from a specific range of physical pages.\n"
+        "  trace            Converts and summarizes a binary I/O trace.\n"
         "\n Examples:"
         "\n  fox run <parameters>     - custom configuration"
         "\n  fox --help               - show available parameters"
@@ -52,6 +53,16 @@ static char doc_read[] =
         "\n Hints: Use -v for printing the data in the screen."
         "\n        Use -o for creating an binary output file.";
 
+static char doc_trace[] =
+        "\nUse this command for reading a binary I/O trace (fox_io.bin) "
+        "generated by 'fox run -o'. Without -c, the workload header and the "
+        "latency percentiles are printed.\n"
+        "\n Example:"
+        "\n     - Converts a trace to CSV:"
+        "\n        fox trace -f output/<timestamp>_fox_io.bin -c > io.csv\n"
+        "\n     - Shows percentiles and a per LUN summary:"
+        "\n        fox trace -f output/<timestamp>_fox_io.bin -l";
+
 static char doc_run[] =
         "\nUse this command to run FOX based on parameters by the"
         " command line.\n"
@@ -71,11 +82,19 @@ static char doc_run[] =
         "\n     vector   = 1 page = <sectors per page * number of planes>"
         "\n     sleep    = 0"
         "\n     memcmp   = disabled"
+        "\n     verifiers= 1 (with memcmp)"
+        "\n     erases   = 2 (in background)"
+        "\n     wear     = fifo"
         "\n     output   = disabled"
-        "\n     engine   = 1 (sequential)";
+        "\n     hlog     = disabled"
+        "\n     rate     = unlimited"
+        "\n     engine   = 1 (sequential)"
+        "\n     iodepth  = 1";
 
 static struct argp_option opt_run[] = {
-    {"device", 'd', "<char>", 0,"Device name. e.g: /dev/nvme0n1"},
+    {"device", 'd', "<char>", 0,"Device name. e.g: /dev/nvme0n1. Use "
+    "emu:<file>?ch=<int>&lun=<int>&blk=<int>&pg=<int> for the file-backed "
+    "emulator."},
     {"runtime", 't', "<int>", 0, "Runtime in seconds. If 0 or not present, "
     "the workload will finish when all pages are done in a given geometry."},
     {"channels", 'c', "<int>", 0, "Number of channels."},
@@ -94,13 +113,64 @@ static struct argp_option opt_run[] = {
     "I/Os in a maximum of <sleep> u-seconds."},
     {"memcmp", 'm', "<int>", 0, "If included, this argument it enables buffer "
     "comparison between write and read buffers. Data types available: "
-    "(1)random data, (2)human readable, (3)geometry based. These cases only "
-    "support geometry based data: 100% reads, Engine 3 (isolation)."},
+    "(1)random data, (2)human readable, (3)geometry based. Data is generated "
+    "from the page address and rebuilt when the page is read."},
     {"output", 'o', NULL, OPTION_ARG_OPTIONAL, "If present, a set of output "
     "files will be generated. (1)metadata, (2)per I/O information, "
     "(3)real time average information"},
     {"engine", 'e', "<int>", 0, "I/O engine ID. (1)sequential, (2)round-robin,"
     " (3)isolation. Please check documentation for detailed information."},
+    {"iodepth", 'q', "<int>", 0, "Number of commands kept in flight per job. "
+    "Commands to the same LUN are completed in order. Maximum of 1024."},
+    {"hlog", 'H', NULL, OPTION_ARG_OPTIONAL, "If present, read, write and "
+    "erase latency histograms are written under ./output in HdrHistogram "
+    "log format (.hlog). Values are in n-seconds."},
+    {"rate-iops", CMDARG_OPT_RATE_IOPS, "<int>", 0, "Limits the workload to "
+    "<int> commands per second. Commands are paced by a token bucket."},
+    {"rate-bw", CMDARG_OPT_RATE_BW, "<int>", 0, "Limits the workload to "
+    "<int> MB per second."},
+    {"rate-per-job", CMDARG_OPT_RATE_JOB, NULL, OPTION_ARG_OPTIONAL, "If "
+    "present, --rate-iops and --rate-bw are applied to each job instead of "
+    "the whole workload."},
+    {"arrival", CMDARG_OPT_ARRIVAL, "<char>", 0, "Open-loop arrival, "
+    "(const) or (poisson) at --rate-iops. Commands are issued at scheduled "
+    "times regardless of completions, latency is measured from the scheduled "
+    "time and the time spent waiting for a free slot is shown as queue "
+    "delay."},
+    {"seed", CMDARG_OPT_SEED, "<int>", 0, "Seed of the data and arrival "
+    "generators. If not present, a seed is taken from the clock. The seed "
+    "is shown in the workload and in the metadata file, a run with the same "
+    "seed and parameters writes the same data."},
+    {"compress", CMDARG_OPT_COMPRESS, "<float>", 0, "Target compression "
+    "ratio of random data, e.g. 2.5. Each sector holds 1/<ratio> random bytes "
+    "and zeros."},
+    {"dedup", CMDARG_OPT_DEDUP, "<int>", 0, "Percentage of sectors holding "
+    "one of a small set of duplicated payloads, e.g. 30%."},
+    {"verifiers", CMDARG_OPT_VERIFIERS, "<int>", 0, "Number of threads "
+    "verifying read data with -m, default 1. Jobs issue the next command "
+    "while the previous one is verified. If 0, reads are verified by the "
+    "jobs."},
+    {"refresh-bbt", CMDARG_OPT_REFRESH_BBT, NULL, OPTION_ARG_OPTIONAL, "If "
+    "present, bad block tables are read from the device and the cache under "
+    "./bbt is rewritten."},
+    {"bbt-age", CMDARG_OPT_BBT_AGE, "<int>", 0, "Seconds a cached bad block "
+    "table is used, default 86400. If 0, the cache is not used."},
+    {"prefill", CMDARG_OPT_PREFILL, NULL, OPTION_ARG_OPTIONAL, "If present, "
+    "100% read workloads program their blocks even if a previous run left "
+    "the same data under ./dataset."},
+    {"erase-depth", CMDARG_OPT_ERASE_DEPTH, "<int>", 0, "Number of blocks "
+    "erased in the background per job, default 2. When a pass ends, blocks "
+    "are erased in write order while the next pass runs. If 0, all blocks "
+    "are erased before the next pass."},
+    {"rotate", CMDARG_OPT_ROTATE, NULL, OPTION_ARG_OPTIONAL, "If present, "
+    "each pass takes the next free blocks of every LUN and returns the "
+    "blocks of the last pass, so long runs cover the whole device."},
+    {"wear", CMDARG_OPT_WEAR, "<char>", 0, "Choice of free blocks by erase "
+    "count: 'fifo' (default), 'least', 'most' or 'random'. Erase counts are "
+    "kept under ./wear between runs."},
+    {"stripe", CMDARG_OPT_STRIPE, "<int>", 0, "Number of LUNs each block "
+    "is striped over, default 1. A block takes one block of its LUN and of "
+    "the next LUNs of the job, consecutive pages go to consecutive LUNs."},
     {0}
 };
 
@@ -141,13 +211,24 @@ static struct argp_option opt_read[] = {
     {0}
 };
 
+static struct argp_option opt_trace[] = {
+    {"file", 'f', "<char>", 0, "Binary trace file (fox_io.bin)."},
+    {"csv", 'c', NULL, OPTION_ARG_OPTIONAL, "Prints one CSV line per I/O: "
+    "sequence;node_sequence;node_id;channel;lun;block;page;start;end;latency;"
+    "queue_delay;type;is_failed;read_memcmp;bytes"},
+    {"lun", 'l', NULL, OPTION_ARG_OPTIONAL, "Prints a per LUN summary."},
+    {"percentiles", 'p', NULL, OPTION_ARG_OPTIONAL, "Prints read and write "
+    "latency percentiles (default if -c and -l are not present)."},
+    {0}
+};
+
 static error_t parse_opt_run (int key, char *arg, struct argp_state *state)
 {
     struct fox_argp *args = state->input;
 
     switch (key) {
         case 'd':
-            if (!arg || strlen(arg) == 0 || strlen(arg) > CMDARG_LEN)
+            if (!arg || strlen(arg) == 0 || strlen(arg) >= CMDARG_LEN)
                 argp_usage(state);
             strcpy(args->devname,arg);
             args->arg_num++;
@@ -242,6 +323,126 @@ static error_t parse_opt_run (int key, char *arg, struct argp_state *state)
             args->arg_num++;
             args->arg_flag |= CMDARG_FLAG_E;
             break;
+        case 'q':
+            if (!arg)
+                argp_usage(state);
+            args->iodepth = atoi (arg);
+            args->arg_num++;
+            args->arg_flag |= CMDARG_FLAG_Q;
+            break;
+        case 'H':
+            args->hlog = 1;
+            args->arg_num++;
+            args->arg_flag |= CMDARG_FLAG_H;
+            break;
+        case CMDARG_OPT_RATE_IOPS:
+            if (!arg)
+                argp_usage(state);
+            args->rate_iops = strtoull (arg, NULL, 10);
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_RATE_BW:
+            if (!arg)
+                argp_usage(state);
+            args->rate_bw = atoi (arg);
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_RATE_JOB:
+            args->rate_job = 1;
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_SEED:
+            if (!arg)
+                argp_usage(state);
+            args->seed = strtoull (arg, NULL, 0);
+            args->seed_set = 1;
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_COMPRESS:
+            if (!arg)
+                argp_usage(state);
+            args->compress = strtod (arg, NULL);
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_DEDUP:
+            if (!arg)
+                argp_usage(state);
+            if (atoi (arg) < 0 || atoi (arg) > 100)
+                argp_usage(state);
+            args->dedup = atoi (arg);
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_VERIFIERS:
+            if (!arg)
+                argp_usage(state);
+            if (atoi (arg) < 0 || atoi (arg) > 64)
+                argp_usage(state);
+            args->verifiers = atoi (arg);
+            args->verifiers_set = 1;
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_REFRESH_BBT:
+            args->refresh_bbt = 1;
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_PREFILL:
+            args->prefill = 1;
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_ERASE_DEPTH:
+            if (!arg)
+                argp_usage(state);
+            if (atoi (arg) < 0 || atoi (arg) > 64)
+                argp_usage(state);
+            args->erase_depth = atoi (arg);
+            args->erase_depth_set = 1;
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_ROTATE:
+            args->rotate = 1;
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_STRIPE:
+            if (!arg)
+                argp_usage(state);
+            if (atoi (arg) < 1 || atoi (arg) > 64)
+                argp_usage(state);
+            args->stripe = atoi (arg);
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_BBT_AGE:
+            if (!arg)
+                argp_usage(state);
+            args->bbt_age = strtoul (arg, NULL, 10);
+            args->bbt_age_set = 1;
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_ARRIVAL:
+            if (!arg)
+                argp_usage(state);
+            if (!strcmp (arg, "const"))
+                args->arrival = FOX_ARRIVAL_CONST;
+            else if (!strcmp (arg, "poisson"))
+                args->arrival = FOX_ARRIVAL_POISSON;
+            else
+                argp_usage(state);
+            args->arg_num++;
+            break;
+        case CMDARG_OPT_WEAR:
+            if (!arg)
+                argp_usage(state);
+            if (!strcmp (arg, "fifo"))
+                args->wear = PROV_WEAR_FIFO;
+            else if (!strcmp (arg, "least"))
+                args->wear = PROV_WEAR_LEAST;
+            else if (!strcmp (arg, "most"))
+                args->wear = PROV_WEAR_MOST;
+            else if (!strcmp (arg, "random"))
+                args->wear = PROV_WEAR_RANDOM;
+            else
+                argp_usage(state);
+            args->arg_num++;
+            break;
         case ARGP_KEY_END:
         case ARGP_KEY_ARG:
         case ARGP_KEY_NO_ARGS:
@@ -263,7 +464,7 @@ static error_t parse_opt_io (int key, char *arg, struct argp_state *state)
 
     switch (key) {
         case 'd':
-            if (!arg || strlen(arg) == 0 || strlen(arg) > CMDARG_LEN)
+            if (!arg || strlen(arg) == 0 || strlen(arg) >= CMDARG_LEN)
                 argp_usage(state);
             strcpy(args->devname,arg);
             args->arg_num++;
@@ -334,6 +535,48 @@ static error_t parse_opt_io (int key, char *arg, struct argp_state *state)
     return 0;
 }
 
+static error_t parse_opt_trace (int key, char *arg, struct argp_state *state)
+{
+    struct fox_argp *args = state->input;
+
+    switch (key) {
+        case 'f':
+            if (!arg || strlen(arg) == 0 || strlen(arg) >= CMDARG_LEN)
+                argp_usage(state);
+            strcpy(args->trace_file,arg);
+            args->arg_num++;
+            args->arg_flag |= CMDARG_FLAG_D;
+            break;
+        case 'c':
+            args->trace_out |= FOX_TRACE_CSV;
+            args->arg_num++;
+            args->arg_flag |= CMDARG_FLAG_C;
+            break;
+        case 'l':
+            args->trace_out |= FOX_TRACE_LUN;
+            args->arg_num++;
+            args->arg_flag |= CMDARG_FLAG_L;
+            break;
+        case 'p':
+            args->trace_out |= FOX_TRACE_PCT;
+            args->arg_num++;
+            args->arg_flag |= CMDARG_FLAG_P;
+            break;
+        case ARGP_KEY_END:
+        case ARGP_KEY_ARG:
+        case ARGP_KEY_NO_ARGS:
+        case ARGP_KEY_ERROR:
+        case ARGP_KEY_SUCCESS:
+        case ARGP_KEY_FINI:
+        case ARGP_KEY_INIT:
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
 static void cmd_prepare(struct argp_state *state, struct fox_argp *args,
                                               char *cmd, struct argp *argp_cmd)
 {
@@ -359,6 +602,7 @@ static struct argp argp_run     = {opt_run, parse_opt_run, 0, doc_run};
 static struct argp argp_erase   = {opt_erase, parse_opt_io, 0, doc_erase};
 static struct argp argp_write   = {opt_write, parse_opt_io, 0, doc_write};
 static struct argp argp_read    = {opt_read, parse_opt_io, 0, doc_read};
+static struct argp argp_trace   = {opt_trace, parse_opt_trace, 0, doc_trace};
 
 error_t parse_opt (int key, char *arg, struct argp_state *state)
 {
@@ -387,6 +631,11 @@ error_t parse_opt (int key, char *arg, struct argp_state *state)
                 args->cmdtype = CMDARG_READ;
                 cmd_prepare(state, args, "read", &argp_read);
 
+            } else if (strcmp(arg, "trace") == 0) {
+
+                args->cmdtype = CMDARG_TRACE;
+                cmd_prepare(state, args, "trace", &argp_trace);
+
             }
             break;
         default:
@@ -413,6 +662,8 @@ int fox_argp_init (int argc, char **argv, struct fox_argp *args_global)
         case CMDARG_WRITE:
         case CMDARG_READ:
             return FOX_IO_MODE;
+        case CMDARG_TRACE:
+            return FOX_TRACE_MODE;
         default:
             printf("Invalid command, please use --help to see more info.\n");
     }
@@ -37,26 +37,69 @@
 
 #include "fox.h"
 
-#define FOX_BUF_WRITE 0x1
-#define FOX_BUF_READ  0x0
+/* Counter-based generator (splitmix64 finalizer). Every 8-byte word is a
+ * function of its sector address, the word index and the key, so a payload
+ * can be rebuilt at any time and no write buffer needs to be kept. */
+static inline uint64_t fox_wb_mix (uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t fox_prng_rotl (uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
 
-void fox_wb_random (uint8_t *wb, size_t sz)
+/* Seeds a xoshiro256** generator. Each 'stream' (e.g. the node id) gets an
+ * independent sequence for the same seed */
+void fox_prng_init (struct fox_prng *prng, uint64_t seed, uint64_t stream)
 {
+    uint64_t x = seed ^ fox_wb_mix (stream + 0x9e3779b97f4a7c15ULL);
     int i;
-    uint8_t byte = 0xff;
 
-    srand(time (NULL));
-    for (i = 0; i < sz; i += 16) {
-        byte = rand() % 255;
-        memset (&wb[i], byte, 16);
+    for (i = 0; i < 4; i++) {
+        x += 0x9e3779b97f4a7c15ULL;
+        prng->s[i] = fox_wb_mix (x);
+    }
+}
+
+uint64_t fox_prng_next (struct fox_prng *prng)
+{
+    uint64_t *s = prng->s;
+    uint64_t ret = fox_prng_rotl (s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = fox_prng_rotl (s[3], 45);
+
+    return ret;
+}
+
+void fox_wb_random (uint8_t *wb, size_t sz, uint64_t seed)
+{
+    struct fox_prng prng;
+    uint64_t word;
+    size_t i;
+
+    fox_prng_init (&prng, seed, 0);
+    for (i = 0; i < sz; i += sizeof (uint64_t)) {
+        word = fox_prng_next (&prng);
+        memcpy (&wb[i], &word, (sz - i < 8) ? sz - i : 8);
     }
 }
 
 void fox_wb_readable(char *buf, int npgs, const struct nvm_geo *geo,
-                                                         struct nvm_addr ppa)
+                                          struct nvm_addr ppa, uint64_t seed)
 {
     unsigned int written;
-    int pg_lines, i, pg;
+    int pg_lines, i, pg, end_pg;
     char aux[9];
     char input_char;
     uint32_t pl_sz;
@@ -66,11 +109,13 @@ void fox_wb_readable(char *buf, int npgs, const struct nvm_geo *geo,
     pl_sz = geo->nplanes * geo->page_nbytes;
     pg_lines = pl_sz / 64;
 
-    for (pg = ppa.g.pg; pg < ppa.g.pg + npgs; pg++) {
-        srand(time(NULL) + pg);
+    end_pg = ppa.g.pg + npgs;
+
+    for (pg = ppa.g.pg; pg < end_pg; pg++) {
         val[8] = pg;
+        ppa.g.pg = pg;
         for (i = 0; i < pg_lines - 1; i++) {
-            input_char = (rand() % 93) + 33;
+            input_char = (fox_wb_mix ((ppa.ppa ^ seed) + i) % 93) + 33;
             switch (i) {
                 case 0:
                     break;
@@ -121,12 +166,15 @@ PRINT:
     }
 }
 
-int fox_wb_geo (uint8_t *wb, size_t sz, const struct nvm_geo *geo,
-                                               struct nvm_addr ppa, uint8_t op)
+/* Fills (WB_GEO_FILL) or compares (WB_GEO_CMP) geometry data. A compare
+ * returns the offset of the first differing byte or -1 if the data matches.
+ * Sectors are processed by the SIMD kernels in fox-simd.c */
+static ssize_t fox_wb_geo_sec (uint8_t *wb, size_t sz,
+                   const struct nvm_geo *geo, struct nvm_addr ppa, uint8_t op)
 {
     uint16_t nsec, sec_i;
-    uint32_t byte_i;
-    uint64_t sum, cmpl, cmph;
+    uint64_t sum;
+    ssize_t off;
     struct nvm_addr cppa;
     uint8_t *wboff;
 
@@ -135,12 +183,12 @@ int fox_wb_geo (uint8_t *wb, size_t sz, const struct nvm_geo *geo,
 
         printf ("\n buf: Buffer is not multiple of sector size or too large.");
         if (op == WB_GEO_FILL) {
-            fox_wb_random (wb, sz);
+            fox_wb_random (wb, sz, ppa.ppa);
             printf (" Filled with random data.\n");
         } else
             printf (" Comparison not performed.\n");
 
-        return 0;
+        return -1;
     }
 
     nsec = sz / geo->sector_nbytes;
@@ -160,127 +208,163 @@ int fox_wb_geo (uint8_t *wb, size_t sz, const struct nvm_geo *geo,
 
         sum = (uint64_t) (cppa.g.sec + cppa.g.pl + cppa.g.pg +
                                            cppa.g.blk + cppa.g.lun + cppa.g.ch);
-        cmpl = cppa.ppa;
-        cmph = sum;
-        for (byte_i = 0; byte_i < geo->sector_nbytes; byte_i += 16) {
-            cmpl += (uint64_t) byte_i;
-            cmph += (uint64_t) byte_i;
-
-            if (op == WB_GEO_FILL) {
-                memcpy (&wboff[byte_i], &cmpl, 8);
-                memcpy (&wboff[byte_i + 8], &cmph, 8);
-            } else
-                if (    memcmp (&wboff[byte_i], &cmpl, 8) ||
-                        memcmp (&wboff[byte_i + 8], &cmph, 8))
-                    return -1;
+
+        if (op == WB_GEO_FILL) {
+            fox_simd_geo_fill (wboff, geo->sector_nbytes / 16, cppa.ppa, sum);
+            continue;
         }
+
+        off = fox_simd_geo_cmp (wboff, geo->sector_nbytes / 16, cppa.ppa, sum);
+        if (off >= 0)
+            return sec_i * geo->sector_nbytes + off;
     }
 
-    return 0;
+    return -1;
 }
 
-static void *fox_alloc_blk_buf_t (struct fox_node *node, uint8_t type)
+int fox_wb_geo (uint8_t *wb, size_t sz, const struct nvm_geo *geo,
+                                               struct nvm_addr ppa, uint8_t op)
 {
-    void *buf;
-    size_t vpg_sz = node->wl->geo->page_nbytes * node->wl->geo->nplanes;
-    size_t size = node->npgs * vpg_sz;
-    struct nvm_addr ppa;
-
-    buf = aligned_alloc (node->wl->geo->sector_nbytes, size);
-    if (!buf)
-        return buf;
-
-    ppa.ppa = 0;
-    if (type == FOX_BUF_WRITE) {
-        switch (node->wl->memcmp) {
-            case WB_READABLE:
-                fox_wb_readable (buf, node->npgs, node->wl->geo, ppa);
-                break;
-            case WB_GEOMETRY:
-                fox_wb_geo (buf, size, node->wl->geo, ppa, WB_GEO_FILL);
-                break;
-            case WB_RANDOM:
-            case WB_DISABLE:
-            default:
-                fox_wb_random (buf, size);
-        }
-    } else
-        memset (buf, 0x0, size);
-    return buf;
+    return (fox_wb_geo_sec (wb, sz, geo, ppa, op) < 0) ? 0 : -1;
 }
 
-int fox_alloc_blk_buf (struct fox_node *node, struct fox_blkbuf *buf)
+/* Data profile (--compress, --dedup). FOX_WB_TPLS template sectors are
+ * built at start: a random part of sector_nbytes / ratio bytes followed by
+ * zeros. A sector is a copy of a template with its first 16 bytes replaced
+ * by a token. Unique sectors get a token from their address, duplicates get
+ * one of FOX_WB_DUPS tokens shared by the whole device. */
+#define FOX_WB_TPLS     64
+#define FOX_WB_DUPS     16
+
+int fox_wb_profile_init (struct fox_workload *wl)
 {
-    buf->buf_r = fox_alloc_blk_buf_t(node, FOX_BUF_READ);
-    buf->buf_w = fox_alloc_blk_buf_t(node, FOX_BUF_WRITE);
+    size_t rnd_sz, sec_sz = wl->geo->sector_nbytes;
+    int tpl_i;
 
-    if (!buf->buf_w || !buf->buf_r)
+    wl->wb_tpl = NULL;
+    if (wl->compress <= 1.0 && !wl->dedup)
+        return 0;
+
+    wl->wb_tpl = aligned_alloc (sec_sz, sec_sz * FOX_WB_TPLS);
+    if (!wl->wb_tpl)
         return -1;
+    memset (wl->wb_tpl, 0x0, sec_sz * FOX_WB_TPLS);
+
+    rnd_sz = (wl->compress > 1.0) ? sec_sz / wl->compress : sec_sz;
+    rnd_sz = (rnd_sz < 16) ? 16 : rnd_sz;
+
+    for (tpl_i = 0; tpl_i < FOX_WB_TPLS; tpl_i++)
+        fox_wb_random (wl->wb_tpl + sec_sz * tpl_i, rnd_sz, wl->seed + tpl_i);
 
     return 0;
 }
 
-void fox_blkbuf_reset (struct fox_node *node, struct fox_blkbuf *buf)
+void fox_wb_profile_exit (struct fox_workload *wl)
 {
-    size_t vpg_sz = node->wl->geo->page_nbytes * node->wl->geo->nplanes;
-    memset (buf->buf_r, 0x0, node->npgs * vpg_sz);
+    free (wl->wb_tpl);
+    wl->wb_tpl = NULL;
 }
 
-void fox_free_blkbuf (struct fox_blkbuf *buf, int count)
+static void fox_wb_tpl (struct fox_workload *wl, uint8_t *wb, uint64_t addr,
+                                                                uint64_t key)
 {
-    int i;
+    uint64_t h = fox_wb_mix (addr ^ wl->seed);
+    uint64_t token[2];
 
-    for (i = 0; i < count; i++) {
-        free (buf[i].buf_r);
-        free (buf[i].buf_w);
-    }
+    memcpy (wb, wl->wb_tpl + wl->geo->sector_nbytes * (h % FOX_WB_TPLS),
+                                                    wl->geo->sector_nbytes);
+
+    /* Duplicated payloads change with the pass, as 'key' does, so a stale
+     * dedup sector fails the comparison */
+    if ((h >> 32) % 100 < wl->dedup)
+        token[0] = fox_wb_mix (key ^ ((h >> 16) % FOX_WB_DUPS));
+    else
+        token[0] = fox_wb_mix (addr ^ key);
+    token[1] = fox_wb_mix (token[0]);
+
+    memcpy (wb, token, sizeof (token));
 }
 
-int fox_blkbuf_cmp (struct fox_node *node, struct fox_blkbuf *buf,
-                           uint16_t pgoff, uint16_t npgs, struct nvm_vblk *vblk)
+static void fox_wb_gen (struct fox_workload *wl, uint8_t *wb, size_t sz,
+                                            struct nvm_addr ppa, uint64_t key)
 {
-    int ret;
-    uint8_t *offw, *offr;
-    size_t vpg_sz = node->wl->geo->page_nbytes * node->wl->geo->nplanes;
-    struct nvm_addr ppa;
+    const struct nvm_geo *geo = wl->geo;
+    uint32_t nsec, sec_i, word_i, nwords, sec_vpg;
+    uint64_t skey, *word;
+    struct nvm_addr sppa;
 
-    if (!node->wl->memcmp)
-        return -1;
+    nsec = sz / geo->sector_nbytes;
+    nwords = geo->sector_nbytes / sizeof (uint64_t);
+    sec_vpg = geo->nsectors * geo->nplanes;
 
-    if (pgoff + npgs > node->npgs) {
-        printf ("Wrong memcmp offset. pg (%d) > pgs_per_blk (%d).\n",
-                                               pgoff + npgs, (int) node->npgs);
-        return -1;
+    sppa.ppa = ppa.ppa;
+    for (sec_i = 0; sec_i < nsec; sec_i++) {
+        sppa.g.pg = ppa.g.pg + sec_i / sec_vpg;
+        sppa.g.pl = (sec_i % sec_vpg) / geo->nsectors;
+        sppa.g.sec = sec_i % geo->nsectors;
+
+        if (wl->wb_tpl) {
+            fox_wb_tpl (wl, wb + sec_i * geo->sector_nbytes, sppa.ppa, key);
+            continue;
+        }
+
+        skey = fox_wb_mix (sppa.ppa ^ key);
+        word = (uint64_t *) (wb + sec_i * geo->sector_nbytes);
+
+        for (word_i = 0; word_i < nwords; word_i++)
+            word[word_i] = fox_wb_mix (skey + word_i * 0x9e3779b97f4a7c15ULL);
     }
+}
 
-    offw = buf->buf_w + vpg_sz * pgoff;
-    offr = buf->buf_r + vpg_sz * pgoff;
+/* Fills 'sz' bytes starting at page 'ppa' with the payload of the workload
+ * data type. Random data also depends on the seed and on 'iter', the number
+ * of times the blocks were erased by the node, so stale pages are detected. */
+void fox_wb_fill (struct fox_workload *wl, uint32_t iter, uint8_t *wb,
+                                            size_t sz, struct nvm_addr ppa)
+{
+    const struct nvm_geo *geo = wl->geo;
+    size_t vpg_sz = geo->page_nbytes * geo->nplanes;
 
-    switch (node->wl->memcmp) {
-        case WB_RANDOM:
+    switch (wl->memcmp) {
         case WB_READABLE:
-            ret = memcmp (offw, offr, vpg_sz * npgs);
+            fox_wb_readable ((char *) wb, sz / vpg_sz, geo, ppa, wl->seed);
             break;
         case WB_GEOMETRY:
-            ppa.ppa = 0;
-            if (node->wl->engine->id == FOX_ENGINE_3 ||
-                                                   node->wl->w_factor == 0)
-                ppa.ppa = vblk->blks[0].ppa;
-            else
-                ppa.g.pg = vblk->blks[0].g.pg;
-
-            ret = fox_wb_geo (offr, vpg_sz * npgs, node->wl->geo,
-                                                              ppa, WB_GEO_CMP);
+            fox_wb_geo (wb, sz, geo, ppa, WB_GEO_FILL);
             break;
+        case WB_RANDOM:
         case WB_DISABLE:
         default:
-            ret = 0;
+            fox_wb_gen (wl, wb, sz, ppa, fox_wb_mix (wl->seed +
+                                            iter * 0x9e3779b97f4a7c15ULL));
     }
+}
+
+/* Compares 'buf' with the expected payload. Returns 0 if equal, 1 if the
+ * data differs, then 'exp' holds the expected payload and 'off' the first
+ * differing byte. Geometry data is verified in place. */
+int fox_wb_cmp (struct fox_workload *wl, uint32_t iter, const uint8_t *buf,
+                    uint8_t *exp, size_t sz, struct nvm_addr ppa, size_t *off)
+{
+    ssize_t diff;
+    size_t i;
+
+    if (wl->memcmp == WB_GEOMETRY) {
+        diff = fox_wb_geo_sec ((uint8_t *) buf, sz, wl->geo, ppa, WB_GEO_CMP);
+        if (diff < 0)
+            return 0;
 
-    if (ret) {
-        fox_set_stats(FOX_STATS_FAIL_CMP, &node->stats, 1);
+        fox_wb_fill (wl, iter, exp, sz, ppa);
+        *off = diff;
         return 1;
     }
 
-    return 0;
-}
\ No newline at end of file
+    fox_wb_fill (wl, iter, exp, sz, ppa);
+    if (!memcmp (exp, buf, sz))
+        return 0;
+
+    for (i = 0; i < sz && exp[i] == buf[i]; i++);
+    *off = i;
+
+    return 1;
+}
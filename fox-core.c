@@ -82,7 +82,55 @@ static int fox_check_workload (struct fox_workload *wl)
         return -1;
     }
 
-    wl->nppas = (!wl->nppas) ? pg_ppas : wl->nppas;
+    if (wl->stripe > wl->channels * wl->luns / wl->nthreads) {
+        printf (" Stripe cannot exceed the number of LUNs per job.\n");
+        return -1;
+    }
+
+    if (wl->blks * wl->stripe > wl->geo->nblocks) {
+        printf (" Blocks per LUN times stripe exceed the device blocks.\n");
+        return -1;
+    }
+
+    if ((uint32_t) wl->pgs * wl->stripe > UINT16_MAX) {
+        printf (" Pages per block times stripe must be <= %d.\n", UINT16_MAX);
+        return -1;
+    }
+
+    /* Default vector: one page of each block of the stripe */
+    if (!wl->nppas) {
+        wl->nppas = pg_ppas * wl->stripe;
+        while (wl->nppas > 64 && wl->nppas > pg_ppas)
+            wl->nppas -= pg_ppas;
+    }
+
+    if (wl->iodepth > 1024) {
+        printf (" I/O depth must be <= 1024.\n");
+        return -1;
+    }
+
+    wl->iodepth = (!wl->iodepth) ? 1 : wl->iodepth;
+
+    if (wl->max_delay && (wl->rate_iops || wl->rate_bw)) {
+        printf (" Use either sleep (-s) or rate limits, not both.\n");
+        return -1;
+    }
+
+    if (wl->arrival && (!wl->rate_iops || wl->rate_bw)) {
+        printf (" Open-loop arrival requires --rate-iops only.\n");
+        return -1;
+    }
+
+    if ((wl->compress || wl->dedup) && wl->memcmp != WB_DISABLE &&
+                                                    wl->memcmp != WB_RANDOM) {
+        printf (" Compression and dedup apply to random data (-m 1).\n");
+        return -1;
+    }
+
+    if (wl->compress && wl->compress < 1.0) {
+        printf (" Compression ratio must be >= 1.\n");
+        return -1;
+    }
 
     return 0;
 }
@@ -187,12 +235,19 @@ int main (int argc, char **argv) {
     if (mode < 0)
         goto ARGP;
 
+    fox_simd_init ();
+
     if (mode == FOX_IO_MODE) {
         ret = fox_mio_init (argp);
         goto ARGP;
     }
 
-    gl_stats = malloc (sizeof (struct fox_stats));
+    if (mode == FOX_TRACE_MODE) {
+        ret = fox_trace_init (argp);
+        goto ARGP;
+    }
+
+    gl_stats = aligned_alloc (FOX_CACHE_LINE, sizeof (struct fox_stats));
     if (!gl_stats)
         goto ARGP;
 
@@ -217,7 +272,24 @@ int main (int argc, char **argv) {
     wl->nppas = argp->vector;
     wl->max_delay = argp->max_delay;
     wl->memcmp = argp->memcmp;
+    wl->seed = (argp->seed_set) ? argp->seed :
+                            fox_timestamp_wall () ^ fox_timestamp_now ();
     wl->output = argp->output;
+    wl->iodepth = argp->iodepth;
+    wl->hlog = argp->hlog;
+    wl->rate_iops = argp->rate_iops;
+    wl->rate_bw = (uint64_t) argp->rate_bw * 1024 * 1024;
+    wl->rate_job = argp->rate_job;
+    wl->arrival = argp->arrival;
+    wl->compress = argp->compress;
+    wl->dedup = argp->dedup;
+    wl->verifiers = (argp->verifiers_set) ? argp->verifiers : 1;
+    wl->prefill = argp->prefill;
+    wl->erase_depth = (argp->erase_depth_set) ? argp->erase_depth :
+                                                            FOX_ERASE_DEPTH;
+    wl->rotate = argp->rotate;
+    wl->wear = argp->wear;
+    wl->stripe = (argp->stripe) ? argp->stripe : 1;
 
     if (wl->devname[0] == 0) {
         wl->devname = malloc (13);
@@ -235,6 +307,10 @@ int main (int argc, char **argv) {
 
     wl->geo = prov_get_geo(wl->dev);
 
+    prov_bbt_cache_set (argp->refresh_bbt, (argp->bbt_age_set) ?
+                                            argp->bbt_age : PROV_BBT_MAX_AGE);
+    prov_wear_policy_set (wl->wear);
+
     if (prov_init(wl->dev, wl->geo))
         goto DEV_CLOSE;
     LIST_INIT(&eng_head);
@@ -251,31 +327,39 @@ int main (int argc, char **argv) {
     if (fox_check_workload(wl))
         goto EXIT_ENG;
 
-    /* Engine 3 and 100% read workload requires geometry memory comparison */
-    if (wl->engine->id == FOX_ENGINE_3 || wl->r_factor == 100)
-        if (wl->memcmp && wl->memcmp != WB_GEOMETRY) {
-            printf ("\n NOTE: This mode requires geometry write buffer (3).\n");
-            wl->memcmp = WB_GEOMETRY;
-        }
+    /* One service thread per LUN for backends without asynchronous I/O,
+     * background erases need them with iodepth 1 too */
+    if ((wl->iodepth > 1 || (wl->erase_depth && wl->w_factor)) &&
+                                    prov_io_init (wl->channels * wl->luns))
+        goto EXIT_ENG;
 
     if (fox_init_stats (gl_stats))
         goto EXIT_ENG;
 
     wl->stats = gl_stats;
 
-    if (wl->output && fox_output_init (wl))
+    if ((wl->output || wl->hlog) && fox_output_init (wl))
         goto EXIT_STATS;
 
     fox_show_workload (wl);
     fox_setup_io_factor (wl);
 
+    if (fox_rate_init (wl))
+        goto EXIT_OUTPUT;
+
+    if (fox_wb_profile_init (wl))
+        goto EXIT_RATE;
+
+    if (fox_verify_init (wl))
+        goto EXIT_PROFILE;
+
     nodes = fox_create_threads (wl);
     if (!nodes)
-        goto EXIT_OUTPUT;
+        goto EXIT_VERIFY;
 
     fox_setup_delay (nodes);
 
-    if (fox_alloc_vblks (wl))
+    if (fox_alloc_vblks (wl, nodes))
         goto EXIT_THREADS;
 
     fox_monitor (nodes);
@@ -292,18 +376,30 @@ int main (int argc, char **argv) {
         fox_output_flush_rt ();
     }
 
+    if (wl->hlog) {
+        printf (" - Writing latency histograms under ./output ...\n\n");
+        fox_output_hlog (wl, nodes);
+    }
+
     ret = 0;
     fox_free_vblks (wl);
 
 EXIT_THREADS:
     fox_exit_threads (nodes);
+EXIT_VERIFY:
+    fox_verify_exit (wl);
+EXIT_PROFILE:
+    fox_wb_profile_exit (wl);
+EXIT_RATE:
+    fox_rate_exit (wl);
 EXIT_OUTPUT:
-    if (wl->output)
+    if (wl->output || wl->hlog)
         fox_output_exit ();
 EXIT_STATS:
     fox_exit_stats (gl_stats);
     wl->stats = NULL;
 EXIT_ENG:
+    prov_io_exit ();
     fox_exit_engs ();
 EXIT_PROV:
     prov_exit ();
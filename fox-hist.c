@@ -0,0 +1,337 @@
+/*  - FOX - A tool for testing Open-Channel SSDs
+ *      - Latency histograms
+ *
+ * Copyright (C) 2016, IT University of Copenhagen. All rights reserved.
+ * Written by Ivan Luiz Picoli <ivpi@itu.dk>
+ *
+ * Funding support provided by CAPES Foundation, Ministry of Education
+ * of Brazil, Brasilia - DF 70040-020, Brazil.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Log-linear latency histograms with the HdrHistogram bucket layout. Values
+ * are kept with 2 significant decimal digits from 1 up to FOX_HIST_MAX;
+ * larger values are counted in the last bucket. Recording is O(1) and the
+ * memory per histogram is fixed at init. The encoding written by
+ * fox_hist_encode can be read by any HdrHistogram implementation. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "fox.h"
+
+#define HIST_SIG_DIGITS     2
+#define HIST_SUB_BITS       8   /* log2 of sub-buckets for 2 digits: 256 */
+#define HIST_SUB_COUNT      (1 << HIST_SUB_BITS)
+#define HIST_SUB_HALF_BITS  (HIST_SUB_BITS - 1)
+#define HIST_SUB_HALF       (1 << HIST_SUB_HALF_BITS)
+#define HIST_SUB_MASK       ((uint64_t) HIST_SUB_COUNT - 1)
+
+/* HdrHistogram V2 encoding cookies */
+#define HIST_V2_COOKIE      0x1c849313
+#define HIST_V2_CMP_COOKIE  0x1c849314
+#define HIST_V2_HDR_SZ      40
+
+static uint32_t fox_hist_nbuckets (uint64_t highest)
+{
+    uint64_t untrackable = HIST_SUB_COUNT;
+    uint32_t nbuckets = 1;
+
+    while (untrackable <= highest) {
+        if (untrackable > INT64_MAX / 2)
+            return nbuckets + 1;
+        untrackable <<= 1;
+        nbuckets++;
+    }
+
+    return nbuckets;
+}
+
+static uint32_t fox_hist_index (uint64_t val)
+{
+    int32_t bucket;
+    uint32_t sub;
+
+    bucket = (64 - __builtin_clzll (val | HIST_SUB_MASK)) -
+                                                    (HIST_SUB_HALF_BITS + 1);
+    sub = val >> bucket;
+
+    return ((bucket + 1) << HIST_SUB_HALF_BITS) + (sub - HIST_SUB_HALF);
+}
+
+/* Highest value that is counted in the same slot as 'index' */
+static uint64_t fox_hist_value (uint32_t index)
+{
+    int32_t bucket;
+    uint32_t sub;
+
+    bucket = (index >> HIST_SUB_HALF_BITS) - 1;
+    sub = (index & (HIST_SUB_HALF - 1)) + HIST_SUB_HALF;
+    if (bucket < 0) {
+        sub -= HIST_SUB_HALF;
+        bucket = 0;
+    }
+
+    return ((uint64_t) sub << bucket) + (1ULL << bucket) - 1;
+}
+
+int fox_hist_init (struct fox_hist *h, uint64_t highest)
+{
+    memset (h, 0, sizeof (struct fox_hist));
+
+    h->highest = highest;
+    h->ncounts = (fox_hist_nbuckets (highest) + 1) * HIST_SUB_HALF;
+    h->counts = calloc (h->ncounts, sizeof (uint64_t));
+    if (!h->counts)
+        return -1;
+
+    h->min = UINT64_MAX;
+
+    return 0;
+}
+
+void fox_hist_exit (struct fox_hist *h)
+{
+    free (h->counts);
+    h->counts = NULL;
+}
+
+void fox_hist_record (struct fox_hist *h, uint64_t val)
+{
+    if (val < h->min)
+        h->min = val;
+    if (val > h->max)
+        h->max = val;
+
+    if (val > h->highest)
+        val = h->highest;
+
+    h->counts[fox_hist_index (val)]++;
+    h->total++;
+}
+
+void fox_hist_merge (struct fox_hist *dst, struct fox_hist *src)
+{
+    uint32_t i;
+
+    if (!src->total)
+        return;
+
+    for (i = 0; i < dst->ncounts && i < src->ncounts; i++)
+        dst->counts[i] += src->counts[i];
+
+    dst->total += src->total;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+uint64_t fox_hist_min (struct fox_hist *h)
+{
+    return (h->total) ? h->min : 0;
+}
+
+uint64_t fox_hist_percentile (struct fox_hist *h, double pct)
+{
+    uint64_t target, sum = 0, val;
+    uint32_t i;
+
+    if (!h->total)
+        return 0;
+
+    if (pct > 100.0)
+        pct = 100.0;
+
+    target = (uint64_t) ((pct / 100.0) * h->total + 0.5);
+    if (target < 1)
+        target = 1;
+
+    for (i = 0; i < h->ncounts; i++) {
+        sum += h->counts[i];
+        if (sum >= target) {
+            val = fox_hist_value (i);
+            return (val < h->max) ? val : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+static void fox_hist_put32 (uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void fox_hist_put64 (uint8_t *p, uint64_t v)
+{
+    fox_hist_put32 (p, v >> 32);
+    fox_hist_put32 (p + 4, v & 0xffffffff);
+}
+
+/* ZigZag LEB128 as used by HdrHistogram, at most 9 bytes */
+static int fox_hist_zigzag (uint8_t *p, int64_t v)
+{
+    uint64_t u = ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        if (u < 0x80) {
+            p[i] = u;
+            return i + 1;
+        }
+        p[i] = (u & 0x7f) | 0x80;
+        u >>= 7;
+    }
+    p[8] = u;
+
+    return 9;
+}
+
+/* zlib stream made of stored deflate blocks. The counts are already
+ * run-length encoded, so real compression buys little here. */
+static size_t fox_hist_zlib (uint8_t *dst, const uint8_t *src, size_t len)
+{
+    uint32_t a = 1, b = 0;
+    size_t i, off = 0, blk;
+    uint8_t *p = dst;
+
+    *p++ = 0x78;
+    *p++ = 0x01;
+
+    do {
+        blk = (len - off > 0xffff) ? 0xffff : len - off;
+        *p++ = (off + blk == len) ? 1 : 0;
+        *p++ = blk & 0xff;
+        *p++ = blk >> 8;
+        *p++ = ~blk & 0xff;
+        *p++ = (~blk >> 8) & 0xff;
+        memcpy (p, src + off, blk);
+        p += blk;
+        off += blk;
+    } while (off < len);
+
+    for (i = 0; i < len; i++) {
+        a = (a + src[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    fox_hist_put32 (p, (b << 16) | a);
+    p += 4;
+
+    return p - dst;
+}
+
+static void fox_hist_base64 (char *dst, const uint8_t *src, size_t len)
+{
+    static const char tb[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                             "abcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i;
+    uint32_t v;
+
+    for (i = 0; i + 2 < len; i += 3) {
+        v = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+        *dst++ = tb[(v >> 18) & 0x3f];
+        *dst++ = tb[(v >> 12) & 0x3f];
+        *dst++ = tb[(v >> 6) & 0x3f];
+        *dst++ = tb[v & 0x3f];
+    }
+
+    if (i < len) {
+        v = src[i] << 16;
+        if (i + 1 < len)
+            v |= src[i + 1] << 8;
+        *dst++ = tb[(v >> 18) & 0x3f];
+        *dst++ = tb[(v >> 12) & 0x3f];
+        *dst++ = (i + 1 < len) ? tb[(v >> 6) & 0x3f] : '=';
+        *dst++ = '=';
+    }
+    *dst = '\0';
+}
+
+/* Returns a base64 string with the compressed V2 encoding of the histogram
+ * (the format used in .hlog files). Must be freed by the caller. */
+char *fox_hist_encode (struct fox_hist *h)
+{
+    uint8_t *raw, *cmp;
+    char *b64 = NULL;
+    uint32_t i, last, nzero;
+    size_t len, raw_sz, cmp_sz;
+    double one = 1.0;
+    uint64_t dbits;
+
+    last = (h->total) ? fox_hist_index (
+                           (h->max > h->highest) ? h->highest : h->max) : 0;
+
+    raw_sz = HIST_V2_HDR_SZ + (last + 1) * 9;
+    raw = malloc (raw_sz);
+    if (!raw)
+        return NULL;
+
+    len = HIST_V2_HDR_SZ;
+    for (i = 0; h->total && i <= last; i++) {
+        if (h->counts[i]) {
+            len += fox_hist_zigzag (raw + len, h->counts[i]);
+            continue;
+        }
+        nzero = 1;
+        while (i < last && !h->counts[i + 1]) {
+            nzero++;
+            i++;
+        }
+        len += fox_hist_zigzag (raw + len, (nzero > 1) ? -(int64_t) nzero : 0);
+    }
+
+    memcpy (&dbits, &one, sizeof (double));
+    fox_hist_put32 (raw, HIST_V2_COOKIE);
+    fox_hist_put32 (raw + 4, len - HIST_V2_HDR_SZ);
+    fox_hist_put32 (raw + 8, 0);
+    fox_hist_put32 (raw + 12, HIST_SIG_DIGITS);
+    fox_hist_put64 (raw + 16, 1);
+    fox_hist_put64 (raw + 24, h->highest);
+    fox_hist_put64 (raw + 32, dbits);
+
+    /* 8 bytes header, zlib header + adler, 5 bytes per stored block */
+    cmp = malloc (8 + 6 + len + 5 * (len / 0xffff + 1));
+    if (!cmp)
+        goto FREE_RAW;
+
+    cmp_sz = fox_hist_zlib (cmp + 8, raw, len);
+    fox_hist_put32 (cmp, HIST_V2_CMP_COOKIE);
+    fox_hist_put32 (cmp + 4, cmp_sz);
+    cmp_sz += 8;
+
+    b64 = malloc ((cmp_sz + 2) / 3 * 4 + 1);
+    if (!b64)
+        goto FREE_CMP;
+
+    fox_hist_base64 (b64, cmp, cmp_sz);
+
+FREE_CMP:
+    free (cmp);
+FREE_RAW:
+    free (raw);
+    return b64;
+}
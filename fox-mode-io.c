@@ -23,7 +23,7 @@ static int fox_mio_rw(struct fox_argp *argp) {
     addr.g.blk = argp->io_blk;
     addr.g.pg = argp->io_pg;
 
-    vblk = nvm_vblk_alloc(dev, &addr, 1);
+    vblk = prov_vblk_new(dev, &addr, 1);
     if (!vblk)
         return ret;
 
@@ -31,16 +31,18 @@ static int fox_mio_rw(struct fox_argp *argp) {
 
     if (argp->cmdtype == CMDARG_WRITE) {
         if (argp->io_random)
-            fox_wb_random ((uint8_t *)buf, geo->page_nbytes * geo->npages);
+            fox_wb_random ((uint8_t *)buf, geo->page_nbytes * geo->npages,
+                                                        fox_timestamp_wall ());
         else
-            fox_wb_readable (buf + offset, argp->io_seq, geo, addr);
+            fox_wb_readable (buf + offset, argp->io_seq, geo, addr,
+                                                        fox_timestamp_wall ());
     }
 
     for (pg_i = 0; pg_i < argp->io_seq; pg_i++) {
 
         bret = (argp->cmdtype == CMDARG_WRITE) ?
-                nvm_vblk_pwrite(vblk, buf + offset, vpg_sz, offset) :
-                nvm_vblk_pread(vblk, buf + offset, vpg_sz, offset);
+                prov_vblk_pwrite(vblk, buf + offset, vpg_sz, offset) :
+                prov_vblk_pread(vblk, buf + offset, vpg_sz, offset);
 
         if (bret != vpg_sz)
             goto FREE_VBLK;
@@ -51,50 +53,55 @@ static int fox_mio_rw(struct fox_argp *argp) {
     ret = 0;
 
 FREE_VBLK:
-    nvm_vblk_free(vblk);
+    prov_vblk_destroy(vblk);
     return ret;
 }
 
 static int fox_mio_erase(struct fox_argp *argp) {
-    int blk_i;
-    struct nvm_vblk *vblk;
+    int blk_i, nvblks = 0, ret = -1;
+    struct nvm_vblk **vblks;
     struct nvm_addr addr;
-    uint32_t cblk, pmode;
+    uint64_t *ns;
+    int *err;
+
+    vblks = calloc(argp->io_seq, sizeof(struct nvm_vblk *));
+    err = calloc(argp->io_seq, sizeof(int));
+    ns = calloc(argp->io_seq, sizeof(uint64_t));
+    if (!vblks || !err || !ns)
+        goto FREE;
 
     addr.ppa = 0x0;
-    cblk = argp->io_blk;
+    addr.g.ch = argp->io_ch;
+    addr.g.lun = argp->io_lun;
 
     for (blk_i = 0; blk_i < argp->io_seq; blk_i++) {
-        addr.g.ch = argp->io_ch;
-        addr.g.lun = argp->io_lun;
-        addr.g.blk = cblk;
+        addr.g.blk = argp->io_blk + blk_i;
 
-        vblk = nvm_vblk_alloc(dev, &addr, 1);
-        if (!vblk)
-            goto FAIL;
-
-        pmode = nvm_dev_get_pmode(dev);
-        if (nvm_dev_set_pmode(dev, 0x0) < 0)
-            goto FREE_VBLK;
-
-        if (nvm_vblk_erase(vblk) < 0)
-            goto SET_PMODE;
-
-        if (nvm_dev_set_pmode(dev, pmode) < 0)
+        vblks[blk_i] = prov_vblk_new(dev, &addr, 1);
+        if (!vblks[blk_i])
             goto FREE_VBLK;
+        nvblks++;
+    }
 
-        nvm_vblk_free(vblk);
-        cblk++;
+    /* All blocks go to the device in as few commands as possible */
+    if (prov_vblk_erase_v(vblks, nvblks, err, ns) > 0) {
+        for (blk_i = 0; blk_i < nvblks; blk_i++)
+            if (err[blk_i])
+                printf(" Block %d failed to erase.\n",
+                                                    argp->io_blk + blk_i);
+        goto FREE_VBLK;
     }
 
-    return 0;
+    ret = 0;
 
-SET_PMODE:
-    nvm_dev_set_pmode(dev, pmode);
 FREE_VBLK:
-    nvm_vblk_free(vblk);
-FAIL:
-    return -1;
+    for (blk_i = 0; blk_i < nvblks; blk_i++)
+        prov_vblk_destroy(vblks[blk_i]);
+FREE:
+    free(vblks);
+    free(err);
+    free(ns);
+    return ret;
 }
 
 static int fox_mio_check(struct fox_argp *argp) {
@@ -212,7 +219,7 @@ int fox_mio_init(struct fox_argp *argp) {
     if (!buf)
         goto CLOSE;
 
-    nvm_dev_set_meta_mode(dev, NVM_META_MODE_ALPHA);
+    prov_dev_set_meta_mode(dev, NVM_META_MODE_ALPHA);
 
     switch (argp->cmdtype) {
         case CMDARG_ERASE:
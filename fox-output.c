@@ -41,14 +41,231 @@
 
 #include "fox.h"
 
-TAILQ_HEAD(out_list,fox_output_row) out_head = TAILQ_HEAD_INITIALIZER(out_head);
+/* Per-IO rows are copied into a fixed ring per node (single producer: the
+ * node, single consumer: the writer thread) and streamed to fox_io.bin while
+ * the workload runs. When a ring is full the node waits up to
+ * OUT_STALL_USEC for the writer, then the row is dropped. */
+#define OUT_RING_SZ     (1 << 16)   /* rows per node, power of 2 */
+#define OUT_RING_MASK   (OUT_RING_SZ - 1)
+#define OUT_STALL_USEC  100000
+#define OUT_STALL_WAIT  50
+#define OUT_WRITER_MS   10
+#define OUT_FILE_BUF    (1024 * 1024)
+
+struct fox_output_ring {
+    uint64_t                head;       /* producer */
+    uint64_t                node_seq;
+    uint64_t                stalled;
+    uint64_t                dropped;
+    uint64_t                tail __attribute__ ((aligned (FOX_CACHE_LINE)));
+    struct fox_output_row   *rows;
+} __attribute__ ((aligned (FOX_CACHE_LINE)));
+
 TAILQ_HEAD(rt_list,fox_output_row_rt) rt_head = TAILQ_HEAD_INITIALIZER(rt_head);
+static struct fox_output_ring *out_ring;
+static int out_nrings;
+static pthread_t out_tid;
+static uint8_t out_running;
+static uint8_t out_stop;
 static pthread_mutex_t out_mutex;
-static pthread_mutex_t file_mutex;
-static uint64_t sequence;
-static uint64_t *node_seq;
+static pthread_cond_t out_cond;
+static FILE *out_fp;
+static uint8_t out_err;
+static uint64_t out_tprev;
 static uint64_t usec;
 
+/* Corruption dumps may come from several verifier threads. After
+ * CORRUPT_MAX_DUMPS only the index line is written */
+#define CORRUPT_MAX_DUMPS   64
+static pthread_mutex_t corrupt_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t corrupt_dumps;
+
+static void fox_output_put (struct fox_trace_rec *rec)
+{
+    if (fwrite (rec, sizeof (struct fox_trace_rec), 1, out_fp) != 1) {
+        printf (" [fox-output: ERROR. Not possible to flush results.]\n");
+        out_err = 1;
+    }
+}
+
+static void fox_output_write (struct fox_output_row *row)
+{
+    struct fox_trace_rec rec;
+    int64_t delta;
+
+    if (out_err)
+        return;
+
+    memset (&rec, 0, sizeof (struct fox_trace_rec));
+
+    delta = (int64_t) (row->tstart - out_tprev);
+    if (delta > INT32_MAX || delta < INT32_MIN) {
+        rec.type = FOX_TRACE_SYNC;
+        rec.blk = row->tstart >> 32;
+        rec.pg = row->tstart & 0xffffffff;
+        fox_output_put (&rec);
+        delta = 0;
+        rec.type = 0;
+        rec.blk = rec.pg = 0;
+    }
+    out_tprev = row->tstart;
+
+    rec.tdelta = delta;
+    rec.ulat = row->ulat;
+    rec.qdelay = row->qdelay;
+    rec.node_seq = row->node_seq;
+    rec.blk = row->blk;
+    rec.pg = row->pg;
+    rec.size = row->size;
+    rec.tid = row->tid;
+    rec.ch = row->ch;
+    rec.lun = row->lun;
+    rec.type = row->type;
+    rec.failed = row->failed;
+    rec.datacmp = row->datacmp;
+
+    fox_output_put (&rec);
+}
+
+static int fox_output_trace_hdr (struct fox_workload *wl)
+{
+    struct fox_trace_hdr hdr;
+
+    memset (&hdr, 0, sizeof (struct fox_trace_hdr));
+
+    hdr.magic = FOX_TRACE_MAGIC;
+    hdr.version = FOX_TRACE_VERSION;
+    hdr.hdr_sz = sizeof (struct fox_trace_hdr);
+    hdr.rec_sz = sizeof (struct fox_trace_rec);
+    hdr.tbase = fox_timestamp_now ();
+    hdr.twall = fox_timestamp_wall () * 1000;
+    hdr.runtime = wl->runtime;
+
+    hdr.nchannels = wl->geo->nchannels;
+    hdr.nluns = wl->geo->nluns;
+    hdr.nplanes = wl->geo->nplanes;
+    hdr.nblocks = wl->geo->nblocks;
+    hdr.npages = wl->geo->npages;
+    hdr.nsectors = wl->geo->nsectors;
+    hdr.sector_nbytes = wl->geo->sector_nbytes;
+    hdr.page_nbytes = wl->geo->page_nbytes;
+
+    hdr.blks = wl->blks;
+    hdr.pgs = wl->pgs * wl->stripe;
+    hdr.max_delay = wl->max_delay;
+    hdr.engine = wl->engine->id;
+    hdr.nthreads = wl->nthreads;
+    hdr.channels = wl->channels;
+    hdr.luns = wl->luns;
+    hdr.w_factor = wl->w_factor;
+    hdr.r_factor = wl->r_factor;
+    hdr.nppas = wl->nppas;
+    hdr.iodepth = wl->iodepth;
+    hdr.memcmp = wl->memcmp;
+    hdr.arrival = wl->arrival;
+    hdr.seed = wl->seed;
+    strncpy (hdr.devname, wl->devname, CMDARG_LEN - 1);
+
+    if (fwrite (&hdr, sizeof (struct fox_trace_hdr), 1, out_fp) != 1)
+        return -1;
+
+    out_tprev = hdr.tbase;
+
+    return 0;
+}
+
+static void fox_output_drain (void)
+{
+    struct fox_output_ring *ring;
+    uint64_t head, tail;
+    int i;
+
+    for (i = 0; i < out_nrings; i++) {
+        ring = &out_ring[i];
+        head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+        tail = ring->tail;
+
+        while (tail < head) {
+            fox_output_write (&ring->rows[tail & OUT_RING_MASK]);
+            tail++;
+            __atomic_store_n (&ring->tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+static void fox_output_wake (void)
+{
+    pthread_mutex_lock (&out_mutex);
+    pthread_cond_signal (&out_cond);
+    pthread_mutex_unlock (&out_mutex);
+}
+
+static void *fox_output_writer (void *arg)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock (&out_mutex);
+    while (!out_stop) {
+        clock_gettime (CLOCK_REALTIME, &ts);
+        ts.tv_nsec += OUT_WRITER_MS * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait (&out_cond, &out_mutex, &ts);
+
+        pthread_mutex_unlock (&out_mutex);
+        fox_output_drain ();
+        pthread_mutex_lock (&out_mutex);
+    }
+    pthread_mutex_unlock (&out_mutex);
+
+    fox_output_drain ();
+
+    return NULL;
+}
+
+static int fox_output_ring_init (int nrings)
+{
+    int i;
+
+    out_ring = aligned_alloc (FOX_CACHE_LINE,
+                                sizeof (struct fox_output_ring) * nrings);
+    if (!out_ring)
+        return -1;
+    memset (out_ring, 0, sizeof (struct fox_output_ring) * nrings);
+
+    for (i = 0; i < nrings; i++) {
+        out_ring[i].rows = malloc (sizeof (struct fox_output_row) *
+                                                                OUT_RING_SZ);
+        if (!out_ring[i].rows)
+            goto FREE;
+    }
+    out_nrings = nrings;
+
+    return 0;
+
+FREE:
+    while (i) {
+        i--;
+        free (out_ring[i].rows);
+    }
+    free (out_ring);
+    out_ring = NULL;
+    return -1;
+}
+
+static void fox_output_ring_exit (void)
+{
+    int i;
+
+    for (i = 0; i < out_nrings; i++)
+        free (out_ring[i].rows);
+    free (out_ring);
+    out_ring = NULL;
+    out_nrings = 0;
+}
+
 int fox_output_init (struct fox_workload *wl)
 {
     struct timeval tv;
@@ -63,55 +280,65 @@ int fox_output_init (struct fox_workload *wl)
     usec = tv.tv_sec * SEC64;
     usec += tv.tv_usec;
 
-    if (wl->output) {
-        sprintf (filename, "output/%lu_fox_io.csv", usec);
-        fp = fopen(filename, "a");
-        if (!fp)
-            return -1;
-
-        fprintf (fp, "sequence;node_sequence;node_id;channel;lun;block;page;"
-                       "start;end;latency;type;is_failed;read_memcmp;bytes\n");
+    TAILQ_INIT (&rt_head);
+    out_err = 0;
+    out_stop = 0;
 
-        fclose(fp);
+    if (!wl->output)
+        return 0;
 
-        sprintf (filename, "output/%lu_fox_rt.csv", usec);
-        fp = fopen(filename, "a");
-        if (!fp)
-            return -1;
+    sprintf (filename, "output/%lu_fox_rt.csv", usec);
+    fp = fopen(filename, "a");
+    if (!fp)
+        return -1;
 
-        fprintf (fp, "timestamp;node_id;throughput(mb/s);iops\n");
+    fprintf (fp, "timestamp;node_id;throughput(mb/s);iops\n");
 
-        fclose(fp);
-    }
+    fclose(fp);
 
-    node_seq = malloc (sizeof(uint64_t) * wl->nthreads);
-    if (!node_seq)
+    sprintf (filename, "output/%lu_fox_io.bin", usec);
+    out_fp = fopen(filename, "w");
+    if (!out_fp)
         return -1;
-    memset (node_seq, 0, sizeof(uint64_t) * wl->nthreads);
+    setvbuf (out_fp, NULL, _IOFBF, OUT_FILE_BUF);
+
+    if (fox_output_trace_hdr (wl))
+        goto CLOSE;
+
+    if (fox_output_ring_init (wl->nthreads))
+        goto CLOSE;
 
-    TAILQ_INIT (&out_head);
-    TAILQ_INIT (&rt_head);
     pthread_mutex_init (&out_mutex, NULL);
-    pthread_mutex_init (&file_mutex, NULL);
-    sequence = 0;
+    pthread_cond_init (&out_cond, NULL);
+
+    if (pthread_create (&out_tid, NULL, fox_output_writer, NULL))
+        goto MUTEX;
+    out_running = 1;
 
     return 0;
-}
 
-void fox_output_exit (void)
-{
+MUTEX:
     pthread_mutex_destroy (&out_mutex);
-    pthread_mutex_destroy (&file_mutex);
-    free (node_seq);
+    pthread_cond_destroy (&out_cond);
+    fox_output_ring_exit ();
+CLOSE:
+    fclose (out_fp);
+    out_fp = NULL;
+    return -1;
 }
 
-struct fox_output_row *fox_output_new (void)
+void fox_output_exit (void)
 {
-    struct fox_output_row *row;
+    if (!out_fp)
+        return;
 
-    row = malloc (sizeof(struct fox_output_row));
+    fox_output_flush ();
 
-    return row;
+    pthread_mutex_destroy (&out_mutex);
+    pthread_cond_destroy (&out_cond);
+    fox_output_ring_exit ();
+    fclose (out_fp);
+    out_fp = NULL;
 }
 
 struct fox_output_row_rt *fox_output_new_rt (void)
@@ -123,19 +350,39 @@ struct fox_output_row_rt *fox_output_new_rt (void)
     return row;
 }
 
+/* Called by the node thread only. The row is copied into the ring. */
 void fox_output_append (struct fox_output_row *row, int node_id)
 {
-    row->tid = node_id;
-    row->node_seq = node_seq[node_id];
-    node_seq[node_id]++;
+    struct fox_output_ring *ring = &out_ring[node_id];
+    uint64_t head = ring->head, tail;
+    uint32_t waited = 0;
 
-    pthread_mutex_lock (&out_mutex);
+    row->tid = node_id;
+    row->node_seq = ring->node_seq;
+    ring->node_seq++;
+
+    tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= OUT_RING_SZ) {
+        ring->stalled++;
+        fox_output_wake ();
+        do {
+            if (waited >= OUT_STALL_USEC) {
+                ring->dropped++;
+                return;
+            }
+            usleep (OUT_STALL_WAIT);
+            waited += OUT_STALL_WAIT;
+            tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+        } while (head - tail >= OUT_RING_SZ);
+    }
 
-    row->seq = sequence;
-    sequence++;
-    TAILQ_INSERT_TAIL (&out_head, row, entry);
+    memcpy (&ring->rows[head & OUT_RING_MASK], row,
+                                              sizeof (struct fox_output_row));
+    __atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
 
-    pthread_mutex_unlock (&out_mutex);
+    /* Don't wait for the writer timeout if the ring is filling up */
+    if (head + 1 - tail == OUT_RING_SZ / 2)
+        fox_output_wake ();
 }
 
 void fox_output_append_rt (struct fox_output_row_rt *row, uint16_t nid)
@@ -145,94 +392,54 @@ void fox_output_append_rt (struct fox_output_row_rt *row, uint16_t nid)
     TAILQ_INSERT_TAIL (&rt_head, row, entry);
 }
 
-void fox_print (char *line, uint8_t to_file)
+void fox_output_trace_stats (uint64_t *stalled, uint64_t *dropped)
 {
-    FILE *fp;
-    char filename[42];
+    int i;
 
-    if (to_file) {
-        sprintf (filename, "output/%lu_fox_meta.csv", usec);
-        fp = fopen(filename, "a");
-        if (!fp)
-            return;
-
-        fputs (line, fp);
-        fclose(fp);
+    *stalled = *dropped = 0;
+    for (i = 0; i < out_nrings; i++) {
+        *stalled += out_ring[i].stalled;
+        *dropped += out_ring[i].dropped;
     }
-    fputs (line, stdout);
 }
 
-void fox_output_flush (void)
+/* Appends a line to the metadata file only */
+void fox_print_meta (char *line)
 {
     FILE *fp;
-    char filename[40];
-    struct fox_output_row *row;
-    char tstart[21], tend[21];
-
-    pthread_mutex_lock (&file_mutex);
+    char filename[42];
 
-    sprintf (filename, "output/%lu_fox_io.csv", usec);
+    sprintf (filename, "output/%lu_fox_meta.csv", usec);
     fp = fopen(filename, "a");
     if (!fp)
-        goto UNLOCK_FILE;
+        return;
 
-    while (!TAILQ_EMPTY (&out_head)) {
-        pthread_mutex_lock (&out_mutex);
+    fputs (line, fp);
+    fclose(fp);
+}
 
-        row = TAILQ_FIRST (&out_head);
-        if (!row)
-            goto UNLOCK_QUEUE;
+void fox_print (char *line, uint8_t to_file)
+{
+    if (to_file)
+        fox_print_meta (line);
+    fputs (line, stdout);
+}
 
-        TAILQ_REMOVE (&out_head, row, entry);
+/* Stops the writer thread after the remaining rows are written */
+void fox_output_flush (void)
+{
+    if (!out_running)
+        return;
 
-        pthread_mutex_unlock (&out_mutex);
+    pthread_mutex_lock (&out_mutex);
+    out_stop = 1;
+    pthread_cond_signal (&out_cond);
+    pthread_mutex_unlock (&out_mutex);
 
-        sprintf (tstart, "%lu", row->tstart);
-        sprintf (tend, "%lu", row->tend);
-        memmove (tstart, tstart+4, 17);
-        memmove (tend, tend+4, 17);
+    pthread_join (out_tid, NULL);
+    out_running = 0;
 
-        if(fprintf (fp,
-                "%lu;"
-                "%lu;"
-                "%d;"
-                "%d;"
-                "%d;"
-                "%d;"
-                "%d;"
-                "%s;"
-                "%s;"
-                "%d;"
-                "%c;"
-                "%d;"
-                "%d;"
-                "%d\n",
-                row->seq,
-                row->node_seq,
-                row->tid,
-                row->ch,
-                row->lun,
-                row->blk,
-                row->pg,
-                tstart,
-                tend,
-                row->ulat,
-                row->type,
-                row->failed,
-                row->datacmp,
-                row->size) < 0) {
-            printf (" [fox-output: ERROR. Not possible to flush results.]\n");
-            goto CLOSE_FILE;
-        }
-        free (row);
-    }
-
-UNLOCK_QUEUE:
-    pthread_mutex_unlock (&out_mutex);
-CLOSE_FILE:
-    fclose(fp);
-UNLOCK_FILE:
-    pthread_mutex_unlock (&file_mutex);
+    fflush (out_fp);
 }
 
 void fox_output_flush_rt (void)
@@ -277,11 +484,18 @@ CLOSE_FILE:
     fclose(fp);
 }
 
-void fox_flush_corruption (char *name, void *bufw, void *bufr, size_t sz)
+/* Dumps the expected and the read data. corruption/<usec>_index.csv keeps
+ * one line per mismatch with the first differing byte and whether the data
+ * was dumped. Returns 1 if the dump was skipped */
+int fox_flush_corruption (char *name, void *bufw, void *bufr, size_t sz,
+                                                                    size_t off)
 {
     FILE *fp = NULL;
     struct stat st = {0};
-    char filename[80];
+    char filename[128];
+    uint8_t dump;
+
+    pthread_mutex_lock (&corrupt_mutex);
 
     if (stat("corruption", &st) == -1)
             mkdir("corruption", S_IRWXO);
@@ -293,13 +507,110 @@ void fox_flush_corruption (char *name, void *bufw, void *bufr, size_t sz)
         usec += tv.tv_usec;
     }
 
-    sprintf(filename, "corruption/%lu_%s_write.bin", usec, name);
-    fp = fopen(filename, "a");
-    fwrite(bufw, sz, 1, fp);
-    fclose (fp);
+    dump = corrupt_dumps < CORRUPT_MAX_DUMPS;
+
+    if (dump) {
+        corrupt_dumps++;
 
-    sprintf(filename, "corruption/%lu_%s_read.bin", usec, name);
+        snprintf (filename, sizeof (filename), "corruption/%lu_%s_write.bin",
+                                                                usec, name);
+        fp = fopen(filename, "a");
+        if (fp) {
+            fwrite(bufw, sz, 1, fp);
+            fclose (fp);
+        }
+
+        snprintf (filename, sizeof (filename), "corruption/%lu_%s_read.bin",
+                                                                usec, name);
+        fp = fopen(filename, "a");
+        if (fp) {
+            fwrite(bufr, sz, 1, fp);
+            fclose (fp);
+        }
+    }
+
+    snprintf (filename, sizeof (filename), "corruption/%lu_index.csv", usec);
     fp = fopen(filename, "a");
-    fwrite(bufr, sz, 1, fp);
+    if (fp) {
+        fprintf(fp, "%s;%lu;%lu;%d\n", name, off, sz, dump);
+        fclose (fp);
+    }
+
+    pthread_mutex_unlock (&corrupt_mutex);
+
+    return !dump;
+}
+static int fox_output_hlog_line (FILE *fp, const char *tag,
+                                            struct fox_hist *h, double tsec)
+{
+    char *enc;
+    int ret;
+
+    if (!h->total)
+        return 0;
+
+    enc = fox_hist_encode (h);
+    if (!enc)
+        return -1;
+
+    ret = fprintf (fp, "Tag=%s,0.000,%.3f,%.3f,%s\n", tag, tsec,
+                                            h->max / (double) 1000000, enc);
+    free (enc);
+
+    return (ret < 0) ? -1 : 0;
+}
+
+/* Latency histograms in HdrHistogram log format. One interval covering the
+ * whole workload per operation, merged (Tag=read) and per job (Tag=read.j0).
+ * Values are in n-seconds, the max column is in m-seconds. */
+int fox_output_hlog (struct fox_workload *wl, struct fox_node *nodes)
+{
+    const char *name[FOX_HIST_OPS] = {"read", "write", "erase", "queue"};
+    FILE *fp;
+    char filename[42], tag[16], date[32];
+    uint64_t start, elapsed;
+    time_t tsec;
+    int i, node_i, ret = -1;
+
+    sprintf (filename, "output/%lu_fox_lat.hlog", usec);
+    fp = fopen(filename, "w");
+    if (!fp)
+        return -1;
+
+    /* Wall clock time when the workload started, in u-sec */
+    elapsed = fox_timestamp_now () - wl->stats->tstart;
+    start = fox_timestamp_wall () - elapsed / 1000;
+    tsec = start / SEC64;
+
+    strftime (date, 32, "%a %b %d %H:%M:%S %Z %Y", localtime (&tsec));
+
+    if (fprintf (fp, "#[Histogram log format version 1.3]\n"
+                 "#[StartTime: %lu.%03lu (seconds since epoch), %s]\n"
+                 "\"StartTimestamp\",\"Interval_Length\",\"Interval_Max\","
+                 "\"Interval_Compressed_Histogram\"\n",
+                 start / SEC64, (start % SEC64) / 1000, date) < 0)
+        goto CLOSE;
+
+    for (i = 0; i < FOX_HIST_OPS; i++) {
+        if (i == FOX_HIST_QUEUE && !wl->arrival)
+            continue;
+        if (fox_output_hlog_line (fp, name[i], &wl->stats->hist[i],
+                                                    elapsed / (double) NSEC64))
+            goto CLOSE;
+
+        for (node_i = 0; node_i < wl->nthreads; node_i++) {
+            sprintf (tag, "%s.j%d", name[i], nodes[node_i].nid);
+            if (fox_output_hlog_line (fp, tag, &nodes[node_i].stats.hist[i],
+                                                    elapsed / (double) NSEC64))
+                goto CLOSE;
+        }
+    }
+
+    ret = 0;
+
+CLOSE:
+    if (ret)
+        printf (" [fox-output: ERROR. Not possible to write histograms.]\n");
     fclose (fp);
-}
\ No newline at end of file
+    return ret;
+}
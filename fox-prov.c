@@ -29,7 +29,8 @@
 
 /*
  * PROVISIONING INTERFACE
- * Wraps liblightnvm vblock IO interface, exposing basic read, write and erase
+ * Wraps the vblock IO interface of the selected storage backend (liblightnvm
+ * or the file-backed emulator), exposing basic read, write and erase
  * operations.
  * Implements vblock provisioning with get and put operations, keeping record
  * of free and used blocks.
@@ -44,15 +45,516 @@
 #include <errno.h>
 #include <time.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "fox.h"
 
+/* Service thread for asynchronous commands on synchronous backends. Each
+ * thread serves a set of LUNs in FIFO order, keeping the program order
+ * within a block. The thread takes all queued commands at each wake up and
+ * is only signaled when it sleeps, so a full queue costs no context switch
+ * per command */
+struct prov_io_worker {
+    pthread_t               tid;
+    uint8_t                 stop;
+    uint8_t                 sleeping;
+    pthread_mutex_t         w_mutex;
+    pthread_cond_t          w_cond;
+    TAILQ_HEAD(pio_list, prov_io) io_head;
+};
+
+/* Bad block table cache, one file per device and geometry under ./bbt.
+ * The file holds the block states of all LUNs, 1 byte per plane. It is
+ * used instead of the device tables while younger than 'max_age' seconds
+ * and removed when a block is marked as bad. The file records the drive
+ * identifier, if the device has one, and the table of one LUN picked at
+ * random is read from the device and compared before the file is used */
+#define PROV_BBT_MAGIC      0x5442425f584f46    /* "FOX_BBT" */
+#define PROV_BBT_VERSION    0x2
+#define PROV_BBT_DEV_LEN    128
+#define PROV_DEV_ID_LEN     64
+
+struct prov_bbt_hdr {
+    uint64_t    magic;
+    uint32_t    version;
+    uint32_t    nchannels;
+    uint32_t    nluns;
+    uint32_t    nplanes;
+    uint32_t    nblocks;
+    uint32_t    npages;
+    uint64_t    created;    /* wall clock, seconds */
+    char        dev[PROV_BBT_DEV_LEN];
+    char        id[PROV_DEV_ID_LEN];
+};
+
+struct prov_bbt_cache {
+    char        dev[PROV_BBT_DEV_LEN];
+    char        id[PROV_DEV_ID_LEN];   /* empty if the device has none */
+    uint8_t     other_dev;  /* the file belongs to another drive */
+    char        file[PROV_BBT_DEV_LEN + 64];
+    uint8_t     refresh;
+    uint32_t    max_age;
+    uint8_t     *blks;      /* loaded states, NULL if not cached */
+};
+
+/* Wear of each block, kept under ./wear with the same key as the bad block
+ * table cache. Compact arrays indexed by lun * nblocks + blk hold the erase
+ * count of the device life, the erases of this run and the latency of the
+ * last erase. The file is loaded by prov_init and written by prov_exit */
+#define PROV_WEAR_MAGIC     0x524145575f584f46  /* "FOX_WEAR" */
+#define PROV_WEAR_VERSION   0x2
+
+struct prov_wear_tbl {
+    char        file[PROV_BBT_DEV_LEN + 64];
+    uint8_t     policy;
+    uint32_t    *erases;
+    uint32_t    *run;
+    uint32_t    *last_us;
+};
+
 static struct prov_v_dev virt_dev;
+static struct prov_bbt_cache bbt_cache = {.max_age = PROV_BBT_MAX_AGE};
+static struct prov_wear_tbl wear;
+static uint32_t bbt_grown;      /* blocks marked bad during the run */
+static struct prov_backend *prov_be;
+static struct prov_io_worker *io_workers;
+static int io_nworkers;
+
+LIST_HEAD(be_list, prov_backend) be_head = LIST_HEAD_INITIALIZER(be_head);
+
+void prov_bbt_cache_set(uint8_t refresh, uint32_t max_age)
+{
+    bbt_cache.refresh = refresh;
+    bbt_cache.max_age = max_age;
+}
+
+uint8_t prov_bbt_cached(void)
+{
+    return (bbt_cache.blks != NULL);
+}
+
+uint32_t prov_bbt_grown(void)
+{
+    return __atomic_load_n(&bbt_grown, __ATOMIC_RELAXED);
+}
+
+static size_t prov_bbt_lun_sz(void)
+{
+    return virt_dev.geo->nblocks * virt_dev.geo->nplanes;
+}
+
+static void prov_bbt_cache_hdr(struct prov_bbt_hdr *hdr)
+{
+    memset(hdr, 0, sizeof(struct prov_bbt_hdr));
+    hdr->magic = PROV_BBT_MAGIC;
+    hdr->version = PROV_BBT_VERSION;
+    hdr->nchannels = virt_dev.geo->nchannels;
+    hdr->nluns = virt_dev.geo->nluns;
+    hdr->nplanes = virt_dev.geo->nplanes;
+    hdr->nblocks = virt_dev.geo->nblocks;
+    hdr->npages = virt_dev.geo->npages;
+    strcpy(hdr->dev, bbt_cache.dev);
+    strcpy(hdr->id, bbt_cache.id);
+}
+
+/* Identifier of the drive behind a device path, read from sysfs. Left
+ * empty if there is none, e.g. for the emulator */
+static void prov_dev_id(const char *dev_path, char *id, size_t sz)
+{
+    const char *attr[] = {"wwid", "device/serial"};
+    const char *name = strrchr(dev_path, '/');
+    char path[PROV_BBT_DEV_LEN + 32];
+    FILE *fp;
+    int i;
+
+    id[0] = '\0';
+    name = (name) ? name + 1 : dev_path;
+
+    for (i = 0; i < 2 && !id[0]; i++) {
+        snprintf(path, sizeof(path), "/sys/block/%s/%s", name, attr[i]);
+        fp = fopen(path, "r");
+        if (!fp)
+            continue;
+
+        if (!fgets(id, sz, fp))
+            id[0] = '\0';
+        id[strcspn(id, " \n")] = '\0';
+        fclose(fp);
+    }
+}
+
+/* Compares the cached table of one LUN with the table of the device. A
+ * different drive at the same path with the same geometry does not pass
+ * unless the LUN tables are equal */
+static int prov_bbt_cache_check(void)
+{
+    const struct nvm_bbt *bbt;
+    struct nvm_addr addr;
+    struct nvm_ret ret;
+    int lun, nluns;
+
+    nluns = virt_dev.geo->nchannels * virt_dev.geo->nluns;
+    lun = time(NULL) % nluns;
+
+    addr.ppa = 0x0;
+    addr.g.ch = lun / virt_dev.geo->nluns;
+    addr.g.lun = lun % virt_dev.geo->nluns;
+
+    bbt = prov_get_bbt(virt_dev.dev, addr, &ret);
+    if (!bbt)
+        return -1;
+
+    return memcmp(bbt->blks, bbt_cache.blks + lun * prov_bbt_lun_sz(),
+                                                prov_bbt_lun_sz()) ? -1 : 0;
+}
+
+/* Device name and geometry are the key of the files under 'dir' */
+static void prov_cache_file(char *file, size_t sz, const char *dir)
+{
+    int i;
+
+    snprintf(file, sz, "%s/%s_%dx%dx%dx%d.%s", dir, bbt_cache.dev,
+                (int) virt_dev.geo->nchannels, (int) virt_dev.geo->nluns,
+                (int) virt_dev.geo->nblocks, (int) virt_dev.geo->nplanes, dir);
+    for (i = strlen(dir) + 1; file[i] != '\0'; i++) {
+        if (strchr("/?&=:", file[i]))
+            file[i] = '_';
+    }
+}
+
+/* Loads the cached states if the file matches the device and geometry */
+static void prov_bbt_cache_load(void)
+{
+    struct prov_bbt_hdr hdr, exp;
+    FILE *fp;
+    size_t sz;
+    uint64_t now = time(NULL);
+
+    bbt_cache.blks = NULL;
+
+    prov_cache_file(bbt_cache.file, sizeof(bbt_cache.file), "bbt");
+
+    if (!bbt_cache.max_age || bbt_cache.refresh)
+        return;
+
+    fp = fopen(bbt_cache.file, "r");
+    if (!fp)
+        return;
+
+    prov_bbt_cache_hdr(&exp);
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1)
+        goto CLOSE;
+
+    exp.created = hdr.created;
+    if (memcmp(&hdr, &exp, sizeof(hdr)) || hdr.created > now ||
+                                    now - hdr.created > bbt_cache.max_age)
+        goto CLOSE;
+
+    sz = prov_bbt_lun_sz() * virt_dev.geo->nchannels * virt_dev.geo->nluns;
+    bbt_cache.blks = malloc(sz);
+    if (!bbt_cache.blks)
+        goto CLOSE;
+
+    if (fread(bbt_cache.blks, sz, 1, fp) != 1 || fgetc(fp) != EOF)
+        goto FREE;
+
+    if (prov_bbt_cache_check()) {
+        printf(" [prov: Cached bad block table does not match the device, "
+                                                        "reading all LUNs.]\n");
+        bbt_cache.other_dev = 1;
+        goto FREE;
+    }
+
+    goto CLOSE;
+
+FREE:
+    free(bbt_cache.blks);
+    bbt_cache.blks = NULL;
+CLOSE:
+    fclose(fp);
+}
+
+/* Writes the states read from the device. A file being written is not
+ * visible under its name until complete */
+static void prov_bbt_cache_save(void)
+{
+    struct prov_bbt_hdr hdr;
+    struct stat st = {0};
+    char tmp[PROV_BBT_DEV_LEN + 72];
+    FILE *fp;
+    int lun, blk, nluns;
+
+    if (!bbt_cache.max_age || bbt_cache.blks)
+        return;
+
+    if (stat("bbt", &st) == -1)
+        mkdir("bbt", S_IRWXU | S_IRWXG | S_IRWXO);
+
+    sprintf(tmp, "%s.%d", bbt_cache.file, (int) getpid());
+    fp = fopen(tmp, "w");
+    if (!fp)
+        return;
+
+    prov_bbt_cache_hdr(&hdr);
+    hdr.created = time(NULL);
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+        goto ERR;
+
+    nluns = virt_dev.geo->nchannels * virt_dev.geo->nluns;
+    for (lun = 0; lun < nluns; lun++) {
+        for (blk = 0; blk < virt_dev.geo->nblocks; blk++) {
+            if (fwrite(virt_dev.prov_vblks[lun][blk].state,
+                                    virt_dev.geo->nplanes, 1, fp) != 1)
+                goto ERR;
+        }
+    }
+
+    if (fclose(fp) || rename(tmp, bbt_cache.file))
+        unlink(tmp);
+
+    return;
+
+ERR:
+    fclose(fp);
+    unlink(tmp);
+}
+
+void prov_wear_policy_set(uint8_t policy)
+{
+    wear.policy = policy;
+}
+
+/* Counts start from zero if the file is missing or does not match */
+static int prov_wear_load(void)
+{
+    struct prov_bbt_hdr hdr, exp;
+    size_t nblks;
+    FILE *fp;
+
+    nblks = virt_dev.geo->nchannels * virt_dev.geo->nluns *
+                                                    virt_dev.geo->nblocks;
+
+    wear.erases = calloc(nblks, sizeof(uint32_t));
+    wear.run = calloc(nblks, sizeof(uint32_t));
+    wear.last_us = calloc(nblks, sizeof(uint32_t));
+    if (!wear.erases || !wear.run || !wear.last_us)
+        goto FREE;
+
+    prov_cache_file(wear.file, sizeof(wear.file), "wear");
+
+    /* Counts of another drive are not loaded, the file is rewritten */
+    if (bbt_cache.other_dev)
+        return 0;
+
+    fp = fopen(wear.file, "r");
+    if (!fp)
+        return 0;
+
+    prov_bbt_cache_hdr(&exp);
+    exp.magic = PROV_WEAR_MAGIC;
+    exp.version = PROV_WEAR_VERSION;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1)
+        goto CLOSE;
+
+    exp.created = hdr.created;
+    if (memcmp(&hdr, &exp, sizeof(hdr)))
+        goto CLOSE;
+
+    if (fread(wear.erases, sizeof(uint32_t), nblks, fp) != nblks ||
+        fread(wear.last_us, sizeof(uint32_t), nblks, fp) != nblks ||
+                                                        fgetc(fp) != EOF) {
+        memset(wear.erases, 0, nblks * sizeof(uint32_t));
+        memset(wear.last_us, 0, nblks * sizeof(uint32_t));
+    }
+
+CLOSE:
+    fclose(fp);
+    return 0;
+
+FREE:
+    free(wear.erases);
+    free(wear.run);
+    free(wear.last_us);
+    return -1;
+}
+
+static void prov_wear_save(void)
+{
+    struct prov_bbt_hdr hdr;
+    struct stat st = {0};
+    char tmp[PROV_BBT_DEV_LEN + 72];
+    size_t nblks;
+    FILE *fp;
+
+    nblks = virt_dev.geo->nchannels * virt_dev.geo->nluns *
+                                                    virt_dev.geo->nblocks;
+
+    if (stat("wear", &st) == -1)
+        mkdir("wear", S_IRWXU | S_IRWXG | S_IRWXO);
+
+    sprintf(tmp, "%s.%d", wear.file, (int) getpid());
+    fp = fopen(tmp, "w");
+    if (!fp) {
+        printf(" [prov: ERROR. Block wear not saved to %s.]\n", wear.file);
+        return;
+    }
+
+    prov_bbt_cache_hdr(&hdr);
+    hdr.magic = PROV_WEAR_MAGIC;
+    hdr.version = PROV_WEAR_VERSION;
+    hdr.created = time(NULL);
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(wear.erases, sizeof(uint32_t), nblks, fp) != nblks ||
+        fwrite(wear.last_us, sizeof(uint32_t), nblks, fp) != nblks) {
+        fclose(fp);
+        goto ERR;
+    }
+
+    if (fclose(fp) || rename(tmp, wear.file))
+        goto ERR;
+
+    return;
+
+ERR:
+    unlink(tmp);
+    printf(" [prov: ERROR. Block wear not saved to %s.]\n", wear.file);
+}
+
+static void prov_wear_free(void)
+{
+    free(wear.erases);
+    free(wear.run);
+    free(wear.last_us);
+    wear.erases = wear.run = wear.last_us = NULL;
+}
+
+/* Accounts a successful erase. Erases issued with prov_io_submit are
+ * accounted by the caller on completion. Commands that run without the
+ * provisioning service (e.g. fox erase) have no table */
+void prov_vblk_wear_add(struct nvm_vblk *vblk, uint64_t ns)
+{
+    size_t idx;
+    int i;
+
+    if (!wear.erases)
+        return;
+
+    for (i = 0; i < vblk->nblks; i++) {
+        idx = (vblk->blks[i].g.ch * virt_dev.geo->nluns +
+                vblk->blks[i].g.lun) * virt_dev.geo->nblocks +
+                vblk->blks[i].g.blk;
+
+        wear.erases[idx]++;
+        wear.run[idx]++;
+        wear.last_us[idx] = (ns / 1000 > UINT32_MAX) ? UINT32_MAX : ns / 1000;
+    }
+}
+
+/* Returns -1 for bad blocks, 'w' is filled anyway */
+int prov_vblk_wear(int ch, int l, int blk, struct prov_wear *w)
+{
+    int lun = ch * virt_dev.geo->nluns + l;
+    size_t idx = lun * virt_dev.geo->nblocks + blk;
+    int pl;
+
+    w->erases = wear.erases[idx];
+    w->run = wear.run[idx];
+    w->last_us = wear.last_us[idx];
+
+    for (pl = 0; pl < virt_dev.geo->nplanes; pl++) {
+        if (virt_dev.prov_vblks[lun][blk].state[pl])
+            return -1;
+    }
+
+    return 0;
+}
+
+/* LUNs are initialized by up to PROV_INIT_THREADS threads, each one takes
+ * the next LUN until all are done. Getting the bad block table is a device
+ * round trip per LUN */
+#define PROV_INIT_THREADS   16
+
+struct prov_init_ctx {
+    int     next;
+    int     nluns;
+    int     *err;
+};
+
+static uint64_t prov_init_ns;
+
+static void *prov_init_th (void *arg)
+{
+    struct prov_init_ctx *ctx = arg;
+    uint64_t tstart;
+    int lun;
+
+    while ((lun = __atomic_fetch_add (&ctx->next, 1, __ATOMIC_RELAXED))
+                                                                < ctx->nluns) {
+        tstart = fox_timestamp_now ();
+        ctx->err[lun] = prov_vblk_list_create(lun);
+        virt_dev.luns[lun].init_ns = fox_timestamp_now () - tstart;
+    }
+
+    return NULL;
+}
+
+static int prov_init_luns (int nluns)
+{
+    struct prov_init_ctx ctx;
+    pthread_t tid[PROV_INIT_THREADS];
+    int lun, th, nth, err = 0;
+
+    ctx.err = calloc(nluns, sizeof(int));
+    if (!ctx.err)
+        return -1;
+
+    ctx.next = 0;
+    ctx.nluns = nluns;
+
+    for (lun = 0; lun < nluns; lun++)
+        virt_dev.luns[lun].seed = rand();
+
+    /* The calling thread also takes LUNs, fewer threads only take longer */
+    nth = (nluns - 1 < PROV_INIT_THREADS) ? nluns - 1 : PROV_INIT_THREADS;
+    for (th = 0; th < nth; th++) {
+        if (pthread_create(&tid[th], NULL, prov_init_th, &ctx))
+            break;
+    }
+    nth = th;
+
+    prov_init_th (&ctx);
+
+    for (th = 0; th < nth; th++)
+        pthread_join(tid[th], NULL);
+
+    for (lun = 0; lun < nluns; lun++) {
+        if (ctx.err[lun]) {
+            printf(" [prov: ERROR. LUN %d (ch %d, lun %d) not initialized.]\n",
+                    lun, (int) (lun / virt_dev.geo->nluns),
+                    (int) (lun % virt_dev.geo->nluns));
+            err++;
+        }
+    }
+
+    if (err) {
+        for (lun = 0; lun < nluns; lun++) {
+            if (!ctx.err[lun])
+                prov_vblk_list_free(lun);
+        }
+    }
+
+    free(ctx.err);
+
+    return (err) ? -1 : 0;
+}
 
 int prov_init(struct nvm_dev *dev, const struct nvm_geo *geo)
 {
     int lun, err_lun;
     int nluns;
     int nblocks;
+    uint64_t tstart = fox_timestamp_now ();
 
     srand(time(NULL));
 
@@ -79,17 +581,29 @@ int prov_init(struct nvm_dev *dev, const struct nvm_geo *geo)
                 free(virt_dev.prov_vblks[err_lun]);
             goto FREE_VBLKS;
         }
-
-        if (prov_vblk_list_create(lun) < 0) {
-            for (err_lun = 0; err_lun < lun; err_lun++)
-                prov_vblk_list_free(err_lun);
-            goto FREE_VBLKS_LUN;
-        }
     }
 
+    prov_bbt_cache_load();
+
+    if (prov_init_luns(nluns))
+        goto FREE_VBLKS_LUN;
+
+    prov_bbt_cache_save();
+
+    if (prov_wear_load())
+        goto FREE_POOLS;
+
+    prov_init_ns = fox_timestamp_now () - tstart;
+
     return 0;
 
+  FREE_POOLS:
+    for (lun = 0; lun < nluns; lun++)
+        prov_vblk_list_free(lun);
+
   FREE_VBLKS_LUN:
+    free(bbt_cache.blks);
+    bbt_cache.blks = NULL;
     for (err_lun = 0; err_lun < nluns; err_lun++)
         free(virt_dev.prov_vblks[err_lun]);
 
@@ -101,6 +615,31 @@ int prov_init(struct nvm_dev *dev, const struct nvm_geo *geo)
     return -1;
 }
 
+/* Time spent in prov_init and in the slowest LUN, in n-sec */
+void prov_init_time (uint64_t *total, uint64_t *lun_max, int *lun)
+{
+    int i, nluns;
+
+    nluns = virt_dev.geo->nchannels * virt_dev.geo->nluns;
+
+    *total = prov_init_ns;
+    *lun_max = 0;
+    *lun = 0;
+
+    for (i = 0; i < nluns; i++) {
+        if (virt_dev.luns[i].init_ns > *lun_max) {
+            *lun_max = virt_dev.luns[i].init_ns;
+            *lun = i;
+        }
+    }
+}
+
+/* Time spent loading the table and building the pools of a LUN, in n-sec */
+uint64_t prov_lun_init_time (int lun)
+{
+    return virt_dev.luns[lun].init_ns;
+}
+
 int prov_exit(void)
 {
     int lun;
@@ -108,6 +647,9 @@ int prov_exit(void)
 
     nluns = virt_dev.geo->nchannels * virt_dev.geo->nluns;
 
+    prov_wear_save();
+    prov_wear_free();
+
     for (lun = 0; lun < nluns; lun++) {
         if (prov_vblk_list_free(lun))
             return -1;
@@ -116,38 +658,68 @@ int prov_exit(void)
 
     free(virt_dev.prov_vblks);
     free(virt_dev.luns);
+    free(bbt_cache.blks);
+    bbt_cache.blks = NULL;
 
     return 0;
 }
 
 int prov_vblk_list_create(int lun)
 {
-    int blk;
+    int blk, rnd;
     int nblk;
     struct nvm_addr addr;
     const struct nvm_bbt *bbt;
+    const uint8_t *bbt_blks;
     struct nvm_ret ret;
+    struct prov_lun *p_lun = &virt_dev.luns[lun];
+    struct prov_vblk *tmp;
 
     addr.ppa = 0x0;
     addr.g.ch = lun / virt_dev.geo->nluns;
     addr.g.lun = lun % virt_dev.geo->nluns;
-    virt_dev.luns[lun].addr = addr;
+    p_lun->addr = addr;
     nblk = virt_dev.geo->nblocks;
 
-    bbt = prov_get_bbt(virt_dev.dev, addr, &ret);
-    if (!bbt)
+    if (bbt_cache.blks) {
+        bbt_blks = bbt_cache.blks + lun * prov_bbt_lun_sz();
+    } else {
+        bbt = prov_get_bbt(virt_dev.dev, addr, &ret);
+        if (!bbt)
+            return -1;
+        bbt_blks = bbt->blks;
+    }
+
+    p_lun->free_blks = malloc(nblk * sizeof(struct prov_vblk *));
+    if (!p_lun->free_blks)
         return -1;
 
-    virt_dev.luns[lun].nfree_blks = 0;
-    virt_dev.luns[lun].nused_blks = 0;
-    CIRCLEQ_INIT(&(virt_dev.luns[lun].free_blk_head));
-    CIRCLEQ_INIT(&(virt_dev.luns[lun].used_blk_head));
-    pthread_mutex_init(&(virt_dev.luns[lun].l_mutex), NULL);
+    p_lun->used_blks = malloc(nblk * sizeof(struct prov_vblk *));
+    if (!p_lun->used_blks) {
+        free(p_lun->free_blks);
+        return -1;
+    }
+
+    p_lun->nfree_blks = 0;
+    p_lun->nused_blks = 0;
+    p_lun->free_head = 0;
+    pthread_mutex_init(&(p_lun->l_mutex), NULL);
 
     for (blk = 0; blk < nblk; blk++) {
-        prov_vblk_alloc(bbt, lun, blk);
+        prov_vblk_alloc(bbt_blks, lun, blk);
     }
 
+    /* Fisher-Yates, blocks are handed out in random order */
+    for (blk = p_lun->nfree_blks - 1; blk > 0; blk--) {
+        rnd = rand_r(&p_lun->seed) % (blk + 1);
+        tmp = p_lun->free_blks[blk];
+        p_lun->free_blks[blk] = p_lun->free_blks[rnd];
+        p_lun->free_blks[rnd] = tmp;
+    }
+
+    for (blk = 0; blk < p_lun->nfree_blks; blk++)
+        p_lun->free_blks[blk]->free_idx = blk;
+
     return 0;
 }
 
@@ -155,75 +727,46 @@ int prov_vblk_list_free(int lun)
 {
     int nblk;
     int blk;
-    struct prov_vblk *vblk, *tmp;
 
     nblk = virt_dev.geo->nblocks;
 
-    if (virt_dev.luns[lun].nfree_blks > 0) {
-        vblk = CIRCLEQ_FIRST(&(virt_dev.luns[lun].free_blk_head));
-
-        for (blk = 0; blk < virt_dev.luns[lun].nfree_blks; blk++) {
-            tmp = CIRCLEQ_NEXT(vblk, entry);
-            CIRCLEQ_REMOVE(&(virt_dev.luns[lun].free_blk_head),
-                           vblk, entry);
-            vblk = tmp;
-        }
-    }
-
-    if (virt_dev.luns[lun].nused_blks > 0) {
-        vblk = CIRCLEQ_FIRST(&(virt_dev.luns[lun].used_blk_head));
-
-        for (blk = 0; blk < virt_dev.luns[lun].nused_blks; blk++) {
-            tmp = CIRCLEQ_NEXT(vblk, entry);
-            CIRCLEQ_REMOVE(&(virt_dev.luns[lun].used_blk_head),
-                           vblk, entry);
-            vblk = tmp;
-        }
-    }
-
     for (blk = 0; blk < nblk; blk++) {
         prov_vblk_free(lun, blk);
     }
 
+    free(virt_dev.luns[lun].free_blks);
+    free(virt_dev.luns[lun].used_blks);
+    virt_dev.luns[lun].nfree_blks = 0;
+    virt_dev.luns[lun].nused_blks = 0;
+
     pthread_mutex_destroy(&(virt_dev.luns[lun].l_mutex));
 
     return 0;
 }
 
-int prov_vblk_alloc(const struct nvm_bbt *bbt, int lun, int blk)
+int prov_vblk_alloc(const uint8_t *bbt, int lun, int blk)
 {
     int pl;
     int bad_blk = 0;
     struct prov_vblk *vblk = &(virt_dev.prov_vblks[lun][blk]);
+    struct prov_lun *p_lun = &virt_dev.luns[lun];
 
     vblk->state = malloc(8 * virt_dev.geo->nplanes);
     if (vblk->state == NULL)
         return -1;
 
-    vblk->addr = virt_dev.luns[lun].addr;
+    vblk->addr = p_lun->addr;
     vblk->addr.g.blk = blk;
+    vblk->free_idx = UINT32_MAX;
 
     for (pl = 0; pl < virt_dev.geo->nplanes; pl++) {
-        vblk->state[pl] = bbt->blks[virt_dev.geo->nplanes * blk + pl];
+        vblk->state[pl] = bbt[virt_dev.geo->nplanes * blk + pl];
         bad_blk += vblk->state[pl];
     }
 
     if (!bad_blk) {
-        struct prov_vblk *rnd_vblk = prov_vblk_rand(lun);
-
-        if (rnd_vblk == NULL) {
-            CIRCLEQ_INSERT_HEAD(&(virt_dev.luns[lun].free_blk_head),
-                                vblk, entry);
-        } else {
-
-            if (rand() % 2)
-                CIRCLEQ_INSERT_BEFORE(&(virt_dev.luns[lun].free_blk_head),
-                                                rnd_vblk, vblk, entry);
-            else
-                CIRCLEQ_INSERT_AFTER(&(virt_dev.luns[lun].free_blk_head),
-                                                rnd_vblk, vblk, entry);
-        }
-        virt_dev.luns[lun].nfree_blks++;
+        p_lun->free_blks[p_lun->nfree_blks] = vblk;
+        p_lun->nfree_blks++;
     }
     return 0;
 }
@@ -236,49 +779,115 @@ int prov_vblk_free(int lun, int blk)
 
 struct prov_vblk *prov_vblk_rand(int lun)
 {
-    int blk, blk_idx;
-    struct prov_vblk *vblk, *tmp;
+    struct prov_lun *p_lun = &virt_dev.luns[lun];
+    uint32_t idx;
 
-    if (virt_dev.luns[lun].nfree_blks > 0) {
-        blk_idx = rand() % virt_dev.luns[lun].nfree_blks;
-        vblk = CIRCLEQ_FIRST(&(virt_dev.luns[lun].free_blk_head));
+    if (p_lun->nfree_blks > 0) {
+        idx = p_lun->free_head + rand() % p_lun->nfree_blks;
+        return p_lun->free_blks[idx % virt_dev.geo->nblocks];
+    }
+    return NULL;
+}
 
-        for (blk = 0; blk < blk_idx; blk++) {
-            tmp = CIRCLEQ_NEXT(vblk, entry);
-            vblk = tmp;
-        }
+int prov_backend_register (struct prov_backend *be)
+{
+    if (!be)
+        return -1;
+
+    LIST_INSERT_HEAD(&be_head, be, entry);
+    return 0;
+}
+
+static int prov_init_backends (void)
+{
+    if (!LIST_EMPTY(&be_head))
+        return 0;
+
+    if (prov_lnvm_init() || prov_emu_init())
+        return -1;
+
+    return 0;
+}
+
+/* Returns the backend matching the device name prefix, or the default
+ * backend (no prefix) if none matches */
+static struct prov_backend *prov_get_backend (const char *dev_path)
+{
+    struct prov_backend *be, *def = NULL;
 
-        return vblk;
+    LIST_FOREACH(be, &be_head, entry){
+        if (!be->prefix) {
+            def = be;
+            continue;
+        }
+        if (strncmp(dev_path, be->prefix, strlen(be->prefix)) == 0)
+            return be;
     }
-    return NULL;
+
+    return def;
+}
+
+const char *prov_backend_name(void)
+{
+    return (prov_be) ? prov_be->name : NULL;
 }
 
 struct nvm_dev *prov_dev_open(const char *dev_path)
 {
-    return nvm_dev_open(dev_path);
+    if (prov_init_backends())
+        return NULL;
+
+    prov_be = prov_get_backend(dev_path);
+    if (!prov_be)
+        return NULL;
+
+    snprintf(bbt_cache.dev, PROV_BBT_DEV_LEN, "%s", dev_path);
+
+    if (prov_be->prefix)
+        dev_path += strlen(prov_be->prefix);
+    else
+        prov_dev_id(dev_path, bbt_cache.id, sizeof(bbt_cache.id));
+
+    return prov_be->dev_open(dev_path);
 }
 
 void prov_dev_close(struct nvm_dev *dev)
 {
-    return nvm_dev_close(dev);
+    return prov_be->dev_close(dev);
+}
+
+int prov_dev_set_meta_mode(struct nvm_dev *dev, int mode)
+{
+    return prov_be->set_meta_mode(dev, mode);
 }
 
 const struct nvm_geo *prov_get_geo(struct nvm_dev *dev)
 {
-    return nvm_dev_get_geo(dev);
+    return prov_be->get_geo(dev);
 }
 
 const struct nvm_bbt *prov_get_bbt(struct nvm_dev *dev,
                                    struct nvm_addr addr,
                                    struct nvm_ret *ret)
 {
-    return nvm_bbt_get(dev, addr, ret);
+    return prov_be->get_bbt(dev, addr, ret);
+}
+
+struct nvm_vblk *prov_vblk_new(struct nvm_dev *dev, struct nvm_addr *addrs,
+                                                                   int naddrs)
+{
+    return prov_be->vblk_alloc(dev, addrs, naddrs);
+}
+
+void prov_vblk_destroy(struct nvm_vblk *vblk)
+{
+    prov_be->vblk_free(vblk);
 }
 
 ssize_t prov_vblk_pread(struct nvm_vblk * vblk, void *buf, size_t count,
                         size_t offset)
 {
-    ssize_t nbytes = nvm_vblk_pread(vblk, buf, count, offset);
+    ssize_t nbytes = prov_be->vblk_pread(vblk, buf, count, offset);
 
     return nbytes;
 }
@@ -286,33 +895,176 @@ ssize_t prov_vblk_pread(struct nvm_vblk * vblk, void *buf, size_t count,
 ssize_t prov_vblk_pwrite(struct nvm_vblk * vblk, const void *buf,
                          size_t count, size_t offset)
 {
-    ssize_t nbytes = nvm_vblk_pwrite(vblk, buf, count, offset);
+    ssize_t nbytes = prov_be->vblk_pwrite(vblk, buf, count, offset);
 
     return nbytes;
 }
 
 ssize_t prov_vblk_erase(struct nvm_vblk * vblk)
 {
-    int pmode;
-    int err;
+    uint64_t tstart = fox_timestamp_now ();
+    ssize_t ret;
 
-    pmode = nvm_dev_get_pmode(virt_dev.dev);
-    if (nvm_dev_set_pmode(virt_dev.dev, 0x0) < 0)
-        goto FAIL;
+    ret = prov_be->vblk_erase(vblk);
+    if (ret >= 0)
+        prov_vblk_wear_add(vblk, fox_timestamp_now () - tstart);
 
-    err = nvm_vblk_erase(vblk);
-    if (err < 0)
-        goto SET_PMODE;
+    return ret;
+}
 
-    if (nvm_dev_set_pmode(virt_dev.dev, pmode) < 0)
-        goto FAIL;
+/* Erases 'n' vblks with as few commands as the backend allows, err[i] is
+ * set if vblks[i] failed and ns[i] is the latency of the command it was
+ * part of. Returns the number of vblks that failed */
+int prov_vblk_erase_v(struct nvm_vblk **vblks, int n, int *err, uint64_t *ns)
+{
+    uint64_t tstart;
+    int i, nfail = 0;
+
+    if (!prov_be->vblk_erase_v) {
+        for (i = 0; i < n; i++) {
+            tstart = fox_timestamp_now ();
+            err[i] = (prov_vblk_erase(vblks[i]) < 0);
+            ns[i] = fox_timestamp_now () - tstart;
+            nfail += err[i];
+        }
+        return nfail;
+    }
 
-    return err;
+    if (n < 1)
+        return 0;
 
-SET_PMODE:
-    nvm_dev_set_pmode(virt_dev.dev, pmode);
-FAIL:
-    return -1;
+    nfail = prov_be->vblk_erase_v(vblks, n, err, ns);
+
+    for (i = 0; i < n; i++)
+        if (!err[i])
+            prov_vblk_wear_add(vblks[i], ns[i]);
+
+    return nfail;
+}
+
+static void prov_io_exec (struct prov_io *io)
+{
+    switch (io->type) {
+        case FOX_WRITE:
+            io->ret = prov_be->vblk_pwrite(io->vblk, io->buf, io->count,
+                                                                io->offset);
+            break;
+        case FOX_ERASE:
+            io->ret = prov_be->vblk_erase(io->vblk);
+            break;
+        default:
+            io->ret = prov_be->vblk_pread(io->vblk, io->buf, io->count,
+                                                                io->offset);
+    }
+}
+
+static void *prov_io_worker_th (void *arg)
+{
+    struct prov_io_worker *w = (struct prov_io_worker *) arg;
+    struct pio_list batch;
+    struct prov_io *io;
+    uint8_t stop;
+
+    TAILQ_INIT(&batch);
+
+    do {
+        pthread_mutex_lock(&w->w_mutex);
+
+        while (TAILQ_EMPTY(&w->io_head) && !w->stop) {
+            w->sleeping = 1;
+            pthread_cond_wait(&w->w_cond, &w->w_mutex);
+            w->sleeping = 0;
+        }
+
+        TAILQ_CONCAT(&batch, &w->io_head, entry);
+        stop = w->stop;
+
+        pthread_mutex_unlock(&w->w_mutex);
+
+        while ((io = TAILQ_FIRST(&batch))) {
+            TAILQ_REMOVE(&batch, io, entry);
+            prov_io_exec (io);
+            io->done (io);
+        }
+    } while (!stop);
+
+    return NULL;
+}
+
+int prov_io_init (int nworkers)
+{
+    int i;
+
+    if (prov_be->vblk_submit || nworkers < 1)
+        return 0;
+
+    io_workers = calloc (nworkers, sizeof (struct prov_io_worker));
+    if (!io_workers)
+        return -1;
+
+    for (i = 0; i < nworkers; i++) {
+        TAILQ_INIT(&io_workers[i].io_head);
+        pthread_mutex_init(&io_workers[i].w_mutex, NULL);
+        pthread_cond_init(&io_workers[i].w_cond, NULL);
+
+        if (pthread_create(&io_workers[i].tid, NULL, prov_io_worker_th,
+                                                           &io_workers[i])) {
+            io_nworkers = i;
+            prov_io_exit ();
+            return -1;
+        }
+    }
+    io_nworkers = nworkers;
+
+    return 0;
+}
+
+void prov_io_exit (void)
+{
+    int i;
+
+    for (i = 0; i < io_nworkers; i++) {
+        pthread_mutex_lock(&io_workers[i].w_mutex);
+        io_workers[i].stop = 1;
+        pthread_cond_signal(&io_workers[i].w_cond);
+        pthread_mutex_unlock(&io_workers[i].w_mutex);
+
+        pthread_join(io_workers[i].tid, NULL);
+        pthread_mutex_destroy(&io_workers[i].w_mutex);
+        pthread_cond_destroy(&io_workers[i].w_cond);
+    }
+
+    free (io_workers);
+    io_workers = NULL;
+    io_nworkers = 0;
+}
+
+/* Submits an asynchronous command. 'io->done' is called on completion */
+int prov_io_submit (struct prov_io *io)
+{
+    struct prov_io_worker *w;
+    int lun;
+
+    if (prov_be->vblk_submit)
+        return prov_be->vblk_submit(io);
+
+    if (!io_nworkers) {
+        prov_io_exec (io);
+        io->done (io);
+        return 0;
+    }
+
+    lun = io->vblk->blks[0].g.ch * virt_dev.geo->nluns +
+                                                    io->vblk->blks[0].g.lun;
+    w = &io_workers[lun % io_nworkers];
+
+    pthread_mutex_lock(&w->w_mutex);
+    TAILQ_INSERT_TAIL(&w->io_head, io, entry);
+    if (w->sleeping)
+        pthread_cond_signal(&w->w_cond);
+    pthread_mutex_unlock(&w->w_mutex);
+
+    return 0;
 }
 
 int prov_bbt_mark(struct prov_vblk *vblk){
@@ -320,7 +1072,11 @@ int prov_bbt_mark(struct prov_vblk *vblk){
     int lun, blk, pl;
     struct nvm_ret ret;
 
-    nvm_bbt_mark(vblk->blk->dev, vblk->blk->blks, 1, 1, &ret);
+    prov_be->bbt_mark(virt_dev.dev, &vblk->addr, 1, 1, &ret);
+    __atomic_fetch_add(&bbt_grown, 1, __ATOMIC_RELAXED);
+
+    /* The cached table is stale now */
+    unlink(bbt_cache.file);
     lun = vblk->addr.g.ch * virt_dev.geo->nluns + vblk->addr.g.lun;
     blk = vblk->addr.g.blk;
 
@@ -330,100 +1086,274 @@ int prov_bbt_mark(struct prov_vblk *vblk){
     return 0;
 }
 
-struct nvm_vblk *prov_vblk_get(int ch, int l)
+/* Moves a block from the used pool to the tail of the free ring */
+static void prov_vblk_release(struct prov_lun *p_lun, struct prov_vblk *vblk)
+{
+    uint32_t tail;
+    struct prov_vblk *last;
+
+    pthread_mutex_lock(&(p_lun->l_mutex));
+
+    p_lun->nused_blks--;
+    last = p_lun->used_blks[p_lun->nused_blks];
+    p_lun->used_blks[vblk->used_idx] = last;
+    last->used_idx = vblk->used_idx;
+
+    tail = (p_lun->free_head + p_lun->nfree_blks) % virt_dev.geo->nblocks;
+    p_lun->free_blks[tail] = vblk;
+    vblk->free_idx = tail;
+    p_lun->nfree_blks++;
+
+    pthread_mutex_unlock(&(p_lun->l_mutex));
+}
+
+/* Position in the free ring, from the head, of the block to hand out.
+ * Least and most worn scan the free blocks of the LUN */
+static uint32_t prov_wear_pick(struct prov_lun *p_lun, int lun)
+{
+    uint32_t i, pick = 0, nblks = virt_dev.geo->nblocks;
+    uint32_t *erases = wear.erases + lun * nblks;
+    struct prov_vblk *vblk;
+    uint32_t cnt, best = 0;
+
+    if (wear.policy == PROV_WEAR_RANDOM)
+        return rand_r(&p_lun->seed) % p_lun->nfree_blks;
+
+    for (i = 0; i < p_lun->nfree_blks; i++) {
+        vblk = p_lun->free_blks[(p_lun->free_head + i) % nblks];
+        cnt = erases[vblk->addr.g.blk];
+        if (i == 0 || (wear.policy == PROV_WEAR_LEAST && cnt < best) ||
+                                (wear.policy == PROV_WEAR_MOST && cnt > best)) {
+            best = cnt;
+            pick = i;
+        }
+    }
+
+    return pick;
+}
+
+/* Takes a block from the free ring, the block is not erased. With a wear
+ * policy the chosen block swaps places with the head */
+static struct prov_vblk *prov_vblk_pop(int ch, int l)
 {
     int lun;
+    uint32_t idx, nblks = virt_dev.geo->nblocks;
+    struct prov_vblk *vblk, *head;
 
     lun = ch * virt_dev.geo->nluns + l;
 
     struct prov_lun *p_lun = &virt_dev.luns[lun];
 
-    if (p_lun->nfree_blks > 0) {
+    pthread_mutex_lock(&(p_lun->l_mutex));
 
-        struct prov_vblk *vblk = CIRCLEQ_FIRST(&p_lun->free_blk_head);
+    if (p_lun->nfree_blks == 0) {
+        pthread_mutex_unlock(&(p_lun->l_mutex));
+        return NULL;
+    }
 
-        pthread_mutex_lock(&(p_lun->l_mutex));
+    if (wear.policy != PROV_WEAR_FIFO) {
+        idx = (p_lun->free_head + prov_wear_pick(p_lun, lun)) % nblks;
+        head = p_lun->free_blks[p_lun->free_head];
+        p_lun->free_blks[p_lun->free_head] = p_lun->free_blks[idx];
+        p_lun->free_blks[idx] = head;
+        head->free_idx = idx;
+    }
 
-        CIRCLEQ_REMOVE(&(p_lun->free_blk_head), vblk, entry);
-        CIRCLEQ_INSERT_TAIL(&(p_lun->used_blk_head), vblk, entry);
+    vblk = p_lun->free_blks[p_lun->free_head];
+    p_lun->free_head = (p_lun->free_head + 1) % virt_dev.geo->nblocks;
+    p_lun->nfree_blks--;
 
-        p_lun->nfree_blks--;
-        p_lun->nused_blks++;
+    vblk->free_idx = UINT32_MAX;
+    vblk->used_idx = p_lun->nused_blks;
+    p_lun->used_blks[p_lun->nused_blks] = vblk;
+    p_lun->nused_blks++;
 
-        pthread_mutex_unlock(&(p_lun->l_mutex));
+    pthread_mutex_unlock(&(p_lun->l_mutex));
 
-        vblk->blk = nvm_vblk_alloc(virt_dev.dev, &vblk->addr, 1);
-        if (vblk->blk == NULL)
-            goto FAIL;
+    vblk->blk = prov_vblk_new(virt_dev.dev, &vblk->addr, 1);
+    if (vblk->blk == NULL) {
+        prov_vblk_release(p_lun, vblk);
+        return NULL;
+    }
 
-        if (prov_vblk_erase(vblk->blk) < 0) {
-            prov_bbt_mark(vblk);
-            nvm_vblk_free(vblk->blk);
-            goto FAIL;
-        }
+    return vblk;
+}
+
+/* Blocks that fail to erase are marked bad and the next free block is
+ * tried. Returns NULL if the LUN has no usable block left */
+struct nvm_vblk *prov_vblk_get(int ch, int l)
+{
+    struct prov_vblk *vblk;
 
-        return vblk->blk;
+    while ((vblk = prov_vblk_pop(ch, l))) {
+        if (prov_vblk_erase(vblk->blk) >= 0)
+            return vblk->blk;
+
+        prov_bbt_mark(vblk);
+        prov_vblk_destroy(vblk->blk);
     }
-  FAIL:
+
     return NULL;
 }
 
-int prov_vblk_put(struct nvm_vblk *vblk)
+/* As prov_vblk_get, but the caller erases the block before writing it */
+struct nvm_vblk *prov_vblk_next(int ch, int l)
 {
-    int ch, l, blk;
-    int lun;
+    struct prov_vblk *vblk;
+
+    vblk = prov_vblk_pop(ch, l);
 
-    ch = vblk->blks[0].g.ch;
-    l = vblk->blks[0].g.lun;
-    blk = vblk->blks[0].g.blk;
+    return (vblk) ? vblk->blk : NULL;
+}
+
+/* Takes a given block from the free pool without erasing it, e.g. to read
+ * data left by a previous run. The block at the head of the ring takes its
+ * place. Returns NULL if the block is not free */
+struct nvm_vblk *prov_vblk_claim(int ch, int l, int blk)
+{
+    int lun;
+    uint32_t nblks = virt_dev.geo->nblocks;
+    struct prov_vblk *vblk, *head;
 
     lun = ch * virt_dev.geo->nluns + l;
-    struct prov_lun *p_lun = &virt_dev.luns[lun];
 
-    nvm_vblk_free(vblk);
+    struct prov_lun *p_lun = &virt_dev.luns[lun];
+    vblk = &virt_dev.prov_vblks[lun][blk];
 
     pthread_mutex_lock(&(p_lun->l_mutex));
-    CIRCLEQ_REMOVE(&(p_lun->used_blk_head),
-                   &virt_dev.prov_vblks[lun][blk], entry);
-    CIRCLEQ_INSERT_TAIL(&(p_lun->free_blk_head),
-                        &virt_dev.prov_vblks[lun][blk], entry);
-    p_lun->nfree_blks++;
-    p_lun->nused_blks--;
+
+    if (vblk->free_idx >= nblks || p_lun->free_blks[vblk->free_idx] != vblk ||
+        (vblk->free_idx + nblks - p_lun->free_head) % nblks >= p_lun->nfree_blks) {
+        pthread_mutex_unlock(&(p_lun->l_mutex));
+        return NULL;
+    }
+
+    head = p_lun->free_blks[p_lun->free_head];
+    p_lun->free_blks[vblk->free_idx] = head;
+    head->free_idx = vblk->free_idx;
+    p_lun->free_head = (p_lun->free_head + 1) % nblks;
+    p_lun->nfree_blks--;
+
+    vblk->free_idx = UINT32_MAX;
+    vblk->used_idx = p_lun->nused_blks;
+    p_lun->used_blks[p_lun->nused_blks] = vblk;
+    p_lun->nused_blks++;
+
     pthread_mutex_unlock(&(p_lun->l_mutex));
 
+    vblk->blk = prov_vblk_new(virt_dev.dev, &vblk->addr, 1);
+    if (vblk->blk == NULL) {
+        prov_vblk_release(p_lun, vblk);
+        return NULL;
+    }
+
+    return vblk->blk;
+}
+
+/* Returns all blocks of 'vblk' to the free rings of their LUNs */
+int prov_vblk_put(struct nvm_vblk *vblk)
+{
+    struct nvm_addr addrs[PROV_NBLK_MAX];
+    int i, lun, nblks = vblk->nblks;
+
+    memcpy(addrs, vblk->blks, nblks * sizeof(struct nvm_addr));
+
+    prov_vblk_destroy(vblk);
+
+    for (i = 0; i < nblks; i++) {
+        lun = addrs[i].g.ch * virt_dev.geo->nluns + addrs[i].g.lun;
+        prov_vblk_release(&virt_dev.luns[lun],
+                                &virt_dev.prov_vblks[lun][addrs[i].g.blk]);
+    }
+
     return 0;
 }
 
-void prov_fblk_pr(int lun) {
-    struct prov_vblk *vblk, *tmp;
-    int blk;
-    int nblks;
-
-    nblks = virt_dev.luns[lun].nfree_blks;
-    if(nblks) {
-        vblk = CIRCLEQ_FIRST(&(virt_dev.luns[lun].free_blk_head));
-        for (blk = 0; blk < nblks; blk++) {
-            tmp = CIRCLEQ_NEXT(vblk, entry);
-            nvm_addr_pr(vblk->addr);
-            vblk = tmp;
+/* Takes the blocks of a vblk that failed a command out of use. Blocks in
+ * 'suspect' are marked bad. If there is more than one, each is erased alone
+ * first and only those that fail are marked, or all of them if none fails.
+ * The other blocks go back to the free rings. Marked blocks are copied to
+ * 'bad', returns their number */
+int prov_vblk_retire(struct nvm_vblk *vblk, uint64_t suspect,
+                                                        struct nvm_addr *bad)
+{
+    struct nvm_addr addrs[PROV_NBLK_MAX];
+    struct nvm_vblk *blk;
+    uint64_t failed = 0;
+    int i, lun, nbad = 0, nblks = vblk->nblks;
+
+    memcpy(addrs, vblk->blks, nblks * sizeof(struct nvm_addr));
+
+    prov_vblk_destroy(vblk);
+
+    if (suspect & (suspect - 1)) {
+        for (i = 0; i < nblks; i++) {
+            if (!(suspect & (1ULL << i)))
+                continue;
+
+            blk = prov_vblk_new(virt_dev.dev, &addrs[i], 1);
+            if (!blk || prov_vblk_erase(blk) < 0)
+                failed |= 1ULL << i;
+            if (blk)
+                prov_vblk_destroy(blk);
         }
+        suspect = (failed) ? failed : suspect;
+    }
+
+    for (i = 0; i < nblks; i++) {
+        lun = addrs[i].g.ch * virt_dev.geo->nluns + addrs[i].g.lun;
+        if (suspect & (1ULL << i)) {
+            prov_bbt_mark(&virt_dev.prov_vblks[lun][addrs[i].g.blk]);
+            bad[nbad++] = addrs[i];
+        } else
+            prov_vblk_release(&virt_dev.luns[lun],
+                                &virt_dev.prov_vblks[lun][addrs[i].g.blk]);
     }
+
+    return nbad;
+}
+
+/* Builds a vblk striped over the blocks of 'n' single block vblks taken
+ * with prov_vblk_get, prov_vblk_next or prov_vblk_claim. Consecutive
+ * pages go to consecutive blocks. The single block vblks are freed on
+ * success, on failure they are left to the caller */
+struct nvm_vblk *prov_vblk_join(struct nvm_vblk **blks, int n)
+{
+    struct nvm_addr addrs[PROV_NBLK_MAX];
+    struct nvm_vblk *vblk;
+    int i;
+
+    if (n == 1)
+        return blks[0];
+
+    for (i = 0; i < n; i++)
+        addrs[i] = blks[i]->blks[0];
+
+    vblk = prov_vblk_new(virt_dev.dev, addrs, n);
+    if (!vblk)
+        return NULL;
+
+    for (i = 0; i < n; i++)
+        prov_vblk_destroy(blks[i]);
+
+    return vblk;
+}
+
+void prov_fblk_pr(int lun) {
+    struct prov_lun *p_lun = &virt_dev.luns[lun];
+    uint32_t blk;
+
+    for (blk = 0; blk < p_lun->nfree_blks; blk++)
+        nvm_addr_pr(p_lun->free_blks[(p_lun->free_head + blk) %
+                                            virt_dev.geo->nblocks]->addr);
 }
 
 void prov_ublk_pr(int lun) {
-    struct prov_vblk *vblk, *tmp;
-    int blk;
-    int nblks;
-
-    nblks = virt_dev.luns[lun].nused_blks;
-    if(nblks) {
-        vblk = CIRCLEQ_FIRST(&(virt_dev.luns[lun].used_blk_head));
-        for (blk = 0; blk < nblks; blk++) {
-            tmp = CIRCLEQ_NEXT(vblk, entry);
-            nvm_addr_pr(vblk->addr);
-            vblk = tmp;
-        }
-    }
+    struct prov_lun *p_lun = &virt_dev.luns[lun];
+    uint32_t blk;
+
+    for (blk = 0; blk < p_lun->nused_blks; blk++)
+        nvm_addr_pr(p_lun->used_blks[blk]->addr);
 }
 
 void prov_dev_pr()
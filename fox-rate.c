@@ -0,0 +1,197 @@
+/*  - FOX - A tool for testing Open-Channel SSDs
+ *      - I/O rate pacing
+ *
+ * Copyright (C) 2016, IT University of Copenhagen. All rights reserved.
+ * Written by Ivan Luiz Picoli <ivpi@itu.dk>
+ *
+ * Funding support provided by CAPES Foundation, Ministry of Education
+ * of Brazil, Brasilia - DF 70040-020, Brazil.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Token bucket pacing for --rate-iops and --rate-bw. Each bucket keeps the
+ * time at which the next command may be issued (GCRA), so a reservation is
+ * a single compare-and-swap and buckets can be shared by all jobs. Idle
+ * time is credited up to FOX_RATE_BURST, then the bucket is full. Waits
+ * sleep until FOX_RATE_SPIN before the deadline and spin on the monotonic
+ * clock for the rest.
+ *
+ * With --arrival the workload is open-loop: each node follows a schedule of
+ * intended issue times (constant or Poisson at --rate-iops) that does not
+ * depend on completions. Latency is measured from the intended time, so a
+ * slow device is not hidden by a slower issue rate. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "fox.h"
+
+#define FOX_RATE_BURST  (1000000 & AND64)   /* n-sec of credit, 1 ms */
+#define FOX_RATE_SPIN   (50000 & AND64)     /* n-sec */
+
+int fox_rate_init (struct fox_workload *wl)
+{
+    int i, nrates;
+
+    wl->rate = NULL;
+    if ((!wl->rate_iops && !wl->rate_bw) || wl->arrival)
+        return 0;
+
+    nrates = (wl->rate_job) ? wl->nthreads : 1;
+
+    wl->rate = aligned_alloc (FOX_CACHE_LINE,
+                                        sizeof (struct fox_rate) * nrates);
+    if (!wl->rate)
+        return -1;
+    memset (wl->rate, 0, sizeof (struct fox_rate) * nrates);
+
+    for (i = 0; i < nrates; i++) {
+        wl->rate[i].iops = wl->rate_iops;
+        wl->rate[i].bw = wl->rate_bw;
+    }
+
+    return 0;
+}
+
+void fox_rate_exit (struct fox_workload *wl)
+{
+    free (wl->rate);
+    wl->rate = NULL;
+}
+
+/* Reserves 'cost' units in a bucket of 'rate' units per second. Returns the
+ * time the command is allowed to start. */
+static uint64_t fox_rate_reserve (uint64_t *tat, uint64_t rate, uint64_t cost,
+                                                                uint64_t now)
+{
+    uint64_t start, next, cur, interval;
+
+    interval = cost * NSEC64 / rate;
+
+    cur = __atomic_load_n (tat, __ATOMIC_RELAXED);
+    do {
+        start = (cur + FOX_RATE_BURST > now) ? cur : now - FOX_RATE_BURST;
+        next = start + interval;
+    } while (!__atomic_compare_exchange_n (tat, &cur, next, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return start;
+}
+
+void fox_rate_wait (uint64_t until)
+{
+    struct timespec ts;
+    uint64_t now = fox_timestamp_now ();
+
+    while (now < until) {
+        if (until - now > FOX_RATE_SPIN) {
+            ts.tv_sec = (until - now - FOX_RATE_SPIN) / NSEC64;
+            ts.tv_nsec = (until - now - FOX_RATE_SPIN) % NSEC64;
+            nanosleep (&ts, NULL);
+        } else {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause ();
+#endif
+        }
+        now = fox_timestamp_now ();
+    }
+}
+
+/* Returns the time a command of 'bytes' may be issued by the node */
+uint64_t fox_rate_next (struct fox_node *node, size_t bytes)
+{
+    struct fox_rate *r = node->rate;
+    uint64_t now, start = 0, t;
+
+    now = fox_timestamp_now ();
+
+    if (r->iops)
+        start = fox_rate_reserve (&r->iops_tat, r->iops, 1, now);
+
+    if (r->bw) {
+        t = fox_rate_reserve (&r->bw_tat, r->bw, bytes, now);
+        start = (t > start) ? t : start;
+    }
+
+    return start;
+}
+
+/* Blocks the node until a command of 'bytes' is allowed */
+void fox_rate_pace (struct fox_node *node, size_t bytes)
+{
+    if (!node->rate)
+        return;
+
+    fox_rate_wait (fox_rate_next (node, bytes));
+}
+
+/* Time between two arrivals. Poisson arrivals have exponential gaps */
+static uint64_t fox_arrival_gap (struct fox_node *node)
+{
+    struct fox_arrival *arr = &node->arrival;
+    double u;
+
+    if (node->wl->arrival != FOX_ARRIVAL_POISSON)
+        return arr->interval;
+
+    /* uniform in (0,1] */
+    u = ((fox_prng_next (&node->prng) >> 11) + 1) *
+                                                (1.0 / 9007199254740992.0);
+
+    return (uint64_t) (-log (u) * arr->interval);
+}
+
+/* Called when the node starts. A global rate is split among the nodes and
+ * the first arrivals are staggered to avoid a burst at start. */
+void fox_arrival_init (struct fox_node *node)
+{
+    struct fox_workload *wl = node->wl;
+    struct fox_arrival *arr = &node->arrival;
+    uint64_t now;
+
+    if (!wl->arrival)
+        return;
+
+    arr->interval = (wl->rate_job) ? NSEC64 / wl->rate_iops :
+                                      NSEC64 * wl->nthreads / wl->rate_iops;
+    if (!arr->interval)
+        arr->interval = 1;
+
+    now = fox_timestamp_now ();
+    arr->next = now + arr->interval * node->nid / wl->nthreads;
+}
+
+/* Blocks the node until the next arrival if it is ahead, then moves the
+ * schedule. Returns the intended issue time. */
+uint64_t fox_arrival_wait (struct fox_node *node)
+{
+    struct fox_arrival *arr = &node->arrival;
+    uint64_t tsched = arr->next;
+
+    fox_rate_wait (tsched);
+    arr->next += fox_arrival_gap (node);
+
+    return tsched;
+}
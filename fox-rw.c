@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <sys/time.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "fox.h"
 
 double fox_check_progress_pgs (struct fox_node *node)
@@ -45,9 +46,10 @@ double fox_check_progress_pgs (struct fox_node *node)
 
 double fox_check_progress_runtime (struct fox_node *node)
 {
-    fox_timestamp_end(FOX_STATS_RUNTIME, &node->stats);
+    fox_timestamp_end(&node->stats);
 
-    return (100 / (double) (node->wl->runtime)) * (node->stats.runtime / SEC64);
+    return (100 / (double) (node->wl->runtime)) *
+                                        (node->stats.runtime / NSEC64);
 }
 
 int fox_update_runtime (struct fox_node *node)
@@ -66,15 +68,820 @@ int fox_update_runtime (struct fox_node *node)
     return 0;
 }
 
+/* Each slot owns a buffer of one command. Payloads are generated at submit
+ * time and rebuilt for comparison, memory does not depend on the geometry */
+int fox_ioq_init (struct fox_node *node)
+{
+    struct fox_ioq *q;
+    size_t cmd_sz = node->wl->nppas * node->wl->geo->sector_nbytes;
+    int i;
+
+    q = calloc (1, sizeof (struct fox_ioq));
+    if (!q)
+        return -1;
+
+    q->depth = node->wl->iodepth;
+    q->ios = calloc (q->depth, sizeof (struct fox_io));
+    if (!q->ios)
+        goto FREE_Q;
+
+    for (i = 0; i < q->depth; i++) {
+        q->ios[i].buf = aligned_alloc (node->wl->geo->sector_nbytes, cmd_sz);
+        if (!q->ios[i].buf)
+            goto FREE_BUF;
+    }
+
+    if (node->wl->memcmp) {
+        q->exp = aligned_alloc (node->wl->geo->sector_nbytes, cmd_sz);
+        if (!q->exp)
+            goto FREE_BUF;
+    }
+
+    /* Second set of buffers for reads being verified */
+    if (node->wl->verify) {
+        q->vjobs = calloc (q->depth, sizeof (struct fox_vjob));
+        if (!q->vjobs)
+            goto FREE_BUF;
+
+        for (i = 0; i < q->depth; i++) {
+            q->vjobs[i].buf = aligned_alloc (node->wl->geo->sector_nbytes,
+                                                                    cmd_sz);
+            if (!q->vjobs[i].buf)
+                goto FREE_VJOB;
+        }
+    }
+
+    /* Erase slots carry no buffer and are not part of the I/O depth. The
+     * distribution is not known yet, block states are sized for all LUNs */
+    if (node->wl->erase_depth) {
+        q->edepth = node->wl->erase_depth;
+        q->eios = calloc (q->edepth, sizeof (struct fox_io));
+        q->eblk = calloc (node->wl->blks * node->wl->luns *
+                                        node->wl->channels, sizeof (uint8_t));
+        if (!q->eios || !q->eblk)
+            goto FREE_ERASE;
+    } else {
+        q->evblks = calloc (node->wl->blks * node->wl->luns *
+                            node->wl->channels, sizeof (struct nvm_vblk *));
+        q->eerr = calloc (node->wl->blks * node->wl->luns *
+                                        node->wl->channels, sizeof (int));
+        q->ens = calloc (node->wl->blks * node->wl->luns *
+                                    node->wl->channels, sizeof (uint64_t));
+        if (!q->evblks || !q->eerr || !q->ens)
+            goto FREE_ERASE;
+    }
+
+    q->bhist = calloc (node->wl->blks * node->wl->luns * node->wl->channels,
+                                                sizeof (struct fox_blk_hist));
+    if (!q->bhist)
+        goto FREE_ERASE;
+
+    TAILQ_INIT (&q->free_head);
+    TAILQ_INIT (&q->cmpl_head);
+    TAILQ_INIT (&q->vfree_head);
+    TAILQ_INIT (&q->vdone_head);
+    TAILQ_INIT (&q->efree_head);
+    TAILQ_INIT (&q->retired_head);
+    pthread_mutex_init (&q->q_mutex, NULL);
+    pthread_cond_init (&q->q_cond, NULL);
+
+    for (i = 0; i < q->depth; i++)
+        TAILQ_INSERT_TAIL (&q->free_head, &q->ios[i], entry);
+
+    for (i = 0; q->vjobs && i < q->depth; i++) {
+        q->vjobs[i].node = node;
+        TAILQ_INSERT_TAIL (&q->vfree_head, &q->vjobs[i], entry);
+    }
+
+    for (i = 0; i < q->edepth; i++)
+        TAILQ_INSERT_TAIL (&q->efree_head, &q->eios[i], entry);
+
+    node->ioq = q;
+
+    return 0;
+
+FREE_ERASE:
+    free (q->eios);
+    free (q->eblk);
+    free (q->evblks);
+    free (q->eerr);
+    free (q->ens);
+    free (q->bhist);
+FREE_VJOB:
+    for (i = 0; q->vjobs && i < q->depth; i++)
+        free (q->vjobs[i].buf);
+    free (q->vjobs);
+FREE_BUF:
+    for (i = 0; i < q->depth; i++)
+        free (q->ios[i].buf);
+    free (q->ios);
+FREE_Q:
+    free (q);
+    return -1;
+}
+
+void fox_ioq_exit (struct fox_node *node)
+{
+    struct fox_retired *rb;
+    int i;
+
+    while (!TAILQ_EMPTY (&node->ioq->retired_head)) {
+        rb = TAILQ_FIRST (&node->ioq->retired_head);
+        TAILQ_REMOVE (&node->ioq->retired_head, rb, entry);
+        free (rb);
+    }
+
+    pthread_mutex_destroy (&node->ioq->q_mutex);
+    pthread_cond_destroy (&node->ioq->q_cond);
+    for (i = 0; i < node->ioq->depth; i++) {
+        free (node->ioq->ios[i].buf);
+        if (node->ioq->vjobs)
+            free (node->ioq->vjobs[i].buf);
+    }
+    free (node->ioq->vjobs);
+    free (node->ioq->eios);
+    free (node->ioq->eblk);
+    free (node->ioq->evblks);
+    free (node->ioq->eerr);
+    free (node->ioq->ens);
+    free (node->ioq->bhist);
+    free (node->ioq->exp);
+    free (node->ioq->ios);
+    free (node->ioq);
+}
+
+/* Index of a block in the node write order, as in fox_erase_all_vblks */
+static uint32_t fox_node_blk (struct fox_node *node, uint16_t ch, uint16_t lun,
+                                                                  uint32_t blk)
+{
+    uint16_t ch_i = 0, lun_i = 0;
+
+    while (ch_i < node->nchs - 1 && node->ch[ch_i] != ch)
+        ch_i++;
+    while (lun_i < node->nluns - 1 && node->lun[lun_i] != lun)
+        lun_i++;
+
+    return (ch_i * node->nluns + lun_i) * node->nblks + blk;
+}
+
+static void fox_node_tgt (struct fox_node *node, uint32_t blk_i,
+                                                    struct fox_tgt_blk *tgt)
+{
+    uint16_t ch_i, lun_i, blk_ch;
+
+    blk_ch = node->nblks * node->nluns;
+    ch_i = blk_i / blk_ch;
+    lun_i = (blk_i % blk_ch) / node->nblks;
+
+    tgt->ch = node->ch[ch_i];
+    tgt->lun = node->lun[lun_i];
+    tgt->blk = blk_i % node->nblks;
+    tgt->vblk = node->wl->vblks[fox_vblk_get_pblk (node->wl, tgt->ch,
+                                                        tgt->lun, tgt->blk)];
+}
+
+static struct fox_blk_hist *fox_node_hist (struct fox_node *node,
+                                                    struct fox_tgt_blk *tgt)
+{
+    return &node->ioq->bhist[fox_node_blk (node, tgt->ch, tgt->lun,
+                                                                tgt->blk)];
+}
+
+static void fox_lat_add (struct fox_lat *lat, uint64_t t)
+{
+    lat->n++;
+    lat->t += t;
+    if (t > lat->max)
+        lat->max = t;
+}
+
+/* A failed write or erase flags the block of the slot, fox_bad_remap
+ * retires it once no command targets it. Later failures of the same block
+ * are only counted */
+static void fox_bad_flag (struct fox_node *node, struct fox_tgt_blk *tgt,
+                    char cause, uint64_t tstart, uint64_t tend, uint32_t pg,
+                    uint32_t npgs)
+{
+    struct fox_blk_hist *h = fox_node_hist (node, tgt);
+
+    if (h->bad)
+        return;
+
+    h->bad = cause;
+    h->fail_pg = pg;
+    h->fail_npgs = npgs;
+    h->fail_t = tend - tstart;
+    h->tfail = tend - node->stats.tstart;
+    node->ioq->nbad++;
+}
+
+/* Accounts the time the node had at least one command in flight */
+static void fox_io_busy (struct fox_node *node, struct fox_io *io)
+{
+    struct fox_ioq *q = node->ioq;
+    uint64_t start;
+
+    start = (io->tstart > q->busy_end) ? io->tstart : q->busy_end;
+    if (io->tend > start)
+        fox_set_stats (FOX_STATS_RW_SECT, &node->stats, io->tend - start);
+    if (io->tend > q->busy_end)
+        q->busy_end = io->tend;
+}
+
+static void fox_io_row (struct fox_io *io, struct fox_output_row *row,
+                                          char type, uint8_t failed, int cmp)
+{
+    row->ch = io->tgt.ch;
+    row->lun = io->tgt.lun;
+    row->blk = io->tgt.blk;
+    row->pg = io->pg;
+    row->tstart = io->tsched;
+    row->tend = io->tend;
+    row->ulat = (io->tend - io->tsched > UINT32_MAX) ?
+                                    UINT32_MAX : io->tend - io->tsched;
+    row->qdelay = (io->tstart - io->tsched > UINT32_MAX) ?
+                                    UINT32_MAX : io->tstart - io->tsched;
+    row->type = type;
+    row->failed = failed;
+    row->datacmp = cmp;
+    row->size = io->pio.count;
+}
+
+static void fox_io_output (struct fox_node *node, struct fox_io *io,
+                                          char type, uint8_t failed, int cmp)
+{
+    struct fox_output_row row;
+
+    fox_io_row (io, &row, type, failed, cmp);
+    fox_output_append(&row, node->nid);
+}
+
+static void fox_write_complete (struct fox_node *node, struct fox_io *io)
+{
+    uint8_t failed = 0;
+
+    if (io->pio.ret != io->pio.count) {
+        fox_set_stats (FOX_STATS_FAIL_W, &node->stats, io->npgs);
+        fox_bad_flag (node, &io->tgt, 'w', io->tsched, io->tend, io->pg,
+                                                                    io->npgs);
+        failed++;
+        goto FAILED;
+    }
+
+    fox_lat_add (&fox_node_hist (node, &io->tgt)->w, io->tend - io->tsched);
+    fox_set_stats(FOX_STATS_WRITE_T, &node->stats, io->tend - io->tsched);
+    fox_io_busy (node, io);
+    fox_set_stats(FOX_STATS_BWRITTEN, &node->stats, io->pio.count);
+    fox_set_stats(FOX_STATS_IOPS, &node->stats, 1);
+
+FAILED:
+    fox_set_stats (FOX_STATS_PGS_W, &node->stats, io->npgs);
+    node->stats.pgs_done += io->npgs;
+
+    if (node->wl->output)
+        fox_io_output (node, io, 'w', failed, 2);
+}
+
+/* Creates a file under /corruption containing the read binary and the
+ * expected data, left in ioq->exp by the comparison. 'off' is the first
+ * differing byte */
+static void fox_read_corruption (struct fox_node *node, struct fox_io *io,
+                                                                  size_t off)
+{
+    char filename[64];
+    uint32_t pblk = fox_vblk_get_pblk (node->wl, io->tgt.ch, io->tgt.lun,
+                                                                  io->tgt.blk);
+
+    snprintf (filename, sizeof (filename), "c%dl%db%dp%d-seq%d", io->tgt.ch,
+                                        io->tgt.lun, pblk, io->pg, io->npgs);
+
+    fox_flush_corruption (filename, node->ioq->exp, io->buf, io->pio.count,
+                                                                        off);
+}
+
+/* Result of a job from the verifier pool, called by the node */
+static void fox_vjob_done (struct fox_node *node, struct fox_vjob *job)
+{
+    if (job->cmp)
+        fox_set_stats(FOX_STATS_FAIL_CMP, &node->stats, 1);
+
+    if (node->wl->output) {
+        job->row.datacmp = job->cmp;
+        fox_output_append(&job->row, node->nid);
+    }
+
+    node->ioq->verifying--;
+    TAILQ_INSERT_TAIL (&node->ioq->vfree_head, job, entry);
+}
+
+static void fox_vjob_reap (struct fox_node *node, struct vjob_done_list *done)
+{
+    struct fox_vjob *job;
+
+    while (!TAILQ_EMPTY (done)) {
+        job = TAILQ_FIRST (done);
+        TAILQ_REMOVE (done, job, entry);
+        fox_vjob_done (node, job);
+    }
+}
+
+/* Hands the read data to the verifier pool. The slot keeps the buffer of a
+ * free job, if all jobs are being verified, waits for one */
+static void fox_read_verify (struct fox_node *node, struct fox_io *io,
+                                                        struct nvm_addr ppa)
+{
+    struct fox_ioq *q = node->ioq;
+    struct fox_vjob *job;
+    struct vjob_done_list done;
+    uint8_t *buf;
+
+    while (TAILQ_EMPTY (&q->vfree_head)) {
+        TAILQ_INIT (&done);
+        pthread_mutex_lock (&q->q_mutex);
+        while (TAILQ_EMPTY (&q->vdone_head))
+            pthread_cond_wait (&q->q_cond, &q->q_mutex);
+        TAILQ_CONCAT (&done, &q->vdone_head, entry);
+        pthread_mutex_unlock (&q->q_mutex);
+        fox_vjob_reap (node, &done);
+    }
+
+    job = TAILQ_FIRST (&q->vfree_head);
+    TAILQ_REMOVE (&q->vfree_head, job, entry);
+
+    buf = job->buf;
+    job->buf = io->buf;
+    io->buf = buf;
+
+    job->count = io->pio.count;
+    job->ppa = ppa;
+    job->iter = node->iter;
+    job->npgs = io->npgs;
+    job->pblk = fox_vblk_get_pblk (node->wl, io->tgt.ch, io->tgt.lun,
+                                                                io->tgt.blk);
+    fox_io_row (io, &job->row, 'r', 0, 0);
+
+    q->verifying++;
+    fox_verify_submit (node->wl->verify, job);
+}
+
+static void fox_read_complete (struct fox_node *node, struct fox_io *io)
+{
+    uint8_t failed = 0;
+    int cmp = 0;
+    size_t off = 0;
+    struct nvm_addr ppa;
+
+    /* Page address for possible memory comparison */
+    ppa.ppa = io->tgt.vblk->blks[0].ppa;
+    ppa.g.pg = io->pg;
+
+    if (io->pio.ret != io->pio.count) {
+        fox_set_stats (FOX_STATS_FAIL_R, &node->stats, io->npgs);
+        failed++;
+        goto FAILED;
+    }
+
+    fox_lat_add (&fox_node_hist (node, &io->tgt)->r, io->tend - io->tsched);
+    fox_set_stats(FOX_STATS_READ_T, &node->stats, io->tend - io->tsched);
+    fox_io_busy (node, io);
+
+    fox_set_stats (FOX_STATS_BREAD, &node->stats, io->pio.count);
+    fox_set_stats(FOX_STATS_IOPS, &node->stats, 1);
+
+    if (node->wl->verify) {
+        fox_set_stats (FOX_STATS_PGS_R, &node->stats, io->npgs);
+        fox_read_verify (node, io, ppa);
+        goto DONE;
+    }
+
+    cmp = (node->wl->memcmp) ? fox_wb_cmp (node->wl, node->iter, io->buf,
+                                node->ioq->exp, io->pio.count, ppa, &off) : 2;
+
+FAILED:
+    fox_set_stats (FOX_STATS_PGS_R, &node->stats, io->npgs);
+
+    if (node->wl->output)
+        fox_io_output (node, io, 'r', failed, cmp);
+
+    if (node->wl->memcmp && cmp) {
+        fox_set_stats(FOX_STATS_FAIL_CMP, &node->stats, 1);
+        fox_read_corruption (node, io, off);
+    }
+
+DONE:
+    if (node->wl->w_factor == 0  || node->wl->engine->id == FOX_ENGINE_3)
+        node->stats.pgs_done += io->npgs;
+}
+
+static void fox_erase_complete (struct fox_node *node, struct fox_io *io)
+{
+    struct fox_ioq *q = node->ioq;
+    struct fox_blk_hist *h = fox_node_hist (node, &io->tgt);
+
+    if (io->pio.ret < 0) {
+        fox_set_stats (FOX_STATS_FAIL_E, &node->stats, 1);
+        fox_bad_flag (node, &io->tgt, 'e', io->tstart, io->tend, 0, 0);
+    } else {
+        prov_vblk_wear_add (io->pio.vblk, io->tend - io->tstart);
+        fox_lat_add (&h->e, io->tend - io->tstart);
+    }
+    h->wp = 0;
+
+    fox_set_stats (FOX_STATS_ERASE_T, &node->stats, io->tend - io->tstart);
+    fox_set_stats (FOX_STATS_ERASED_BLK, &node->stats, 1);
+
+    q->eblk[fox_node_blk (node, io->tgt.ch, io->tgt.lun, io->tgt.blk)] = 0;
+    q->erasing--;
+    TAILQ_INSERT_TAIL (&q->efree_head, io, entry);
+}
+
+static void fox_io_complete (struct fox_node *node, struct fox_io *io)
+{
+    if (io->pio.type == FOX_ERASE) {
+        fox_erase_complete (node, io);
+        return;
+    }
+
+    if (io->pio.type == FOX_WRITE)
+        fox_write_complete (node, io);
+    else
+        fox_read_complete (node, io);
+
+    /* Interference of background erases is accounted apart */
+    if ((io->erasing || node->ioq->erasing) && io->pio.ret == io->pio.count)
+        fox_set_stats (FOX_STATS_ERASE_IO, &node->stats,
+                                                    io->tend - io->tsched);
+
+    node->ioq->inflight--;
+    TAILQ_INSERT_TAIL (&node->ioq->free_head, io, entry);
+}
+
+/* Called by the backend when an asynchronous command completes */
+static void fox_io_done (struct prov_io *pio)
+{
+    struct fox_io *io = (struct fox_io *) pio;
+    struct fox_ioq *q = ((struct fox_node *) pio->ctx)->ioq;
+
+    io->tend = fox_timestamp_now ();
+
+    pthread_mutex_lock (&q->q_mutex);
+    TAILQ_INSERT_TAIL (&q->cmpl_head, io, entry);
+    pthread_cond_signal (&q->q_cond);
+    pthread_mutex_unlock (&q->q_mutex);
+}
+
+/* Erases are submitted to the LUN service threads, with iodepth 1 the jobs
+ * keep issuing reads and writes to other blocks meanwhile */
+static void fox_erase_issue (struct fox_node *node, uint32_t blk_i)
+{
+    struct fox_ioq *q = node->ioq;
+    struct fox_io *io;
+
+    io = TAILQ_FIRST (&q->efree_head);
+    TAILQ_REMOVE (&q->efree_head, io, entry);
+
+    fox_node_tgt (node, blk_i, &io->tgt);
+
+    io->pio.type = FOX_ERASE;
+    io->pio.vblk = io->tgt.vblk;
+    io->pio.buf = NULL;
+    io->pio.count = 0;
+    io->pio.offset = 0;
+    io->pio.done = fox_io_done;
+    io->pio.ctx = node;
+
+    q->eblk[blk_i] = FOX_EBLK_ERASING;
+    q->erasing++;
+
+    io->tstart = io->tsched = fox_timestamp_now ();
+
+    if (prov_io_submit (&io->pio)) {
+        io->pio.ret = -1;
+        fox_io_done (&io->pio);
+    }
+}
+
+/* Keeps up to 'edepth' erases in flight, next dirty blocks first */
+static void fox_erase_ahead (struct fox_node *node)
+{
+    struct fox_ioq *q = node->ioq;
+
+    while (q->ndirty && !TAILQ_EMPTY (&q->efree_head)) {
+        while (q->eblk[q->enext] != FOX_EBLK_DIRTY)
+            q->enext = (q->enext + 1) % q->eblks;
+
+        q->ndirty--;
+        fox_erase_issue (node, q->enext);
+    }
+}
+
+/* Completes all finished commands, if 'wait' is set, blocks until at least
+ * one command is completed */
+static void fox_ioq_reap (struct fox_node *node, uint8_t wait)
+{
+    struct fox_ioq *q = node->ioq;
+    struct fox_io *io;
+    struct io_cmpl_list cmpl;
+    struct vjob_done_list done;
+
+    TAILQ_INIT (&cmpl);
+    TAILQ_INIT (&done);
+
+    pthread_mutex_lock (&q->q_mutex);
+
+    while (wait && TAILQ_EMPTY (&q->cmpl_head) &&
+                                            TAILQ_EMPTY (&q->vdone_head))
+        pthread_cond_wait (&q->q_cond, &q->q_mutex);
+
+    TAILQ_CONCAT (&cmpl, &q->cmpl_head, entry);
+    TAILQ_CONCAT (&done, &q->vdone_head, entry);
+
+    pthread_mutex_unlock (&q->q_mutex);
+
+    fox_vjob_reap (node, &done);
+
+    while (!TAILQ_EMPTY (&cmpl)) {
+        io = TAILQ_FIRST (&cmpl);
+        TAILQ_REMOVE (&cmpl, io, entry);
+        fox_io_complete (node, io);
+    }
+
+    if (q->ndirty)
+        fox_erase_ahead (node);
+}
+
+/* Waits for the commands in flight, 'verify' also waits for the reads
+ * being verified and for background erases */
+static void fox_ioq_wait (struct fox_node *node, uint8_t verify)
+{
+    while (node->ioq->inflight || (verify && (node->ioq->verifying ||
+                                                      node->ioq->erasing)))
+        fox_ioq_reap (node, 1);
+}
+
+/* A block is not read or written before its background erase completes. If
+ * the jobs reach a block still dirty, its erase is issued first */
+static void fox_erase_wait (struct fox_node *node, struct fox_tgt_blk *tgt)
+{
+    struct fox_ioq *q = node->ioq;
+    uint32_t blk_i = fox_node_blk (node, tgt->ch, tgt->lun, tgt->blk);
+
+    while (q->eblk[blk_i]) {
+        if (q->eblk[blk_i] == FOX_EBLK_DIRTY &&
+                                        !TAILQ_EMPTY (&q->efree_head)) {
+            q->ndirty--;
+            fox_erase_issue (node, blk_i);
+            continue;
+        }
+        fox_ioq_reap (node, 1);
+    }
+}
+
+/* Writes again the first 'npgs' pages of a slot on its new block, with the
+ * payload of the current pass. Called with no command in flight, the
+ * buffer of a free slot is used */
+static int fox_bad_rewrite (struct fox_node *node, struct nvm_vblk *vblk,
+                                                                uint32_t npgs)
+{
+    struct fox_workload *wl = node->wl;
+    size_t vpg_sz = wl->geo->page_nbytes * wl->geo->nplanes;
+    uint8_t *buf = TAILQ_FIRST (&node->ioq->free_head)->buf;
+    struct nvm_addr ppa;
+    uint32_t i, n, cmd_pgs;
+
+    cmd_pgs = wl->nppas / (wl->geo->nsectors * wl->geo->nplanes);
+    ppa.ppa = vblk->blks[0].ppa;
+
+    for (i = 0; i < npgs; i += n) {
+        n = (i + cmd_pgs > npgs) ? npgs - i : cmd_pgs;
+        ppa.g.pg = i;
+        fox_wb_fill (wl, node->iter, buf, vpg_sz * n, ppa);
+
+        if (prov_vblk_pwrite (vblk, buf, vpg_sz * n, vpg_sz * i) !=
+                                                                vpg_sz * n)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Marks the failed blocks of 'vblk' as bad, or only logs its first block
+ * if 'keep' is set. 'h' is the history of the slot with the block */
+static void fox_bad_log (struct fox_node *node, struct fox_tgt_blk *tgt,
+                struct nvm_vblk *vblk, uint64_t suspect, uint8_t keep,
+                struct fox_blk_hist *h)
+{
+    struct nvm_addr bad[PROV_NBLK_MAX], addrs[PROV_NBLK_MAX];
+    struct prov_wear w[PROV_NBLK_MAX];
+    struct fox_retired *rb;
+    int i, j, nbad = 1, nblks = vblk->nblks;
+
+    /* Erase counts are the ones before the blocks are marked */
+    for (i = 0; i < nblks; i++) {
+        addrs[i] = vblk->blks[i];
+        prov_vblk_wear (addrs[i].g.ch, addrs[i].g.lun, addrs[i].g.blk, &w[i]);
+    }
+
+    if (keep)
+        bad[0] = vblk->blks[0];
+    else
+        nbad = prov_vblk_retire (vblk, suspect, bad);
+
+    for (i = 0; i < nbad; i++) {
+        rb = calloc (1, sizeof (struct fox_retired));
+        if (!rb) {
+            printf (" [fox: ERROR. Not possible to record %d retired "
+                                            "block(s).]\n", nbad - i);
+            node->ioq->nlost += nbad - i;
+            return;
+        }
+
+        for (j = 0; j < nblks - 1 && bad[i].ppa != addrs[j].ppa; j++);
+
+        rb->addr = bad[i];
+        rb->ch = tgt->ch;
+        rb->lun = tgt->lun;
+        rb->blk = tgt->blk;
+        rb->spare = !keep;
+        rb->erases = w[j].erases;
+        rb->run = w[j].run;
+        rb->last_us = w[j].last_us;
+        rb->hist = *h;
+        TAILQ_INSERT_TAIL (&node->ioq->retired_head, rb, entry);
+    }
+}
+
+/* Members of a striped block written by the failed command, all of them
+ * for erases */
+static uint64_t fox_bad_suspect (struct fox_blk_hist *h, int nblks)
+{
+    uint64_t mask = 0;
+    uint32_t pg;
+
+    if (h->bad == 'e' || h->fail_npgs >= nblks)
+        return (nblks == 64) ? UINT64_MAX : (1ULL << nblks) - 1;
+
+    for (pg = h->fail_pg; pg < h->fail_pg + h->fail_npgs; pg++)
+        mask |= 1ULL << (pg % nblks);
+
+    return mask;
+}
+
+/* Retires the blocks flagged by failed commands. Each slot gets a spare
+ * from the free pool of its LUNs, erased, and the pages already written in
+ * the pass are written again, so reads still verify. A spare that fails is
+ * retired as well. If the pool runs out, the slot keeps its block */
+static void fox_bad_remap (struct fox_node *node)
+{
+    struct fox_ioq *q = node->ioq;
+    struct fox_workload *wl = node->wl;
+    struct fox_blk_hist *h, empty;
+    struct fox_tgt_blk tgt;
+    struct nvm_vblk *vblk;
+    uint32_t blk_i, t_blks, wp;
+    uint64_t tstart;
+
+    fox_ioq_wait (node, 0);
+
+    t_blks = node->nblks * node->nluns * node->nchs;
+    for (blk_i = 0; q->nbad && blk_i < t_blks; blk_i++) {
+        h = &q->bhist[blk_i];
+        if (!h->bad || h->bad == FOX_BAD_KEPT)
+            continue;
+
+        /* A new block does not need its background erase */
+        while (q->eblk && q->eblk[blk_i] == FOX_EBLK_ERASING)
+            fox_ioq_reap (node, 1);
+        if (q->eblk && q->eblk[blk_i] == FOX_EBLK_DIRTY) {
+            q->eblk[blk_i] = 0;
+            q->ndirty--;
+        }
+
+        fox_node_tgt (node, blk_i, &tgt);
+
+        while (1) {
+            tstart = fox_timestamp_now ();
+            vblk = fox_vblk_stripe (wl, tgt.ch, tgt.lun, 1, NULL);
+            if (!vblk)
+                break;
+
+            fox_set_stats (FOX_STATS_ERASE_T, &node->stats,
+                                            fox_timestamp_now () - tstart);
+            fox_set_stats (FOX_STATS_ERASED_BLK, &node->stats, 1);
+
+            if (!fox_bad_rewrite (node, vblk, h->wp))
+                break;
+
+            fox_set_stats (FOX_STATS_FAIL_W, &node->stats, 1);
+            memset (&empty, 0, sizeof (struct fox_blk_hist));
+            empty.bad = 'w';
+            empty.fail_npgs = h->wp;
+            empty.tfail = fox_timestamp_now () - node->stats.tstart;
+            fox_bad_log (node, &tgt, vblk, fox_bad_suspect (&empty,
+                                                    vblk->nblks), 0, &empty);
+        }
+
+        fox_bad_log (node, &tgt, tgt.vblk, fox_bad_suspect (h,
+                                            tgt.vblk->nblks), !vblk, h);
+
+        if (vblk) {
+            wl->vblks[fox_vblk_get_pblk (wl, tgt.ch, tgt.lun, tgt.blk)] =
+                                                                        vblk;
+            q->nremap++;
+            wp = h->wp;
+            memset (h, 0, sizeof (struct fox_blk_hist));
+            h->wp = wp;
+        } else
+            h->bad = FOX_BAD_KEPT;
+
+        q->nbad--;
+    }
+}
+
+void fox_ioq_drain (struct fox_node *node)
+{
+    fox_ioq_wait (node, 1);
+
+    if (node->ioq->nbad)
+        fox_bad_remap (node);
+}
+
+static struct fox_io *fox_ioq_get (struct fox_node *node,
+                                                    struct fox_tgt_blk *tgt)
+{
+    struct fox_ioq *q = node->ioq;
+    struct fox_io *io;
+
+    if (q->depth > 1 || q->erasing)
+        fox_ioq_reap (node, 0);
+
+    if (q->nbad)
+        fox_bad_remap (node);
+
+    /* The target may carry the block retired by a remap */
+    if (q->nremap)
+        tgt->vblk = node->wl->vblks[fox_vblk_get_pblk (node->wl, tgt->ch,
+                                                        tgt->lun, tgt->blk)];
+
+    if (q->ndirty || q->erasing)
+        fox_erase_wait (node, tgt);
+
+    while (TAILQ_EMPTY (&q->free_head))
+        fox_ioq_reap (node, 1);
+
+    io = TAILQ_FIRST (&q->free_head);
+    TAILQ_REMOVE (&q->free_head, io, entry);
+
+    io->tgt = *tgt;
+    io->pio.vblk = tgt->vblk;
+    io->pio.done = fox_io_done;
+    io->pio.ctx = node;
+
+    return io;
+}
+
+/* With iodepth 1 the command is executed and completed synchronously.
+ * Latency is measured from tsched, in open-loop mode it is the intended
+ * issue time and the queue delay is accounted apart. */
+static void fox_ioq_submit (struct fox_node *node, struct fox_io *io)
+{
+    if (node->wl->arrival) {
+        io->tsched = fox_arrival_wait (node);
+        io->tstart = fox_timestamp_now ();
+        fox_set_stats (FOX_STATS_QUEUE_T, &node->stats,
+                                                io->tstart - io->tsched);
+    } else {
+        fox_rate_pace (node, io->pio.count);
+        io->tstart = io->tsched = fox_timestamp_now ();
+    }
+
+    node->ioq->inflight++;
+    io->erasing = (node->ioq->erasing > 0);
+
+    if (node->ioq->depth == 1) {
+        io->pio.ret = (io->pio.type == FOX_WRITE) ?
+            prov_vblk_pwrite(io->pio.vblk, io->pio.buf, io->pio.count,
+                                                            io->pio.offset) :
+            prov_vblk_pread(io->pio.vblk, io->pio.buf, io->pio.count,
+                                                            io->pio.offset);
+        io->tend = fox_timestamp_now ();
+        fox_io_complete (node, io);
+        return;
+    }
+
+    if (prov_io_submit (&io->pio)) {
+        io->pio.ret = -1;
+        fox_io_done (&io->pio);
+    }
+}
+
 int fox_write_blk (struct fox_tgt_blk *tgt, struct fox_node *node,
-                        struct fox_blkbuf *buf, uint16_t npgs, uint16_t blkoff)
+                                                uint16_t npgs, uint16_t blkoff)
 {
     int i, cmd_pgs;
-    uint8_t failed = 0;
-    struct fox_output_row *row;
+    struct fox_io *io;
+    struct fox_blk_hist *h;
     struct nvm_addr ppa;
-    uint64_t tstart, tend;
-    size_t tot_bytes;
     size_t vpg_sz = node->wl->geo->page_nbytes * node->wl->geo->nplanes;
 
     cmd_pgs = node->wl->nppas /
@@ -86,55 +893,27 @@ int fox_write_blk (struct fox_tgt_blk *tgt, struct fox_node *node,
 
     for (i = blkoff; i < blkoff + npgs; i = i + cmd_pgs) {
 
-        tstart = fox_timestamp_tmp_start(&node->stats);
-
         cmd_pgs = (i + cmd_pgs > blkoff + npgs) ? blkoff + npgs - i : cmd_pgs;
-        tot_bytes = vpg_sz * cmd_pgs;
-
-        /* If the data is human readable, updates the buffer */
-        if (node->wl->memcmp == WB_READABLE &&
-                                        node->wl->engine->id == FOX_ENGINE_1) {
-            ppa.ppa = tgt->vblk->blks[0].ppa;
-            ppa.g.pg = i;
-            fox_wb_readable((char *)(buf->buf_w + vpg_sz * i), cmd_pgs,
-                                                            node->wl->geo, ppa);
-        }
 
-        if (prov_vblk_pwrite(tgt->vblk,
-                            buf->buf_w + vpg_sz * i,
-                            tot_bytes,
-                            vpg_sz * i) != tot_bytes){
-            fox_set_stats (FOX_STATS_FAIL_W, &node->stats, cmd_pgs);
-            tend = fox_timestamp_end(FOX_STATS_RUNTIME, &node->stats);
-            failed++;
-            goto FAILED;
-        }
+        io = fox_ioq_get (node, tgt);
 
-        tend = fox_timestamp_end(FOX_STATS_WRITE_T, &node->stats);
-        fox_timestamp_end(FOX_STATS_RW_SECT, &node->stats);
-        fox_set_stats(FOX_STATS_BWRITTEN, &node->stats, tot_bytes);
-        fox_set_stats(FOX_STATS_BRW_SEC, &node->stats, tot_bytes);
-        fox_set_stats(FOX_STATS_IOPS, &node->stats, 1);
+        ppa.ppa = tgt->vblk->blks[0].ppa;
+        ppa.g.pg = i;
+        fox_wb_fill (node->wl, node->iter, io->buf, vpg_sz * cmd_pgs, ppa);
 
-FAILED:
-        fox_set_stats (FOX_STATS_PGS_W, &node->stats, cmd_pgs);
-        node->stats.pgs_done += cmd_pgs;
-
-        if (node->wl->output) {
-            row = fox_output_new ();
-            row->ch = tgt->ch;
-            row->lun = tgt->lun;
-            row->blk = tgt->blk;
-            row->pg = i;
-            row->tstart = tstart;
-            row->tend = tend;
-            row->ulat = tend - tstart;
-            row->type = 'w';
-            row->failed = failed;
-            row->datacmp = 2;
-            row->size = vpg_sz * cmd_pgs;
-            fox_output_append(row, node->nid);
-        }
+        /* Pages a spare block gets again if this one is retired */
+        h = fox_node_hist (node, tgt);
+        if (i + cmd_pgs > h->wp)
+            h->wp = i + cmd_pgs;
+
+        io->pio.type = FOX_WRITE;
+        io->pio.buf = io->buf;
+        io->pio.count = vpg_sz * cmd_pgs;
+        io->pio.offset = vpg_sz * i;
+        io->pg = i;
+        io->npgs = cmd_pgs;
+
+        fox_ioq_submit (node, io);
 
         if (fox_update_runtime(node)||(node->wl->stats->flags & FOX_FLAG_DONE))
             return 1;
@@ -146,13 +925,10 @@ FAILED:
 }
 
 int fox_read_blk (struct fox_tgt_blk *tgt, struct fox_node *node,
-                        struct fox_blkbuf *buf, uint16_t npgs, uint16_t blkoff)
+                                                uint16_t npgs, uint16_t blkoff)
 {
     int i, cmd_pgs;
-    uint8_t failed = 0, cmp = 0;
-    struct fox_output_row *row;
-    uint64_t tstart, tend, vwpg;
-    size_t tot_bytes;
+    struct fox_io *io;
     size_t vpg_sz = node->wl->geo->page_nbytes * node->wl->geo->nplanes;
 
     cmd_pgs = node->wl->nppas /(node->wl->geo->nsectors * node->wl->geo->nplanes);
@@ -163,77 +939,20 @@ int fox_read_blk (struct fox_tgt_blk *tgt, struct fox_node *node,
 
     for (i = blkoff; i < blkoff + npgs; i = i + cmd_pgs) {
 
-        tstart = fox_timestamp_tmp_start(&node->stats);
-
         cmd_pgs = (i + cmd_pgs > blkoff + npgs) ? blkoff + npgs - i : cmd_pgs;
-        tot_bytes = vpg_sz * cmd_pgs;
-
-        if (prov_vblk_pread(tgt->vblk,
-                            buf->buf_r + vpg_sz * i,
-                            tot_bytes,
-                            vpg_sz * i) != tot_bytes){
-            fox_set_stats (FOX_STATS_FAIL_R, &node->stats, cmd_pgs);
-            tend = fox_timestamp_end(FOX_STATS_RUNTIME, &node->stats);
-            failed++;
-            vwpg = tgt->vblk->blks[0].g.pg;
-            goto FAILED;
-        }
-
-        tend = fox_timestamp_end(FOX_STATS_READ_T, &node->stats);
-        fox_timestamp_end(FOX_STATS_RW_SECT, &node->stats);
-
-        /* Set page in vblk for possible memory comparison */
-        vwpg = tgt->vblk->blks[0].g.pg;
-        tgt->vblk->blks[0].g.pg = i;
 
-        cmp = (node->wl->memcmp) ?
-                          fox_blkbuf_cmp(node, buf, i, cmd_pgs, tgt->vblk) : 2;
+        io = fox_ioq_get (node, tgt);
 
-        fox_set_stats (FOX_STATS_BREAD, &node->stats, tot_bytes);
-        fox_set_stats (FOX_STATS_BRW_SEC,&node->stats, tot_bytes);
-        fox_set_stats(FOX_STATS_IOPS, &node->stats, 1);
+        io->pio.type = FOX_READ;
+        io->pio.buf = io->buf;
+        io->pio.count = vpg_sz * cmd_pgs;
+        io->pio.offset = vpg_sz * i;
+        io->pg = i;
+        io->npgs = cmd_pgs;
 
-FAILED:
-        fox_set_stats (FOX_STATS_PGS_R, &node->stats, cmd_pgs);
-
-        if (node->wl->output) {
-            row = fox_output_new ();
-            row->ch = tgt->ch;
-            row->lun = tgt->lun;
-            row->blk = tgt->blk;
-            row->pg = i;
-            row->tstart = tstart;
-            row->tend = tend;
-            row->ulat = tend - tstart;
-            row->type = 'r';
-            row->failed = failed;
-            row->datacmp = cmp;
-            row->size = vpg_sz * cmd_pgs;
-            fox_output_append(row, node->nid);
-        }
-
-        /* Create a file under /corruption containing the read binary */
-        if (node->wl->memcmp && cmp) {
-            char filename[40];
-            uint32_t pblk = fox_vblk_get_pblk (node->wl, tgt->ch, tgt->lun,
-                                                                      tgt->blk);
-
-            sprintf(filename, "c%dl%db%dp%d-seq%d", tgt->ch, tgt->lun, pblk, i,
-                                                                      cmd_pgs);
-
-            if (node->wl->memcmp == WB_GEOMETRY)
-                fox_wb_geo (buf->buf_w, tot_bytes, node->wl->geo,
-                                              tgt->vblk->blks[0], WB_GEO_FILL);
-
-            fox_flush_corruption (filename, buf->buf_w + vpg_sz * i,
-                                            buf->buf_r + vpg_sz * i, tot_bytes);
-        }
-
-        /* Set page in vblk back to previous position */
-        tgt->vblk->blks[0].g.pg = vwpg;
+        fox_ioq_submit (node, io);
 
         if (node->wl->w_factor == 0  || node->wl->engine->id == FOX_ENGINE_3) {
-            node->stats.pgs_done += cmd_pgs;
             if (fox_update_runtime(node))
                 return 1;
         }
@@ -247,15 +966,56 @@ FAILED:
     return 0;
 }
 
-int fox_erase_blk (struct fox_tgt_blk *tgt, struct fox_node *node)
+/* Replaces a block of the node by the next free block of its LUN (and of
+ * the LUNs of its stripe), the retired blocks go to the tail of the free
+ * rings. The new block is erased by the caller. Returns -1 if a LUN has no
+ * other usable block, the current one is kept. */
+static int fox_rotate_blk (struct fox_node *node, uint32_t blk_i)
 {
-    fox_timestamp_tmp_start(&node->stats);
+    struct fox_tgt_blk tgt;
+    struct nvm_vblk *vblk;
 
-    if (prov_vblk_erase (tgt->vblk)<0)
-        fox_set_stats (FOX_STATS_FAIL_E, &node->stats, 1);
+    fox_node_tgt (node, blk_i, &tgt);
 
-    fox_timestamp_end(FOX_STATS_ERASE_T, &node->stats);
-    fox_set_stats (FOX_STATS_ERASED_BLK, &node->stats, 1);
+    vblk = fox_vblk_stripe (node->wl, tgt.ch, tgt.lun, 0, NULL);
+    if (!vblk)
+        return -1;
+
+    prov_vblk_put (tgt.vblk);
+    node->wl->vblks[fox_vblk_get_pblk (node->wl, tgt.ch, tgt.lun,
+                                                            tgt.blk)] = vblk;
+    memset (&node->ioq->bhist[blk_i], 0, sizeof (struct fox_blk_hist));
+
+    return 0;
+}
+
+/* Marks the blocks of the node as dirty, they are erased in the background
+ * ahead of the jobs. Commands of the last pass complete first. */
+static int fox_erase_all_bg (struct fox_node *node)
+{
+    struct fox_ioq *q = node->ioq;
+    uint32_t blk_i;
+
+    fox_ioq_wait (node, 0);
+
+    if (q->nbad)
+        fox_bad_remap (node);
+
+    q->eblks = node->nblks * node->nluns * node->nchs;
+    for (blk_i = 0; blk_i < q->eblks; blk_i++) {
+        if (!q->eblk[blk_i]) {
+            if (node->wl->rotate)
+                fox_rotate_blk (node, blk_i);
+
+            q->eblk[blk_i] = FOX_EBLK_DIRTY;
+            q->ndirty++;
+        }
+    }
+    q->enext = 0;
+
+    fox_erase_ahead (node);
+
+    node->iter++;
 
     if (fox_update_runtime(node) || node->wl->stats->flags & FOX_FLAG_DONE)
         return 1;
@@ -263,26 +1023,61 @@ int fox_erase_blk (struct fox_tgt_blk *tgt, struct fox_node *node)
     return 0;
 }
 
+/* Erases all blocks of the node with one call to the provisioning layer,
+ * the backend groups them in as few commands as it can. Each block is
+ * accounted the latency of the command it was part of */
 int fox_erase_all_vblks (struct fox_node *node)
 {
-    uint32_t t_blks, t_luns;
-    uint16_t blk_i, lun_i, ch_i, blk_ch, blk_lun;
+    struct fox_ioq *q = node->ioq;
+    struct fox_tgt_blk tgt;
+    struct fox_blk_hist *h;
+    uint32_t blk_i, t_blks;
+    uint64_t tend;
+
+    if (q->edepth)
+        return fox_erase_all_bg (node);
+
+    /* Commands in flight may target the blocks, reads being verified have
+     * their own copy */
+    fox_ioq_wait (node, 0);
 
-    t_luns = node->nluns * node->nchs;
-    t_blks = node->nblks * t_luns;
-    blk_lun = t_blks / t_luns;
-    blk_ch = blk_lun * node->nluns;
+    if (q->nbad)
+        fox_bad_remap (node);
 
+    t_blks = node->nblks * node->nluns * node->nchs;
     for (blk_i = 0; blk_i < t_blks; blk_i++) {
-        ch_i = blk_i / blk_ch;
-        lun_i = (blk_i % blk_ch) / blk_lun;
+        /* If a LUN has no other free block, its block is erased again */
+        if (node->wl->rotate)
+            fox_rotate_blk (node, blk_i);
 
-        fox_vblk_tgt(node, node->ch[ch_i],node->lun[lun_i],blk_i % blk_lun);
+        fox_node_tgt (node, blk_i, &tgt);
+        q->evblks[blk_i] = tgt.vblk;
+    }
 
-        if (fox_erase_blk (&node->vblk_tgt, node))
-            return 1;
+    prov_vblk_erase_v (q->evblks, t_blks, q->eerr, q->ens);
+    tend = fox_timestamp_now ();
+
+    for (blk_i = 0; blk_i < t_blks; blk_i++) {
+        fox_node_tgt (node, blk_i, &tgt);
+        h = fox_node_hist (node, &tgt);
+
+        if (q->eerr[blk_i]) {
+            fox_set_stats (FOX_STATS_FAIL_E, &node->stats, 1);
+            fox_bad_flag (node, &tgt, 'e', tend - q->ens[blk_i], tend, 0, 0);
+        } else
+            fox_lat_add (&h->e, q->ens[blk_i]);
+        h->wp = 0;
+
+        fox_set_stats (FOX_STATS_ERASE_T, &node->stats, q->ens[blk_i]);
+        fox_set_stats (FOX_STATS_ERASED_BLK, &node->stats, 1);
     }
 
+    /* Pages written from now on carry a new payload */
+    node->iter++;
+
+    if (fox_update_runtime(node) || node->wl->stats->flags & FOX_FLAG_DONE)
+        return 1;
+
     return 0;
 }
 
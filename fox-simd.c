@@ -0,0 +1,287 @@
+/*  - FOX - A tool for testing Open-Channel SSDs
+ *      - Geometry buffer kernels
+ *
+ * Copyright (C) 2016, IT University of Copenhagen. All rights reserved.
+ * Written by Ivan Luiz Picoli <ivpi@itu.dk>
+ *
+ * Funding support provided by CAPES Foundation, Ministry of Education
+ * of Brazil, Brasilia - DF 70040-020, Brazil.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Fill and compare kernels for the geometry data type (-m 3). A sector is a
+ * sequence of 16-byte steps, step n holds the pair (l + 8n(n+1), h + 8n(n+1))
+ * where 'l' and 'h' are derived from the sector address. Each kernel keeps
+ * 'k' steps per register: moving k steps forward adds 16k*m + 8k(k+1) to the
+ * step m of the register and that delta grows by 16k*k every iteration.
+ *
+ * The widest kernel supported by the CPU is selected at runtime. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include "fox.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+struct fox_simd_ops {
+    const char  *name;
+    void        (*fill)(uint64_t *, size_t, uint64_t, uint64_t);
+    ssize_t     (*cmp)(const uint64_t *, size_t, uint64_t, uint64_t);
+};
+
+/* Steps from 'n' to the end, returns the first differing word or -1 */
+static ssize_t fox_simd_tail_cmp (const uint64_t *src, size_t n, size_t nsteps,
+                                                        uint64_t l, uint64_t h)
+{
+    uint64_t off;
+
+    for (; n < nsteps; n++) {
+        off = 8 * n * (n + 1);
+        if (src[2 * n] != l + off)
+            return 2 * n;
+        if (src[2 * n + 1] != h + off)
+            return 2 * n + 1;
+    }
+
+    return -1;
+}
+
+static void fox_simd_tail_fill (uint64_t *dst, size_t n, size_t nsteps,
+                                                        uint64_t l, uint64_t h)
+{
+    uint64_t off;
+
+    for (; n < nsteps; n++) {
+        off = 8 * n * (n + 1);
+        dst[2 * n] = l + off;
+        dst[2 * n + 1] = h + off;
+    }
+}
+
+static void fox_simd_fill_scalar (uint64_t *dst, size_t nsteps, uint64_t l,
+                                                                    uint64_t h)
+{
+    fox_simd_tail_fill (dst, 0, nsteps, l, h);
+}
+
+static ssize_t fox_simd_cmp_scalar (const uint64_t *src, size_t nsteps,
+                                                        uint64_t l, uint64_t h)
+{
+    return fox_simd_tail_cmp (src, 0, nsteps, l, h);
+}
+
+#if defined(__x86_64__)
+
+/* SSE: one step per register */
+__attribute__ ((target ("sse4.2")))
+static void fox_simd_fill_sse (uint64_t *dst, size_t nsteps, uint64_t l,
+                                                                    uint64_t h)
+{
+    __m128i v = _mm_set_epi64x (h, l);
+    __m128i d = _mm_set1_epi64x (16);
+    __m128i inc = _mm_set1_epi64x (16);
+    size_t n;
+
+    for (n = 0; n < nsteps; n++) {
+        _mm_storeu_si128 ((__m128i *) (dst + 2 * n), v);
+        v = _mm_add_epi64 (v, d);
+        d = _mm_add_epi64 (d, inc);
+    }
+}
+
+__attribute__ ((target ("sse4.2")))
+static ssize_t fox_simd_cmp_sse (const uint64_t *src, size_t nsteps,
+                                                        uint64_t l, uint64_t h)
+{
+    __m128i v = _mm_set_epi64x (h, l);
+    __m128i d = _mm_set1_epi64x (16);
+    __m128i inc = _mm_set1_epi64x (16);
+    __m128i s;
+    size_t n;
+
+    for (n = 0; n < nsteps; n++) {
+        s = _mm_loadu_si128 ((const __m128i *) (src + 2 * n));
+        if (_mm_movemask_epi8 (_mm_cmpeq_epi64 (s, v)) != 0xffff)
+            return fox_simd_tail_cmp (src, n, nsteps, l, h);
+        v = _mm_add_epi64 (v, d);
+        d = _mm_add_epi64 (d, inc);
+    }
+
+    return -1;
+}
+
+/* AVX2: two steps per register */
+__attribute__ ((target ("avx2")))
+static void fox_simd_fill_avx2 (uint64_t *dst, size_t nsteps, uint64_t l,
+                                                                    uint64_t h)
+{
+    __m256i v = _mm256_set_epi64x (h + 16, l + 16, h, l);
+    __m256i d = _mm256_set_epi64x (80, 80, 48, 48);
+    __m256i inc = _mm256_set1_epi64x (64);
+    size_t n;
+
+    for (n = 0; n + 2 <= nsteps; n += 2) {
+        _mm256_storeu_si256 ((__m256i *) (dst + 2 * n), v);
+        v = _mm256_add_epi64 (v, d);
+        d = _mm256_add_epi64 (d, inc);
+    }
+
+    fox_simd_tail_fill (dst, n, nsteps, l, h);
+}
+
+__attribute__ ((target ("avx2")))
+static ssize_t fox_simd_cmp_avx2 (const uint64_t *src, size_t nsteps,
+                                                        uint64_t l, uint64_t h)
+{
+    __m256i v = _mm256_set_epi64x (h + 16, l + 16, h, l);
+    __m256i d = _mm256_set_epi64x (80, 80, 48, 48);
+    __m256i inc = _mm256_set1_epi64x (64);
+    __m256i s;
+    size_t n;
+
+    for (n = 0; n + 2 <= nsteps; n += 2) {
+        s = _mm256_loadu_si256 ((const __m256i *) (src + 2 * n));
+        if (_mm256_movemask_epi8 (_mm256_cmpeq_epi64 (s, v)) != -1)
+            break;
+        v = _mm256_add_epi64 (v, d);
+        d = _mm256_add_epi64 (d, inc);
+    }
+
+    return fox_simd_tail_cmp (src, n, nsteps, l, h);
+}
+
+/* AVX-512: four steps per register */
+__attribute__ ((target ("avx512f")))
+static void fox_simd_fill_avx512 (uint64_t *dst, size_t nsteps, uint64_t l,
+                                                                    uint64_t h)
+{
+    __m512i v = _mm512_set_epi64 (h + 96, l + 96, h + 48, l + 48,
+                                  h + 16, l + 16, h, l);
+    __m512i d = _mm512_set_epi64 (352, 352, 288, 288, 224, 224, 160, 160);
+    __m512i inc = _mm512_set1_epi64 (256);
+    size_t n;
+
+    for (n = 0; n + 4 <= nsteps; n += 4) {
+        _mm512_storeu_si512 ((void *) (dst + 2 * n), v);
+        v = _mm512_add_epi64 (v, d);
+        d = _mm512_add_epi64 (d, inc);
+    }
+
+    fox_simd_tail_fill (dst, n, nsteps, l, h);
+}
+
+__attribute__ ((target ("avx512f")))
+static ssize_t fox_simd_cmp_avx512 (const uint64_t *src, size_t nsteps,
+                                                        uint64_t l, uint64_t h)
+{
+    __m512i v = _mm512_set_epi64 (h + 96, l + 96, h + 48, l + 48,
+                                  h + 16, l + 16, h, l);
+    __m512i d = _mm512_set_epi64 (352, 352, 288, 288, 224, 224, 160, 160);
+    __m512i inc = _mm512_set1_epi64 (256);
+    __m512i s;
+    size_t n;
+
+    for (n = 0; n + 4 <= nsteps; n += 4) {
+        s = _mm512_loadu_si512 ((const void *) (src + 2 * n));
+        if (_mm512_cmpneq_epu64_mask (s, v))
+            break;
+        v = _mm512_add_epi64 (v, d);
+        d = _mm512_add_epi64 (d, inc);
+    }
+
+    return fox_simd_tail_cmp (src, n, nsteps, l, h);
+}
+
+#endif /* __x86_64__ */
+
+static struct fox_simd_ops fox_simd_kernels[] = {
+#if defined(__x86_64__)
+    {"avx512", fox_simd_fill_avx512, fox_simd_cmp_avx512},
+    {"avx2",   fox_simd_fill_avx2,   fox_simd_cmp_avx2},
+    {"sse4.2", fox_simd_fill_sse,    fox_simd_cmp_sse},
+#endif
+    {"scalar", fox_simd_fill_scalar, fox_simd_cmp_scalar},
+};
+
+static struct fox_simd_ops *fox_simd = &fox_simd_kernels
+                    [sizeof (fox_simd_kernels) / sizeof (fox_simd_kernels[0]) - 1];
+
+static int fox_simd_supported (const char *name)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init ();
+
+    if (!strcmp (name, "avx512"))
+        return __builtin_cpu_supports ("avx512f");
+    if (!strcmp (name, "avx2"))
+        return __builtin_cpu_supports ("avx2");
+    if (!strcmp (name, "sse4.2"))
+        return __builtin_cpu_supports ("sse4.2");
+#endif
+    return !strcmp (name, "scalar");
+}
+
+/* Selects the widest kernel supported by the CPU */
+void fox_simd_init (void)
+{
+    int i;
+
+    for (i = 0; i < sizeof (fox_simd_kernels) / sizeof (fox_simd_kernels[0]);
+                                                                        i++) {
+        if (fox_simd_supported (fox_simd_kernels[i].name)) {
+            fox_simd = &fox_simd_kernels[i];
+            return;
+        }
+    }
+}
+
+const char *fox_simd_name (void)
+{
+    return fox_simd->name;
+}
+
+/* Fills a sector of 'nsteps' 16-byte steps */
+void fox_simd_geo_fill (uint8_t *dst, size_t nsteps, uint64_t l, uint64_t h)
+{
+    fox_simd->fill ((uint64_t *) dst, nsteps, l, h);
+}
+
+/* Returns the offset of the first differing byte in the sector or -1 */
+ssize_t fox_simd_geo_cmp (const uint8_t *src, size_t nsteps, uint64_t l,
+                                                                    uint64_t h)
+{
+    ssize_t word;
+    uint64_t exp, diff;
+
+    word = fox_simd->cmp ((const uint64_t *) src, nsteps, l, h);
+    if (word < 0)
+        return -1;
+
+    exp = ((word & 0x1) ? h : l) + 8 * (word / 2) * (word / 2 + 1);
+    diff = ((const uint64_t *) src)[word] ^ exp;
+
+    return word * 8 + __builtin_ctzll (diff) / 8;
+}
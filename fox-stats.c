@@ -32,34 +32,57 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <pthread.h>
 #include <string.h>
 #include "fox.h"
 
+/* Only the node thread writes its stats, a plain load followed by a relaxed
+ * store is enough. The monitor reads with relaxed loads and never blocks
+ * the I/O path. */
+#define FOX_STATS_ADD(f,v)  __atomic_store_n (&(f), (f) + (v), __ATOMIC_RELAXED)
+#define FOX_STATS_SET(f,v)  __atomic_store_n (&(f), (v), __ATOMIC_RELAXED)
+#define FOX_STATS_GET(f)    __atomic_load_n (&(f), __ATOMIC_RELAXED)
+
+/* Counters seen by the monitor at the previous progress report */
+struct fox_stats_snap {
+    uint64_t    rw_sect;
+    uint64_t    brw;
+    uint32_t    io_count;
+};
+
 int fox_init_stats (struct fox_stats *st)
 {
+    int i;
+
     memset (st, 0, sizeof (struct fox_stats));
 
-    if (pthread_mutex_init (&st->s_mutex, NULL) != 0)
-        return -1;
+    for (i = 0; i < FOX_HIST_OPS; i++) {
+        if (fox_hist_init (&st->hist[i], FOX_HIST_MAX))
+            goto FREE_HIST;
+    }
 
     return 0;
+
+FREE_HIST:
+    while (i) {
+        i--;
+        fox_hist_exit (&st->hist[i]);
+    }
+    return -1;
 }
 
 void fox_exit_stats (struct fox_stats *st)
 {
-    pthread_mutex_destroy (&st->s_mutex);
+    int i;
+
+    for (i = 0; i < FOX_HIST_OPS; i++)
+        fox_hist_exit (&st->hist[i]);
 }
 
 static uint16_t fox_get_progress (struct fox_stats *st)
 {
-    uint8_t prog;
-
-    pthread_mutex_lock(&st->s_mutex);
-    prog = st->progress;
-    pthread_mutex_unlock(&st->s_mutex);
-
-    return prog;
+    return FOX_STATS_GET(st->progress);
 }
 
 static uint64_t fox_get_tot_runtime (struct fox_node *nodes)
@@ -76,105 +99,105 @@ static uint64_t fox_get_tot_runtime (struct fox_node *nodes)
 
 void fox_set_progress (struct fox_stats *st, uint16_t val)
 {
-    pthread_mutex_lock(&st->s_mutex);
-    st->progress = val;
-    pthread_mutex_unlock(&st->s_mutex);
+    FOX_STATS_SET(st->progress, val);
 }
 
 void fox_set_stats (uint8_t type, struct fox_stats *st, int64_t val)
 {
-    pthread_mutex_lock(&st->s_mutex);
     switch (type) {
         case FOX_STATS_RUNTIME:
-            st->runtime = (uint64_t) val;
+            FOX_STATS_SET(st->runtime, (uint64_t) val);
             break;
         case FOX_STATS_RW_SECT:
-            st->rw_sect += (uint64_t) val;
+            FOX_STATS_ADD(st->rw_sect, (uint64_t) val);
             break;
         case FOX_STATS_ERASE_T:
-            st->erase_t += (uint64_t) val;
+            FOX_STATS_ADD(st->erase_t, (uint64_t) val);
+            fox_hist_record (&st->hist[FOX_HIST_ERASE], (uint64_t) val);
             break;
         case FOX_STATS_READ_T:
-            st->read_t += (uint64_t) val;
+            FOX_STATS_ADD(st->read_t, (uint64_t) val);
+            fox_hist_record (&st->hist[FOX_HIST_READ], (uint64_t) val);
             break;
         case FOX_STATS_WRITE_T:
-            st->write_t += (uint64_t) val;
+            FOX_STATS_ADD(st->write_t, (uint64_t) val);
+            fox_hist_record (&st->hist[FOX_HIST_WRITE], (uint64_t) val);
             break;
         case FOX_STATS_ERASED_BLK:
-            st->erased_blks += (uint32_t) val;
+            FOX_STATS_ADD(st->erased_blks, (uint32_t) val);
             break;
         case FOX_STATS_PGS_R:
-            st->pgs_r += (uint32_t) val;
+            FOX_STATS_ADD(st->pgs_r, (uint32_t) val);
             break;
         case FOX_STATS_PGS_W:
-            st->pgs_w += (uint32_t) val;
+            FOX_STATS_ADD(st->pgs_w, (uint32_t) val);
             break;
         case FOX_STATS_BREAD:
-            st->bread += (uint64_t) val;
+            FOX_STATS_ADD(st->bread, (uint64_t) val);
             break;
         case FOX_STATS_BWRITTEN:
-            st->bwritten += (uint64_t) val;
-            break;
-        case FOX_STATS_BRW_SEC:
-            st->brw_sec += (uint64_t) val;
+            FOX_STATS_ADD(st->bwritten, (uint64_t) val);
             break;
         case FOX_STATS_IOPS:
-            st->iops += (uint32_t) val;
-            st->io_count += (uint32_t) val;
+            FOX_STATS_ADD(st->io_count, (uint32_t) val);
             break;
         case FOX_STATS_FAIL_CMP:
-            st->fail_cmp += (uint32_t) val;
+            FOX_STATS_ADD(st->fail_cmp, (uint32_t) val);
             break;
         case FOX_STATS_FAIL_E:
-            st->fail_e += (uint32_t) val;
+            FOX_STATS_ADD(st->fail_e, (uint32_t) val);
             break;
         case FOX_STATS_FAIL_R:
-            st->fail_r += (uint32_t) val;
+            FOX_STATS_ADD(st->fail_r, (uint32_t) val);
             break;
         case FOX_STATS_FAIL_W:
-            st->fail_w += (uint32_t) val;
+            FOX_STATS_ADD(st->fail_w, (uint32_t) val);
+            break;
+        case FOX_STATS_QUEUE_T:
+            FOX_STATS_ADD(st->queue_t, (uint64_t) val);
+            fox_hist_record (&st->hist[FOX_HIST_QUEUE], (uint64_t) val);
+            break;
+        case FOX_STATS_ERASE_IO:
+            FOX_STATS_ADD(st->erase_io_t, (uint64_t) val);
+            FOX_STATS_ADD(st->erase_io, 1);
             break;
     }
-    pthread_mutex_unlock(&st->s_mutex);
 }
 
-void fox_timestamp_start (struct fox_stats *st)
+/* Durations are measured with CLOCK_MONOTONIC_RAW in n-seconds, it is not
+ * slewed by NTP. The wall clock is only used to label output. */
+uint64_t fox_timestamp_now (void)
 {
-    gettimeofday(&st->tval, NULL);
-}
+    struct timespec ts;
 
-uint64_t fox_timestamp_tmp_start (struct fox_stats *st)
-{
-    uint64_t usec;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
 
-    gettimeofday(&st->tval_tmp, NULL);
-
-    usec = st->tval_tmp.tv_sec * SEC64;
-    usec += st->tval_tmp.tv_usec;
-
-    return usec;
+    return ts.tv_sec * NSEC64 + ts.tv_nsec;
 }
 
-uint64_t fox_timestamp_end (uint8_t type, struct fox_stats *st)
+/* u-seconds since epoch */
+uint64_t fox_timestamp_wall (void)
 {
-    struct timeval te;
-    struct timeval *ts;
-    int64_t usec_s, usec_e, tot;
+    struct timeval tv;
 
-    gettimeofday(&te, NULL);
+    gettimeofday(&tv, NULL);
 
-    ts = (type == FOX_STATS_RUNTIME) ? &st->tval : &st->tval_tmp;
+    return tv.tv_sec * SEC64 + tv.tv_usec;
+}
 
-    usec_e = te.tv_sec * SEC64;
-    usec_e += te.tv_usec;
-    usec_s = ts->tv_sec * SEC64;
-    usec_s += ts->tv_usec;
+void fox_timestamp_start (struct fox_stats *st)
+{
+    st->tstart = fox_timestamp_now ();
+}
 
-    tot = usec_e - usec_s;
+/* Updates the runtime, returns the current monotonic time */
+uint64_t fox_timestamp_end (struct fox_stats *st)
+{
+    uint64_t now = fox_timestamp_now ();
 
-    fox_set_stats (type, st, tot);
+    fox_set_stats (FOX_STATS_RUNTIME, st, now - st->tstart);
 
-    return usec_e;
+    return now;
 }
 
 void fox_start_node (struct fox_node *node)
@@ -182,18 +205,20 @@ void fox_start_node (struct fox_node *node)
     node->stats.flags |= FOX_FLAG_READY;
     fox_wait_for_ready (node->wl);
     fox_timestamp_start(&node->stats);
+    fox_arrival_init (node);
 }
 
 void fox_end_node (struct fox_node *node)
 {
-    fox_timestamp_end(FOX_STATS_RUNTIME, &node->stats);
+    fox_ioq_drain (node);
+    fox_timestamp_end(&node->stats);
     node->stats.flags |= FOX_FLAG_DONE;
-    node->stats.progress = 100;
+    fox_set_progress (&node->stats, 100);
 }
 
 void fox_merge_stats (struct fox_node *nodes, struct fox_stats *st)
 {
-    int i;
+    int i, h_i;
 
     for (i = 0; i < nodes[0].wl->nthreads; i++) {
         st->bread += nodes[i].stats.bread;
@@ -203,28 +228,38 @@ void fox_merge_stats (struct fox_node *nodes, struct fox_stats *st)
         st->pgs_r += nodes[i].stats.pgs_r;
         st->pgs_w += nodes[i].stats.pgs_w;
         st->write_t += nodes[i].stats.write_t;
+        st->queue_t += nodes[i].stats.queue_t;
+        st->erase_io_t += nodes[i].stats.erase_io_t;
+        st->erase_io += nodes[i].stats.erase_io;
         st->erased_blks += nodes[i].stats.erased_blks;
         st->fail_e += nodes[i].stats.fail_e;
         st->fail_w += nodes[i].stats.fail_w;
         st->fail_r += nodes[i].stats.fail_r;
         st->fail_cmp += nodes[i].stats.fail_cmp;
         st->io_count += nodes[i].stats.io_count;
+
+        for (h_i = 0; h_i < FOX_HIST_OPS; h_i++)
+            fox_hist_merge (&st->hist[h_i], &nodes[i].stats.hist[h_i]);
     }
 
-    fox_timestamp_end (FOX_STATS_RUNTIME, st);
+    fox_timestamp_end (st);
 
     st->runtime = fox_get_tot_runtime(nodes);
 }
 
-static void fox_show_progress (struct fox_node *node)
+static void fox_show_progress (struct fox_node *node,
+                                                struct fox_stats_snap *snap)
 {
     int node_i, i;
     uint16_t n_prog, wl_prog = 0;
     long double th_sec, tot_sec = 0, totalb = 0, th = 0, iops = 0;
-    uint64_t usec, io_count = 0;
+    uint64_t usec, rw_sect, brw;
+    uint32_t io_count, n_ios;
+    struct fox_stats *st;
     struct fox_output_row_rt **rt = NULL;
 
-    usec = fox_timestamp_end (FOX_STATS_RUNTIME, node[0].wl->stats);
+    fox_timestamp_end (node[0].wl->stats);
+    usec = fox_timestamp_wall ();
 
     if (node->wl->output) {
         rt = malloc (sizeof(void *) * (node->wl->nthreads + 1));
@@ -237,42 +272,43 @@ static void fox_show_progress (struct fox_node *node)
 
     printf ("\r");
     for (node_i = 0; node_i < node[0].wl->nthreads; node_i++) {
+        st = &node[node_i].stats;
 
-        n_prog = fox_get_progress(&node[node_i].stats);
+        n_prog = fox_get_progress(st);
         wl_prog += n_prog;
 
-        pthread_mutex_lock(&node[node_i].stats.s_mutex);
+        /* counters are cumulative, the interval is the difference from
+         * the previous report */
+        rw_sect = FOX_STATS_GET(st->rw_sect);
+        brw = FOX_STATS_GET(st->bread) + FOX_STATS_GET(st->bwritten);
+        n_ios = FOX_STATS_GET(st->io_count);
+
+        totalb = brw - snap[node_i].brw;
+        th_sec = rw_sect - snap[node_i].rw_sect;
+        io_count = n_ios - snap[node_i].io_count;
+
+        snap[node_i].rw_sect = rw_sect;
+        snap[node_i].brw = brw;
+        snap[node_i].io_count = n_ios;
+
+        th_sec /= (long double) NSEC64;
+        tot_sec += th_sec;
 
         if (node->wl->output) {
-            rt[node_i + 1]->thpt = (node[node_i].stats.brw_sec == 0 ||
-                node[node_i].stats.rw_sect == 0) ? 0 :
-                (node[node_i].stats.brw_sec / (long double) (1024 * 1024))
-                / (node[node_i].stats.rw_sect / (long double) SEC64);
+            rt[node_i + 1]->thpt = (totalb == 0 || th_sec == 0) ? 0 :
+                (totalb / (long double) (1024 * 1024)) / th_sec;
 
-            rt[node_i + 1]->iops = (node[node_i].stats.iops == 0 ||
-                node[node_i].stats.rw_sect == 0) ? 0 :
-                ((long double) node[node_i].stats.iops) /
-                (node[node_i].stats.rw_sect / (long double) SEC64);
+            rt[node_i + 1]->iops = (io_count == 0 || th_sec == 0) ? 0 :
+                (long double) io_count / th_sec;
 
             rt[node_i + 1]->timestp = usec;
 
             fox_output_append_rt (rt[node_i + 1], node[node_i].nid + 1);
         }
 
-        totalb = node[node_i].stats.brw_sec;
-        th_sec = node[node_i].stats.rw_sect;
-        io_count = node[node_i].stats.iops;
-        node[node_i].stats.rw_sect -= th_sec;
-        node[node_i].stats.brw_sec -= totalb;
-        th_sec /= (long double) SEC64;
-        tot_sec += th_sec;
-
         th += (totalb == 0 || th_sec == 0) ? 0 : totalb /  th_sec;
         iops += (io_count == 0 || th_sec == 0) ?
                                           0 : (long double) io_count / th_sec;
-        node[node_i].stats.iops = 0;
-
-        pthread_mutex_unlock(&node[node_i].stats.s_mutex);
 
         printf(" [%d:%d%%]", node[node_i].nid, n_prog);
 
@@ -297,9 +333,9 @@ static void fox_show_progress (struct fox_node *node)
 static uint8_t fox_check_runtime (struct fox_workload *wl)
 {
     if (wl->runtime) {
-        fox_timestamp_end (FOX_STATS_RUNTIME, wl->stats);
+        fox_timestamp_end (wl->stats);
 
-        if (wl->stats->runtime / SEC64 > wl->runtime)
+        if (wl->stats->runtime / NSEC64 > wl->runtime)
             return 1;
     }
 
@@ -314,6 +350,9 @@ void fox_monitor (struct fox_node *nodes)
 
     nn = wl->nthreads;
 
+    struct fox_stats_snap snap[nn];
+    memset (snap, 0, sizeof (struct fox_stats_snap) * nn);
+
     printf ("\n - Synchronizing threads... (%s engine)\n", wl->engine->name);
     if (wl->engine->id == 3)
         printf ("\n");
@@ -347,13 +386,13 @@ void fox_monitor (struct fox_node *nodes)
 
     /* show progress and wait until all threads are done */
     show = 0;
-    fox_show_progress (nodes);
+    fox_show_progress (nodes, snap);
     do {
         usleep(50000);
 
         show++;
         if (show % 10 == 0) {
-            fox_show_progress (nodes);
+            fox_show_progress (nodes, snap);
             show = 0;
         }
 
@@ -367,35 +406,206 @@ void fox_monitor (struct fox_node *nodes)
         }
     } while (ndone < nn);
 
-    fox_show_progress (nodes);
+    fox_show_progress (nodes, snap);
+}
+
+static void fox_show_hist (struct fox_workload *wl, struct fox_stats *st)
+{
+    const char *name[FOX_HIST_OPS] = {"Read", "Write", "Erase", "Queue"};
+    struct fox_hist *h;
+    char line[128];
+    int i;
+
+    sprintf (line, " --- LATENCY (u-sec) ---\n\n");
+    fox_print (line, wl->output);
+    sprintf (line, "            min     p50     p90     p99   p99.9  p99.99"
+                                                        "     max\n");
+    fox_print (line, wl->output);
+
+    for (i = 0; i < FOX_HIST_OPS; i++) {
+        if (i == FOX_HIST_QUEUE && !wl->arrival)
+            continue;
+        h = &st->hist[i];
+        sprintf (line, " - %-6s%8.1f%8.1f%8.1f%8.1f%8.1f%8.1f%8.1f\n", name[i],
+                                    fox_hist_min (h) / 1e3,
+                                    fox_hist_percentile (h, 50.0) / 1e3,
+                                    fox_hist_percentile (h, 90.0) / 1e3,
+                                    fox_hist_percentile (h, 99.0) / 1e3,
+                                    fox_hist_percentile (h, 99.9) / 1e3,
+                                    fox_hist_percentile (h, 99.99) / 1e3,
+                                    h->max / 1e3);
+        fox_print (line, wl->output);
+    }
+    sprintf (line, "\n");
+    fox_print (line, wl->output);
+}
+
+static int fox_wear_cmp (const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void fox_show_wear_row (struct fox_workload *wl, const char *name,
+                                                    uint32_t *val, size_t n)
+{
+    char line[128];
+    long double sum = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        sum += val[i];
+
+    qsort (val, n, sizeof (uint32_t), fox_wear_cmp);
+
+    sprintf (line, " - %-6s%8u%8u%8u%8u%8u%10.1Lf\n", name, val[0],
+                                val[n / 2], val[n * 90 / 100],
+                                val[n * 99 / 100], val[n - 1], sum / n);
+    fox_print (line, wl->output);
+}
+
+/* Erase counts of the good blocks of the workload LUNs, including the
+ * free ones. 'Last' is the latency of the last erase in u-sec. */
+static void fox_show_wear (struct fox_workload *wl)
+{
+    struct prov_wear w;
+    uint32_t *erases, *run, *last;
+    size_t n = 0, nblks;
+    char line[128];
+    int ch, lun, blk;
+
+    nblks = wl->channels * wl->luns * wl->geo->nblocks;
+    erases = malloc (nblks * sizeof (uint32_t));
+    run = malloc (nblks * sizeof (uint32_t));
+    last = malloc (nblks * sizeof (uint32_t));
+    if (!erases || !run || !last)
+        goto FREE;
+
+    for (ch = 0; ch < wl->channels; ch++) {
+        for (lun = 0; lun < wl->luns; lun++) {
+            for (blk = 0; blk < wl->geo->nblocks; blk++) {
+                if (prov_vblk_wear (ch, lun, blk, &w))
+                    continue;
+                erases[n] = w.erases;
+                run[n] = w.run;
+                last[n] = w.last_us;
+                n++;
+            }
+        }
+    }
+
+    if (!n)
+        goto FREE;
+
+    sprintf (line, " --- WEAR (%lu blocks) ---\n\n", n);
+    fox_print (line, wl->output);
+    sprintf (line, "            min     p50     p90     p99     max      mean"
+                                                                        "\n");
+    fox_print (line, wl->output);
+
+    fox_show_wear_row (wl, "Erases", erases, n);
+    fox_show_wear_row (wl, "Run", run, n);
+    fox_show_wear_row (wl, "Last", last, n);
+
+    sprintf (line, "\n");
+    fox_print (line, wl->output);
+
+FREE:
+    free (erases);
+    free (run);
+    free (last);
+}
+
+/* Blocks marked bad by the jobs (device address), when and why, the erase
+ * counts before, and the commands to the block since its slot took it,
+ * mean and max latency in u-sec */
+static void fox_show_retired (struct fox_workload *wl, struct fox_node *node)
+{
+    struct fox_retired *rb;
+    struct fox_blk_hist *h;
+    char line[160];
+    int i, n = 0;
+
+    for (i = 0; i < wl->nthreads; i++)
+        TAILQ_FOREACH (rb, &node[i].ioq->retired_head, entry)
+            n++;
+
+    if (!n)
+        return;
+
+    sprintf (line, " --- RETIRED BLOCKS (%d) ---\n\n", n);
+    fox_print (line, wl->output);
+    sprintf (line, "                    cause   at s  fail us  erases  last us"
+            "   writes  mean   max   reads  mean   max  erases  mean   max"
+            " spare\n");
+    fox_print (line, wl->output);
+
+    for (i = 0; i < wl->nthreads; i++) {
+        TAILQ_FOREACH (rb, &node[i].ioq->retired_head, entry) {
+            h = &rb->hist;
+            sprintf (line, " - c%02dl%02db%-5d %-5s %7.1f %8.1f %7u %8u"
+                    " %8u %5.0f %5.0f %7u %5.0f %5.0f %7u %5.0f %5.0f %s\n",
+                    rb->addr.g.ch, rb->addr.g.lun, rb->addr.g.blk,
+                    (h->bad == 'e') ? "erase" : "write",
+                    h->tfail / (double) NSEC64, h->fail_t / 1000.0,
+                    rb->erases, rb->last_us,
+                    h->w.n, (h->w.n) ? h->w.t / 1000.0 / h->w.n : 0,
+                    h->w.max / 1000.0,
+                    h->r.n, (h->r.n) ? h->r.t / 1000.0 / h->r.n : 0,
+                    h->r.max / 1000.0,
+                    h->e.n, (h->e.n) ? h->e.t / 1000.0 / h->e.n : 0,
+                    h->e.max / 1000.0, (rb->spare) ? "yes" : "no");
+            fox_print (line, wl->output);
+        }
+    }
+
+    sprintf (line, "\n");
+    fox_print (line, wl->output);
 }
 
 void fox_show_stats (struct fox_workload *wl, struct fox_node *node)
 {
-    long double th = 0, totb = 0, tsec, io_usec = 0;
-    uint64_t elat, rlat, wlat;
+    long double th = 0, totb = 0, tsec, io_nsec = 0;
+    long double elat, rlat, wlat, qlat, eiolat, iolat;
+    uint64_t stalled, dropped;
+    struct fox_retired *rb;
+    uint32_t nremap = 0, nlost = 0;
     int i;
     char line[80];
 
     struct fox_stats *st = wl->stats;
 
     for (i = 0; i < wl->nthreads; i++) {
-        io_usec += node[i].stats.runtime;
+        io_nsec += node[i].stats.runtime;
         totb += node[i].stats.bread + node[i].stats.bwritten;
+        TAILQ_FOREACH (rb, &node[i].ioq->retired_head, entry)
+            nremap += rb->spare;
+        nlost += node[i].ioq->nlost;
     }
 
-    tsec = st->runtime / (long double) SEC64;
+    tsec = st->runtime / (long double) NSEC64;
     th = totb / tsec;
 
-    elat = (st->erased_blks) ? st->erase_t / st->erased_blks : 0;
-    rlat = (st->pgs_r) ? st->read_t / (st->pgs_r & AND64) : 0;
-    wlat = (st->pgs_w) ? st->write_t / (st->pgs_w & AND64) : 0;
+    /* Latencies are kept in n-sec and shown in u-sec */
+    elat = (st->erased_blks) ? st->erase_t / (long double) st->erased_blks : 0;
+    rlat = (st->pgs_r) ? st->read_t / (long double) st->pgs_r : 0;
+    wlat = (st->pgs_w) ? st->write_t / (long double) st->pgs_w : 0;
+    qlat = (st->hist[FOX_HIST_QUEUE].total) ?
+                st->queue_t / (long double) st->hist[FOX_HIST_QUEUE].total : 0;
+
+    /* Commands with and without a background erase in flight */
+    eiolat = (st->erase_io) ? st->erase_io_t / (long double) st->erase_io : 0;
+    iolat = (st->io_count > st->erase_io) ? (st->read_t + st->write_t -
+              st->erase_io_t) / (long double) (st->io_count - st->erase_io) : 0;
 
     sprintf (line, "\n\n --- RESULTS ---\n\n");
     fox_print (line, wl->output);
-    sprintf (line, " - Elapsed time  : %lu m-sec\n",st->runtime/(1000 & AND64));
+    sprintf (line, " - Elapsed time  : %lu m-sec\n",
+                                            st->runtime / (1000000 & AND64));
     fox_print (line, wl->output);
-    sprintf (line, " - I/O time (sum): %.0Lf m-sec\n", io_usec/(1000 & AND64));
+    sprintf (line, " - I/O time (sum): %.0Lf m-sec\n",
+                                            io_nsec / (1000000 & AND64));
     fox_print (line, wl->output);
     sprintf (line, " - Read data     : %lu KB\n", st->bread / (1024 & AND64));
     fox_print (line, wl->output);
@@ -411,31 +621,86 @@ void fox_show_stats (struct fox_workload *wl, struct fox_node *node)
     fox_print (line, wl->output);
     sprintf (line, " - Erased blocks : %d\n", st->erased_blks);
     fox_print (line, wl->output);
-    sprintf (line, " - Erase latency : %lu u-sec\n", elat);
+    sprintf (line, " - Erase latency : %.2Lf u-sec\n", elat / 1000);
     fox_print (line, wl->output);
-    sprintf (line, " - Read latency  : %lu u-sec\n", rlat);
+    sprintf (line, " - Read latency  : %.2Lf u-sec\n", rlat / 1000);
     fox_print (line, wl->output);
-    sprintf (line, " - Write latency : %lu u-sec\n", wlat);
+    sprintf (line, " - Write latency : %.2Lf u-sec\n", wlat / 1000);
     fox_print (line, wl->output);
+    if (wl->arrival) {
+        sprintf (line, " - Queue delay   : %.2Lf u-sec\n", qlat / 1000);
+        fox_print (line, wl->output);
+    }
+    if (wl->erase_depth && st->erased_blks) {
+        snprintf (line, sizeof (line), " - Erase overlap : %d cmds, %.2Lf "
+                        "u-sec (%.2Lf u-sec apart)\n", st->erase_io,
+                        eiolat / 1000, iolat / 1000);
+        fox_print (line, wl->output);
+    }
     sprintf (line, " - Failed memcmp : %d\n", st->fail_cmp);
     fox_print (line, wl->output);
     sprintf (line, " - Failed writes : %d\n", st->fail_w);
     fox_print (line, wl->output);
     sprintf (line, " - Failed reads  : %d\n", st->fail_r);
     fox_print (line, wl->output);
-    sprintf (line, " - Failed erases : %d\n\n", st->fail_e);
+    sprintf (line, " - Failed erases : %d\n", st->fail_e);
+    fox_print (line, wl->output);
+    snprintf (line, sizeof (line), " - Retired blocks: %d (%d replaced in "
+                            "the workload)\n%s", prov_bbt_grown (), nremap,
+                            (nlost) ? "" : "\n");
     fox_print (line, wl->output);
+    if (nlost) {
+        snprintf (line, sizeof (line), " - Not recorded : %d retired "
+                                                    "blocks\n\n", nlost);
+        fox_print (line, wl->output);
+    }
+
+    if (wl->output) {
+        fox_output_trace_stats (&stalled, &dropped);
+        sprintf (line, " - Trace stalls  : %lu\n", stalled);
+        fox_print (line, wl->output);
+        sprintf (line, " - Trace dropped : %lu\n\n", dropped);
+        fox_print (line, wl->output);
+    }
+
+    fox_show_hist (wl, st);
+    fox_show_wear (wl);
+    fox_show_retired (wl, node);
 }
 
 void fox_show_workload (struct fox_workload *wl)
 {
+    const char *wear_name[] = {"fifo", "least worn", "most worn", "random"};
     char line[80];
     char mcname[20];
+    uint64_t init_ns, lun_ns;
+    int lun, nluns;
 
     sprintf (line, "\n --- WORKLOAD ---\n\n");
     fox_print (line, wl->output);
-    sprintf (line, " - Device       : %s\n", wl->devname);
+    snprintf (line, sizeof (line), " - Device       : %s\n", wl->devname);
     fox_print (line, wl->output);
+    prov_init_time (&init_ns, &lun_ns, &lun);
+    if (prov_bbt_cached ())
+        sprintf (line, " - BBT load     : %.1f ms, cached\n",
+                                                init_ns / (double) 1000000);
+    else
+        sprintf (line, " - BBT load     : %.1f ms, slowest LUN c%dl%d "
+                "%.1f ms\n", init_ns / (double) 1000000,
+                (int) (lun / wl->geo->nluns), (int) (lun % wl->geo->nluns),
+                lun_ns / (double) 1000000);
+    fox_print (line, wl->output);
+    /* The time of every LUN only goes to the metadata file */
+    if (wl->output) {
+        nluns = wl->geo->nchannels * wl->geo->nluns;
+        for (lun = 0; lun < nluns; lun++) {
+            sprintf (line, "   - BBT load c%dl%d : %.3f ms\n",
+                            (int) (lun / wl->geo->nluns),
+                            (int) (lun % wl->geo->nluns),
+                            prov_lun_init_time (lun) / (double) 1000000);
+            fox_print_meta (line);
+        }
+    }
     if (wl->runtime)
         sprintf (line, " - Runtime      : %lu sec\n", wl->runtime);
     else
@@ -451,14 +716,37 @@ void fox_show_workload (struct fox_workload *wl)
     fox_print (line, wl->output);
     sprintf (line, " - Pgs per Blk  : %d\n", wl->pgs);
     fox_print (line, wl->output);
+    if (wl->stripe > 1) {
+        sprintf (line, " - Stripe width : %d LUNs, %d pgs per blk\n",
+                                        wl->stripe, wl->pgs * wl->stripe);
+        fox_print (line, wl->output);
+    }
     sprintf (line, " - Write factor : %d %%\n", wl->w_factor);
     fox_print (line, wl->output);
     sprintf (line, " - Read factor  : %d %%\n", wl->r_factor);
     fox_print (line, wl->output);
     sprintf (line, " - Vector PPAs  : %d\n", wl->nppas);
     fox_print (line, wl->output);
+    sprintf (line, " - I/O depth    : %d\n", wl->iodepth);
+    fox_print (line, wl->output);
     sprintf (line, " - Max I/O delay: %d u-sec\n", wl->max_delay);
     fox_print (line, wl->output);
+    if (wl->rate_iops) {
+        sprintf (line, " - Rate (IOPS)  : %lu (%s)\n", wl->rate_iops,
+                                    (wl->rate_job) ? "per job" : "global");
+        fox_print (line, wl->output);
+    }
+    if (wl->arrival) {
+        sprintf (line, " - Arrival      : open-loop, %s\n",
+                (wl->arrival == FOX_ARRIVAL_POISSON) ? "poisson" : "constant");
+        fox_print (line, wl->output);
+    }
+    if (wl->rate_bw) {
+        sprintf (line, " - Rate (MB/s)  : %lu (%s)\n",
+                                    wl->rate_bw / (1024 * 1024),
+                                    (wl->rate_job) ? "per job" : "global");
+        fox_print (line, wl->output);
+    }
     if (wl->output)
         sprintf (line, " - Output file  : enabled\n");
     else
@@ -484,6 +772,39 @@ void fox_show_workload (struct fox_workload *wl)
     }
     sprintf (line, " - Buffer type  : %s\n", mcname);
 
+    fox_print (line, wl->output);
+    sprintf (line, " - Seed         : 0x%016lx\n", wl->seed);
+    fox_print (line, wl->output);
+    if (wl->compress > 1.0 || wl->dedup) {
+        sprintf (line, " - Compression  : %.2f:1\n",
+                                    (wl->compress > 1.0) ? wl->compress : 1.0);
+        fox_print (line, wl->output);
+        sprintf (line, " - Dedup        : %d %%\n", wl->dedup);
+        fox_print (line, wl->output);
+    }
+    if (wl->memcmp == WB_GEOMETRY) {
+        sprintf (line, " - Data kernel  : %s\n", fox_simd_name ());
+        fox_print (line, wl->output);
+    }
+    if (wl->memcmp) {
+        if (wl->verifiers)
+            sprintf (line, " - Verifiers    : %d\n", wl->verifiers);
+        else
+            sprintf (line, " - Verifiers    : inline\n");
+        fox_print (line, wl->output);
+    }
+    if (wl->w_factor) {
+        if (wl->erase_depth)
+            sprintf (line, " - Erase depth  : %d\n", wl->erase_depth);
+        else
+            sprintf (line, " - Erase depth  : at the end of each pass\n");
+        fox_print (line, wl->output);
+        if (wl->rotate) {
+            sprintf (line, " - Rotation     : free blocks of each LUN\n");
+            fox_print (line, wl->output);
+        }
+    }
+    sprintf (line, " - Block choice : %s\n", wear_name[wl->wear]);
     fox_print (line, wl->output);
     sprintf (line, " - Engine       : %d (%s)\n", wl->engine->id,
                                                             wl->engine->name);
@@ -201,7 +201,8 @@ struct fox_node *fox_create_threads (struct fox_workload *wl)
     if (!nodes_ch)
         goto FREE_TC;
 
-    node = malloc (sizeof(struct fox_node) * wl->nthreads);
+    node = aligned_alloc (FOX_CACHE_LINE,
+                                    sizeof(struct fox_node) * wl->nthreads);
     if (!node) {
         printf ("thread: Memory allocation failed.\n");
         goto FREE_NC;
@@ -211,14 +212,24 @@ struct fox_node *fox_create_threads (struct fox_workload *wl)
         node[ci].wl = wl;
         node[ci].nid = ci;
         node[ci].nblks = wl->blks;
-        node[ci].npgs = wl->pgs;
+        node[ci].npgs = wl->pgs * wl->stripe;
         node[ci].delay = 0;
+        node[ci].iter = 0;
+        fox_prng_init (&node[ci].prng, wl->seed, ci);
+        node[ci].rate = (!wl->rate) ? NULL :
+                                    &wl->rate[(wl->rate_job) ? ci : 0];
 
         if (fox_init_stats (&node[ci].stats))
             goto EXIT_CH;
 
+        if (fox_ioq_init (&node[ci])) {
+            fox_exit_stats (&node[ci].stats);
+            goto EXIT_CH;
+        }
+
         if (fox_config_ch(&node[ci])) {
             printf("thread: Failed to start. id: %d\n", ci);
+            fox_ioq_exit (&node[ci]);
             fox_exit_stats (&node[ci].stats);
 	    goto EXIT_CH;
         }
@@ -248,6 +259,7 @@ EXIT_LUN:
     err++;
 EXIT_CH:
     for (i = 0; i < ci; i++) {
+        fox_ioq_exit (&node[i]);
         fox_exit_stats (&node[i].stats);
         free (node[i].ch);
     }
@@ -273,6 +285,7 @@ void fox_exit_threads (struct fox_node *nodes)
         free (nodes[i].lun);
         fox_exit_stats (&nodes[i].stats);
         pthread_join(nodes[i].tid, NULL);
+        fox_ioq_exit (&nodes[i]);
     }
     free (nodes);
     free(th_ch);
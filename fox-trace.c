@@ -0,0 +1,356 @@
+/*  - FOX - A tool for testing Open-Channel SSDs
+ *      - Binary trace reader
+ *
+ * Copyright (C) 2016, IT University of Copenhagen. All rights reserved.
+ * Written by Ivan Luiz Picoli <ivpi@itu.dk>
+ *
+ * Funding support provided by CAPES Foundation, Ministry of Education
+ * of Brazil, Brasilia - DF 70040-020, Brazil.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fox.h"
+
+struct fox_trace_lun {
+    uint64_t        bread;
+    uint64_t        bwritten;
+    uint64_t        fail;
+    struct fox_hist hist[2];
+};
+
+/* Read, write and queue delay */
+#define FOX_TRACE_HISTS 3
+
+struct fox_trace {
+    const struct fox_trace_hdr  *hdr;
+    const uint8_t               *recs;
+    uint64_t                    nrecs;
+    uint64_t                    nios;
+    uint64_t                    tfirst;
+    uint64_t                    tlast;
+    struct fox_hist             hist[FOX_TRACE_HISTS];
+    struct fox_trace_lun        *lun;
+    uint32_t                    nluns;
+};
+
+static int fox_trace_check (const struct fox_trace_hdr *hdr, size_t sz)
+{
+    if (sz < sizeof (struct fox_trace_hdr) || hdr->magic != FOX_TRACE_MAGIC) {
+        printf (" Not a FOX binary trace.\n");
+        return -1;
+    }
+
+    if (hdr->version != FOX_TRACE_VERSION) {
+        printf (" Trace version %d is not supported.\n", hdr->version);
+        return -1;
+    }
+
+    if (hdr->hdr_sz < sizeof (struct fox_trace_hdr) || hdr->hdr_sz > sz ||
+                            hdr->rec_sz < sizeof (struct fox_trace_rec)) {
+        printf (" Corrupted trace header.\n");
+        return -1;
+    }
+
+    if ((sz - hdr->hdr_sz) % hdr->rec_sz)
+        printf (" WARNING: trace is truncated, last record ignored.\n");
+
+    return 0;
+}
+
+static void fox_trace_header (struct fox_trace *tr)
+{
+    const struct fox_trace_hdr *hdr = tr->hdr;
+
+    printf ("\n --- TRACE ---\n\n");
+    printf (" - Device       : %s\n", hdr->devname);
+    printf (" - Geometry     : %d ch, %d luns, %d blks, %d pgs, %d pls, "
+                          "%d secs\n", hdr->nchannels, hdr->nluns,
+                          hdr->nblocks, hdr->npages, hdr->nplanes,
+                          hdr->nsectors);
+    printf (" - Num of jobs  : %d\n", hdr->nthreads);
+    printf (" - Workload     : %d ch, %d luns, %d blks, %d pgs\n",
+                          hdr->channels, hdr->luns, hdr->blks, hdr->pgs);
+    printf (" - R/W factor   : %d/%d %%\n", hdr->r_factor, hdr->w_factor);
+    printf (" - Vector PPAs  : %d\n", hdr->nppas);
+    printf (" - I/O depth    : %d\n", hdr->iodepth);
+    printf (" - Engine       : %d\n", hdr->engine);
+    printf (" - Seed         : 0x%016lx\n", hdr->seed);
+    if (hdr->arrival)
+        printf (" - Arrival      : open-loop, %s\n",
+               (hdr->arrival == FOX_ARRIVAL_POISSON) ? "poisson" : "constant");
+    printf (" - Records      : %lu\n", tr->nios);
+    if (tr->nios)
+        printf (" - Trace span   : %lu m-sec\n",
+                                        (tr->tlast - tr->tfirst) / 1000000);
+}
+
+static void fox_trace_pct (struct fox_trace *tr)
+{
+    const char *name[FOX_TRACE_HISTS] = {"Read", "Write", "Queue"};
+    struct fox_hist *h;
+    int i;
+
+    printf ("\n --- LATENCY (u-sec) ---\n\n");
+    printf ("            min     p50     p90     p99   p99.9  p99.99"
+                                                            "     max\n");
+    for (i = 0; i < FOX_TRACE_HISTS; i++) {
+        if (i == 2 && !tr->hdr->arrival)
+            continue;
+        h = &tr->hist[i];
+        printf (" - %-6s%8.1f%8.1f%8.1f%8.1f%8.1f%8.1f%8.1f\n", name[i],
+                                    fox_hist_min (h) / 1e3,
+                                    fox_hist_percentile (h, 50.0) / 1e3,
+                                    fox_hist_percentile (h, 90.0) / 1e3,
+                                    fox_hist_percentile (h, 99.0) / 1e3,
+                                    fox_hist_percentile (h, 99.9) / 1e3,
+                                    fox_hist_percentile (h, 99.99) / 1e3,
+                                    h->max / 1e3);
+    }
+}
+
+static void fox_trace_luns (struct fox_trace *tr)
+{
+    struct fox_trace_lun *l;
+    uint32_t i;
+
+    printf ("\n --- PER LUN ---\n\n");
+    printf ("  ch lun    reads   writes  read MB   wrt MB   r_p50   r_p99"
+                                                "   w_p50   w_p99  fail\n");
+    for (i = 0; i < tr->nluns; i++) {
+        l = &tr->lun[i];
+        if (!l->hist[0].total && !l->hist[1].total && !l->fail)
+            continue;
+
+        printf (" %3d %3d %8lu %8lu %8lu %8lu %7.1f %7.1f %7.1f %7.1f %5lu\n",
+                i / tr->hdr->nluns, i % tr->hdr->nluns,
+                l->hist[0].total, l->hist[1].total,
+                l->bread / (1024 * 1024), l->bwritten / (1024 * 1024),
+                fox_hist_percentile (&l->hist[0], 50.0) / 1e3,
+                fox_hist_percentile (&l->hist[0], 99.0) / 1e3,
+                fox_hist_percentile (&l->hist[1], 50.0) / 1e3,
+                fox_hist_percentile (&l->hist[1], 99.0) / 1e3,
+                l->fail);
+    }
+}
+
+/* Walks all records. Rebuilds absolute timestamps and 64-bit node sequences,
+ * prints CSV lines if requested and feeds the histograms. */
+static int fox_trace_scan (struct fox_trace *tr, uint8_t out)
+{
+    const struct fox_trace_rec *rec;
+    uint64_t rec_i, tstart, twall, nseq, seq = 0;
+    uint64_t *node_seq;
+    uint32_t lun_i;
+    int op;
+
+    node_seq = calloc (tr->hdr->nthreads + 1, sizeof (uint64_t));
+    if (!node_seq)
+        return -1;
+
+    if (out & FOX_TRACE_CSV)
+        printf ("sequence;node_sequence;node_id;channel;lun;block;page;"
+                       "start;end;latency;queue_delay;type;is_failed;"
+                       "read_memcmp;bytes\n");
+
+    tstart = tr->hdr->tbase;
+    for (rec_i = 0; rec_i < tr->nrecs; rec_i++) {
+        rec = (const struct fox_trace_rec *)
+                                    (tr->recs + rec_i * tr->hdr->rec_sz);
+
+        if (rec->type == FOX_TRACE_SYNC) {
+            tstart = ((uint64_t) rec->blk << 32) | rec->pg;
+            continue;
+        }
+        tstart += rec->tdelta;
+
+        if (!tr->nios)
+            tr->tfirst = tstart;
+        if (tstart + rec->ulat > tr->tlast)
+            tr->tlast = tstart + rec->ulat;
+        tr->nios++;
+
+        nseq = rec->node_seq;
+        if (rec->tid <= tr->hdr->nthreads) {
+            nseq |= node_seq[rec->tid] & ~0xffffffffULL;
+            if (nseq < node_seq[rec->tid])
+                nseq += 1ULL << 32;
+            node_seq[rec->tid] = nseq;
+        }
+
+        if (out & FOX_TRACE_CSV) {
+            twall = tr->hdr->twall + (tstart - tr->hdr->tbase);
+            printf ("%lu;%lu;%d;%d;%d;%d;%d;%lu;%lu;%u;%u;%c;%d;%d;%d\n",
+                    seq, nseq, rec->tid, rec->ch, rec->lun, rec->blk,
+                    rec->pg, twall, twall + rec->ulat, rec->ulat,
+                    rec->qdelay, rec->type, rec->failed, rec->datacmp, rec->size);
+            seq++;
+            continue;
+        }
+
+        op = (rec->type == 'w') ? 1 : 0;
+        lun_i = rec->ch * tr->hdr->nluns + rec->lun;
+
+        if (rec->failed) {
+            if (lun_i < tr->nluns)
+                tr->lun[lun_i].fail++;
+            continue;
+        }
+
+        fox_hist_record (&tr->hist[op], rec->ulat);
+        fox_hist_record (&tr->hist[2], rec->qdelay);
+
+        if (lun_i < tr->nluns) {
+            fox_hist_record (&tr->lun[lun_i].hist[op], rec->ulat);
+            if (op)
+                tr->lun[lun_i].bwritten += rec->size;
+            else
+                tr->lun[lun_i].bread += rec->size;
+        }
+    }
+
+    free (node_seq);
+    return 0;
+}
+
+static void fox_trace_free (struct fox_trace *tr)
+{
+    uint32_t i;
+
+    for (i = 0; i < FOX_TRACE_HISTS; i++)
+        fox_hist_exit (&tr->hist[i]);
+
+    if (!tr->lun)
+        return;
+
+    for (i = 0; i < tr->nluns; i++) {
+        fox_hist_exit (&tr->lun[i].hist[0]);
+        fox_hist_exit (&tr->lun[i].hist[1]);
+    }
+    free (tr->lun);
+}
+
+static int fox_trace_alloc (struct fox_trace *tr, uint8_t out)
+{
+    uint32_t i;
+
+    for (i = 0; i < FOX_TRACE_HISTS; i++)
+        if (fox_hist_init (&tr->hist[i], FOX_HIST_MAX))
+            goto FREE;
+
+    if (!(out & FOX_TRACE_LUN))
+        return 0;
+
+    tr->nluns = tr->hdr->nchannels * tr->hdr->nluns;
+    tr->lun = calloc (tr->nluns, sizeof (struct fox_trace_lun));
+    if (!tr->lun)
+        goto FREE;
+
+    for (i = 0; i < tr->nluns; i++) {
+        if (fox_hist_init (&tr->lun[i].hist[0], FOX_HIST_MAX) ||
+                        fox_hist_init (&tr->lun[i].hist[1], FOX_HIST_MAX))
+            goto FREE;
+    }
+
+    return 0;
+
+FREE:
+    fox_trace_free (tr);
+    return -1;
+}
+
+int fox_trace_init (struct fox_argp *argp)
+{
+    struct fox_trace tr;
+    struct stat st;
+    uint8_t out = argp->trace_out;
+    void *map;
+    int fd, ret = -1;
+
+    if (argp->trace_file[0] == 0) {
+        printf (" Trace file is required (-f).\n");
+        return -1;
+    }
+
+    if (!(out & (FOX_TRACE_CSV | FOX_TRACE_LUN)))
+        out |= FOX_TRACE_PCT;
+
+    fd = open (argp->trace_file, O_RDONLY);
+    if (fd < 0) {
+        printf (" Trace file not found.\n");
+        return -1;
+    }
+
+    if (fstat (fd, &st))
+        goto CLOSE;
+
+    if (st.st_size < sizeof (struct fox_trace_hdr)) {
+        printf (" Not a FOX binary trace.\n");
+        goto CLOSE;
+    }
+
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        goto CLOSE;
+    madvise (map, st.st_size, MADV_SEQUENTIAL);
+
+    memset (&tr, 0, sizeof (struct fox_trace));
+    tr.hdr = map;
+
+    if (fox_trace_check (tr.hdr, st.st_size))
+        goto UNMAP;
+
+    tr.recs = (const uint8_t *) map + tr.hdr->hdr_sz;
+    tr.nrecs = (st.st_size - tr.hdr->hdr_sz) / tr.hdr->rec_sz;
+
+    if (fox_trace_alloc (&tr, out))
+        goto UNMAP;
+
+    if (fox_trace_scan (&tr, out))
+        goto FREE;
+
+    if (!(out & FOX_TRACE_CSV)) {
+        fox_trace_header (&tr);
+        if (out & FOX_TRACE_PCT)
+            fox_trace_pct (&tr);
+        if (out & FOX_TRACE_LUN)
+            fox_trace_luns (&tr);
+        printf ("\n");
+    }
+
+    ret = 0;
+
+FREE:
+    fox_trace_free (&tr);
+UNMAP:
+    munmap (map, st.st_size);
+CLOSE:
+    close (fd);
+    return ret;
+}
@@ -30,6 +30,11 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "fox.h"
 
 uint32_t fox_vblk_get_pblk (struct fox_workload *wl, uint16_t ch, uint16_t lun,
@@ -67,74 +72,606 @@ int fox_vblk_tgt (struct fox_node *node, uint16_t chid, uint16_t lunid,
     return 0;
 }
 
-static int fox_write_vblk_100r (struct nvm_vblk *vblk, struct fox_workload *wl)
+/* Gets the blocks of a workload slot: one of the slot LUN and, with
+ * --stripe, one of each of the next LUNs of the job. Blocks are erased
+ * if 'erase' is set. 'claim' gives the blocks to take instead of the next
+ * free ones, they must follow the same LUNs. Returns NULL if any block is
+ * missing, the others go back to the pool */
+struct nvm_vblk *fox_vblk_stripe (struct fox_workload *wl, uint16_t ch,
+                uint16_t lun, uint8_t erase, const struct nvm_addr *claim)
 {
-    uint8_t *buf, *buf_off;
-    size_t vpg_sz = wl->geo->page_nbytes * wl->geo->nplanes;
-    int i, ret = -1;
+    struct nvm_vblk *blks[PROV_NBLK_MAX], *vblk;
+    int i, l = ch * wl->luns + lun;
+
+    for (i = 0; i < wl->stripe; i++) {
+        ch = l / wl->luns;
+        lun = l % wl->luns;
+
+        if (claim && (claim[i].g.ch != ch || claim[i].g.lun != lun))
+            goto PUT;
+
+        if (claim)
+            blks[i] = prov_vblk_claim (ch, lun, claim[i].g.blk);
+        else
+            blks[i] = (erase) ? prov_vblk_get (ch, lun) :
+                                                prov_vblk_next (ch, lun);
+        if (!blks[i])
+            goto PUT;
+
+        if (i + 1 < wl->stripe)
+            l = wl->stripe_lun[l];
+    }
+
+    vblk = prov_vblk_join (blks, wl->stripe);
+    if (vblk)
+        return vblk;
+
+PUT:
+    while (i--)
+        prov_vblk_put (blks[i]);
+    return NULL;
+}
 
-    buf = malloc (vpg_sz * wl->pgs);
-    if (!buf)
+/* With --stripe, each LUN points to the next LUN of its job, in the order
+ * the job visits its blocks */
+static int fox_stripe_init (struct fox_workload *wl, struct fox_node *nodes)
+{
+    struct fox_node *node;
+    int node_i, i, next, t_luns;
+
+    if (wl->stripe == 1)
+        return 0;
+
+    wl->stripe_lun = calloc (wl->channels * wl->luns, sizeof (uint16_t));
+    if (!wl->stripe_lun)
         return -1;
 
-    fox_wb_geo (buf, vpg_sz * wl->pgs, wl->geo, vblk->blks[0], WB_GEO_FILL);
+    for (node_i = 0; node_i < wl->nthreads; node_i++) {
+        node = &nodes[node_i];
+        t_luns = node->nchs * node->nluns;
 
-    for (i = 0; i < wl->pgs; i++) {
-        buf_off = buf + vpg_sz * i;
+        if (t_luns < wl->stripe) {
+            printf (" [fox: ERROR. Job %d has %d LUNs, stripe is %d.]\n",
+                                            node->nid, t_luns, wl->stripe);
+            free (wl->stripe_lun);
+            wl->stripe_lun = NULL;
+            return -1;
+        }
+
+        for (i = 0; i < t_luns; i++) {
+            next = (i + 1) % t_luns;
+            wl->stripe_lun[node->ch[i / node->nluns] * wl->luns +
+                                                node->lun[i % node->nluns]] =
+                                node->ch[next / node->nluns] * wl->luns +
+                                                node->lun[next % node->nluns];
+        }
+    }
+
+    return 0;
+}
+
+/* Blocks are prepared per LUN by up to FOX_PREP_THREADS threads: each one
+ * takes the next LUN, gets (and erases) its blocks and, for 100% read
+ * workloads, programs them with commands of FOX_PREP_PPAS sectors. The main
+ * thread shows the progress */
+#define FOX_PREP_THREADS    16
+#define FOX_PREP_PPAS       64
+#define FOX_PREP_SHOW_USEC  100000
+
+/* A 100% read workload leaves a manifest under ./dataset with the blocks it
+ * programmed and what was written. A later read run with the same device,
+ * distribution and data takes the same blocks from the free pool without
+ * erasing them, after reading FOX_DATASET_SAMPLES pages of each block */
+#define FOX_DATASET_MAGIC   0x5441445f584f46    /* "FOX_DAT" */
+#define FOX_DATASET_VERSION 0x2
+#define FOX_DATASET_SAMPLES 3
+#define FOX_DATASET_DEV_LEN 128
+
+struct fox_dataset_hdr {
+    uint64_t    magic;
+    uint32_t    version;
+    uint32_t    nchannels;  /* device geometry */
+    uint32_t    nluns;
+    uint32_t    nplanes;
+    uint32_t    nblocks;
+    uint32_t    npages;
+    uint32_t    sector_nbytes;
+    uint32_t    channels;   /* workload */
+    uint32_t    luns;
+    uint32_t    blks;
+    uint32_t    pgs;
+    uint32_t    stripe;
+    uint32_t    memcmp;
+    uint32_t    dedup;
+    double      compress;
+    uint64_t    seed;
+    uint64_t    written;    /* wall clock, seconds */
+    char        dev[FOX_DATASET_DEV_LEN];
+};
+
+struct fox_prep_ctx {
+    struct fox_workload *wl;
+    struct nvm_addr     *reuse;     /* blocks of a dataset, NULL if none,
+                                       wl->stripe per slot */
+    int                 next;       /* next LUN */
+    int                 nluns;
+    int                 running;
+    uint32_t            blks_done;
+    uint64_t            bytes;
+    uint8_t             err;
+    uint64_t            tend;       /* set by each thread when done */
+    uint64_t            *erase_ns;  /* per block, accounted by the caller */
+};
+
+/* Pages are written with the payload of the first pass, the same the read
+ * verification rebuilds */
+static int fox_write_vblk_100r (struct nvm_vblk *vblk, struct fox_workload *wl,
+                                                    uint8_t *buf, int cmd_pgs)
+{
+    size_t vpg_sz = wl->geo->page_nbytes * wl->geo->nplanes;
+    int vblk_pgs = wl->pgs * wl->stripe;
+    struct nvm_addr ppa;
+    int i, npgs;
 
-        if (prov_vblk_pwrite(vblk, buf_off, vpg_sz,vpg_sz * i) != vpg_sz){
+    ppa.ppa = vblk->blks[0].ppa;
+
+    for (i = 0; i < vblk_pgs; i += cmd_pgs) {
+        npgs = (i + cmd_pgs > vblk_pgs) ? vblk_pgs - i : cmd_pgs;
+        ppa.g.pg = i;
+        fox_wb_fill (wl, 0, buf, vpg_sz * npgs, ppa);
+
+        if (prov_vblk_pwrite(vblk, buf, vpg_sz * npgs, vpg_sz * i) !=
+                                                            vpg_sz * npgs) {
             printf ("\nWARNING: error when writing to vblk page.\n");
-            goto FREE_BUF;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Reads the first, the last and random pages of a reused block */
+static int fox_check_vblk_100r (struct nvm_vblk *vblk, struct fox_workload *wl,
+                                uint8_t *buf, uint8_t *exp, unsigned int *seed)
+{
+    size_t vpg_sz = wl->geo->page_nbytes * wl->geo->nplanes;
+    int vblk_pgs = wl->pgs * wl->stripe;
+    struct nvm_addr ppa;
+    size_t off;
+    int i;
+
+    ppa.ppa = vblk->blks[0].ppa;
+
+    for (i = 0; i < FOX_DATASET_SAMPLES; i++) {
+        if (i == 0)
+            ppa.g.pg = 0;
+        else if (i == 1)
+            ppa.g.pg = vblk_pgs - 1;
+        else
+            ppa.g.pg = rand_r (seed) % vblk_pgs;
+
+        if (prov_vblk_pread(vblk, buf, vpg_sz, vpg_sz * ppa.g.pg) != vpg_sz)
+            return -1;
+
+        if (fox_wb_cmp (wl, 0, buf, exp, vpg_sz, ppa, &off))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* All members of a striped block */
+static uint64_t fox_stripe_mask (struct fox_workload *wl)
+{
+    return (wl->stripe == 64) ? UINT64_MAX : (1ULL << wl->stripe) - 1;
+}
+
+/* Takes the blocks of a LUN and erases them in one batch. Blocks that fail
+ * are retired and the slot takes the next free ones, erased one by one */
+static int fox_prep_erase (struct fox_prep_ctx *ctx, uint16_t ch_i,
+                                                    uint16_t lun_i, int *err)
+{
+    struct fox_workload *wl = ctx->wl;
+    uint32_t blk, pblk = fox_vblk_get_pblk (wl, ch_i, lun_i, 0);
+    struct nvm_vblk **vblks = &wl->vblks[pblk];
+    struct nvm_addr bad[PROV_NBLK_MAX];
+    uint64_t tstart;
+
+    for (blk = 0; blk < wl->blks; blk++) {
+        vblks[blk] = fox_vblk_stripe (wl, ch_i, lun_i, 0, NULL);
+        if (!vblks[blk])
+            goto NO_BLK;
+    }
+
+    prov_vblk_erase_v (vblks, wl->blks, err, &ctx->erase_ns[pblk]);
+
+    for (blk = 0; blk < wl->blks; blk++) {
+        if (!err[blk])
+            continue;
+
+        prov_vblk_retire (vblks[blk], fox_stripe_mask (wl), bad);
+
+        tstart = fox_timestamp_now ();
+        vblks[blk] = fox_vblk_stripe (wl, ch_i, lun_i, 1, NULL);
+        if (!vblks[blk])
+            goto NO_BLK;
+        ctx->erase_ns[pblk + blk] = fox_timestamp_now () - tstart;
+    }
+
+    return 0;
+
+NO_BLK:
+    printf ("\n [fox: ERROR. No free block in ch %d, lun %d%s.]\n",
+                    ch_i, lun_i, (wl->stripe > 1) ? " or its stripe" : "");
+    return -1;
+}
+
+static int fox_prep_blk (struct fox_prep_ctx *ctx, uint16_t ch_i,
+                        uint16_t lun_i, uint32_t blk, uint8_t *buf,
+                        uint8_t *exp, int cmd_pgs, unsigned int *seed)
+{
+    struct fox_workload *wl = ctx->wl;
+    size_t vpg_sz = wl->geo->page_nbytes * wl->geo->nplanes;
+    uint32_t pblk = fox_vblk_get_pblk (wl, ch_i, lun_i, blk);
+    struct nvm_addr bad[PROV_NBLK_MAX];
+    uint64_t tstart;
+
+    if (ctx->reuse) {
+        wl->vblks[pblk] = fox_vblk_stripe (wl, ch_i, lun_i, 0,
+                                            &ctx->reuse[pblk * wl->stripe]);
+        if (!wl->vblks[pblk])
+            return -1;
+
+        return fox_check_vblk_100r (wl->vblks[pblk], wl, buf, exp, seed);
+    }
+
+    if (wl->w_factor)
+        return 0;
+
+    /* Write all pages of the vblk for 100% read workload. Blocks that fail
+     * are retired and the slot takes the next free ones */
+    while (fox_write_vblk_100r (wl->vblks[pblk], wl, buf, cmd_pgs)) {
+        prov_vblk_retire (wl->vblks[pblk], fox_stripe_mask (wl), bad);
+
+        tstart = fox_timestamp_now ();
+        wl->vblks[pblk] = fox_vblk_stripe (wl, ch_i, lun_i, 1, NULL);
+        if (!wl->vblks[pblk]) {
+            printf ("\n [fox: ERROR. No free block in ch %d, lun %d%s.]\n",
+                    ch_i, lun_i, (wl->stripe > 1) ? " or its stripe" : "");
+            return -1;
+        }
+        ctx->erase_ns[pblk] += fox_timestamp_now () - tstart;
+    }
+
+    __atomic_fetch_add (&ctx->bytes, vpg_sz * wl->pgs * wl->stripe,
+                                                            __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void *fox_prep_th (void *arg)
+{
+    struct fox_prep_ctx *ctx = arg;
+    struct fox_workload *wl = ctx->wl;
+    size_t vpg_sz = wl->geo->page_nbytes * wl->geo->nplanes;
+    uint8_t *buf = NULL, *exp = NULL;
+    uint32_t blk;
+    unsigned int seed = fox_timestamp_now ();
+    int lun, ch_i, lun_i, cmd_pgs, *err = NULL;
+
+    cmd_pgs = FOX_PREP_PPAS / (wl->geo->nsectors * wl->geo->nplanes);
+    cmd_pgs = (cmd_pgs) ? cmd_pgs : 1;
+
+    if (wl->w_factor == 0) {
+        buf = aligned_alloc (wl->geo->sector_nbytes, vpg_sz * cmd_pgs);
+        exp = aligned_alloc (wl->geo->sector_nbytes, vpg_sz);
+        if (!buf || !exp) {
+            ctx->err = 1;
+            goto EXIT;
         }
     }
 
-    ret = 0;
+    if (!ctx->reuse) {
+        err = calloc (wl->blks, sizeof (int));
+        if (!err) {
+            ctx->err = 1;
+            goto EXIT;
+        }
+    }
 
-FREE_BUF:
+    while ((lun = __atomic_fetch_add (&ctx->next, 1, __ATOMIC_RELAXED))
+                                                                < ctx->nluns) {
+        ch_i = lun / wl->luns;
+        lun_i = lun % wl->luns;
+
+        if (!ctx->reuse && fox_prep_erase (ctx, ch_i, lun_i, err)) {
+            __atomic_store_n (&ctx->err, 1, __ATOMIC_RELAXED);
+            goto EXIT;
+        }
+
+        for (blk = 0; blk < wl->blks; blk++) {
+            if (__atomic_load_n (&ctx->err, __ATOMIC_RELAXED))
+                goto EXIT;
+
+            if (fox_prep_blk (ctx, ch_i, lun_i, blk, buf, exp, cmd_pgs,
+                                                                    &seed)) {
+                __atomic_store_n (&ctx->err, 1, __ATOMIC_RELAXED);
+                goto EXIT;
+            }
+
+            __atomic_fetch_add (&ctx->blks_done, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+EXIT:
     free (buf);
-    return ret;
+    free (exp);
+    free (err);
+    __atomic_store_n (&ctx->tend, fox_timestamp_now (), __ATOMIC_RELAXED);
+    __atomic_fetch_sub (&ctx->running, 1, __ATOMIC_RELEASE);
+    return NULL;
 }
 
-int fox_alloc_vblks (struct fox_workload *wl)
+static void fox_prep_show (struct fox_prep_ctx *ctx, uint32_t t_blks,
+                                                uint64_t tstart, char end)
 {
-    int ch_i, lun_i, blk_i, t_blks, t_luns, blk_ch, blk_lun;
+    uint32_t done = __atomic_load_n (&ctx->blks_done, __ATOMIC_RELAXED);
+    uint64_t bytes = __atomic_load_n (&ctx->bytes, __ATOMIC_RELAXED);
+    uint64_t tend = (__atomic_load_n (&ctx->running, __ATOMIC_ACQUIRE)) ?
+                                            fox_timestamp_now () : ctx->tend;
+    double sec = (tend - tstart) / (double) NSEC64;
+
+    if (bytes)
+        printf ("\r - Preparing blocks... [%d/%d] %.1f s, %.1f MB/s%c",
+                                done, t_blks, sec, (sec > 0) ?
+                                bytes / sec / (1024 * 1024) : 0.0, end);
+    else
+        printf ("\r - %s blocks... [%d/%d] %.1f s%c",
+                                (ctx->reuse) ? "Checking" : "Preparing",
+                                done, t_blks, sec, end);
+    fflush(stdout);
+}
+
+/* Gets the workload blocks, or the blocks of 'reuse'. On failure, the
+ * blocks already taken are returned to the pool */
+static int fox_prep_vblks (struct fox_workload *wl, struct nvm_addr *reuse)
+{
+    struct fox_prep_ctx ctx;
+    pthread_t tid[FOX_PREP_THREADS];
+    int blk_i, t_blks, t_luns, th, nth;
+    uint64_t tstart;
 
     t_luns = wl->luns * wl->channels;
     t_blks = wl->blks * t_luns;
-    blk_lun = t_blks / t_luns;
-    blk_ch = blk_lun * wl->luns;
-
-    wl->vblks = malloc (sizeof(struct nvm_vblk *) * t_blks);
 
-    if (!wl->vblks)
+    memset (wl->vblks, 0, t_blks * sizeof(struct nvm_vblk *));
+    memset (&ctx, 0, sizeof (struct fox_prep_ctx));
+    ctx.wl = wl;
+    ctx.reuse = reuse;
+    ctx.nluns = t_luns;
+    ctx.erase_ns = calloc (t_blks, sizeof (uint64_t));
+    if (!ctx.erase_ns)
         return -1;
 
-    printf ("\n");
-    for (blk_i = 0; blk_i < t_blks; blk_i++) {
-        printf ("\r - Allocating blocks... [%d/%d]", blk_i, t_blks);
-        fflush(stdout);
+    tstart = fox_timestamp_now ();
 
-        ch_i = blk_i / blk_ch;
-        lun_i = (blk_i % blk_ch) / blk_lun;
+    nth = (t_luns < FOX_PREP_THREADS) ? t_luns : FOX_PREP_THREADS;
+    ctx.running = nth;
+    for (th = 0; th < nth; th++) {
+        if (pthread_create (&tid[th], NULL, fox_prep_th, &ctx)) {
+            __atomic_fetch_sub (&ctx.running, nth - th, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    nth = th;
 
-        fox_timestamp_tmp_start(wl->stats);
+    if (!nth) {
+        ctx.running = 1;
+        fox_prep_th (&ctx);
+    }
 
-        wl->vblks[blk_i] = prov_vblk_get(ch_i, lun_i);
+    while (__atomic_load_n (&ctx.running, __ATOMIC_ACQUIRE)) {
+        fox_prep_show (&ctx, t_blks, tstart, ' ');
+        usleep (FOX_PREP_SHOW_USEC);
+    }
 
-        /* TODO: treat error */
-        if(wl->vblks[blk_i] == NULL)
-            return -1;
+    for (th = 0; th < nth; th++)
+        pthread_join (tid[th], NULL);
+
+    fox_prep_show (&ctx, t_blks, tstart, '\n');
+
+    if (ctx.err)
+        goto PUT_VBLKS;
 
-        fox_timestamp_end(FOX_STATS_ERASE_T, wl->stats);
+    for (blk_i = 0; !reuse && blk_i < t_blks; blk_i++) {
+        fox_set_stats (FOX_STATS_ERASE_T, wl->stats, ctx.erase_ns[blk_i]);
         fox_set_stats (FOX_STATS_ERASED_BLK, wl->stats, 1);
+    }
+
+    free (ctx.erase_ns);
+
+    return 0;
+
+PUT_VBLKS:
+    for (blk_i = 0; blk_i < t_blks; blk_i++) {
+        if (wl->vblks[blk_i])
+            prov_vblk_put(wl->vblks[blk_i]);
+    }
+    free (ctx.erase_ns);
+    return -1;
+}
 
-        /* Write wl->pgs to vblk for 100% read workload */
-        if (wl->w_factor == 0)
-            fox_write_vblk_100r (wl->vblks[blk_i], wl);
+static void fox_dataset_file (struct fox_workload *wl, char *file)
+{
+    int i;
+
+    sprintf (file, "dataset/%.*s.fox", FOX_DATASET_DEV_LEN - 1, wl->devname);
+    for (i = 8; file[i] != '\0'; i++) {
+        if (strchr ("/?&=:", file[i]))
+            file[i] = '_';
     }
-    printf ("\r - Preparing blocks... [%d/%d]\n", blk_i, t_blks);
+}
+
+static void fox_dataset_hdr (struct fox_workload *wl,
+                                                struct fox_dataset_hdr *hdr)
+{
+    memset (hdr, 0, sizeof (struct fox_dataset_hdr));
+    hdr->magic = FOX_DATASET_MAGIC;
+    hdr->version = FOX_DATASET_VERSION;
+    hdr->nchannels = wl->geo->nchannels;
+    hdr->nluns = wl->geo->nluns;
+    hdr->nplanes = wl->geo->nplanes;
+    hdr->nblocks = wl->geo->nblocks;
+    hdr->npages = wl->geo->npages;
+    hdr->sector_nbytes = wl->geo->sector_nbytes;
+    hdr->channels = wl->channels;
+    hdr->luns = wl->luns;
+    hdr->blks = wl->blks;
+    hdr->pgs = wl->pgs;
+    hdr->stripe = wl->stripe;
+    hdr->memcmp = wl->memcmp;
+    hdr->dedup = wl->dedup;
+    hdr->compress = wl->compress;
+    hdr->seed = wl->seed;
+    snprintf (hdr->dev, FOX_DATASET_DEV_LEN, "%s", wl->devname);
+}
+
+/* Loads the block list of a dataset that can be read by this workload.
+ * More pages than needed may have been written. Geometry data does not
+ * depend on the seed */
+static struct nvm_addr *fox_dataset_load (struct fox_workload *wl,
+                                                        uint64_t *written)
+{
+    struct fox_dataset_hdr hdr, exp;
+    struct nvm_addr *ppas = NULL;
+    char file[FOX_DATASET_DEV_LEN + 16];
+    size_t t_blks = wl->blks * wl->luns * wl->channels * wl->stripe;
+    FILE *fp;
+
+    fox_dataset_file (wl, file);
+    fp = fopen (file, "r");
+    if (!fp)
+        return NULL;
+
+    if (fread (&hdr, sizeof (hdr), 1, fp) != 1)
+        goto CLOSE;
+
+    fox_dataset_hdr (wl, &exp);
+    if (hdr.pgs >= wl->pgs)
+        exp.pgs = hdr.pgs;
+    if (wl->memcmp == WB_GEOMETRY)
+        exp.seed = hdr.seed;
+    exp.written = hdr.written;
+
+    if (memcmp (&hdr, &exp, sizeof (hdr)))
+        goto CLOSE;
+
+    ppas = malloc (t_blks * sizeof (struct nvm_addr));
+    if (!ppas)
+        goto CLOSE;
+
+    if (fread (ppas, sizeof (struct nvm_addr), t_blks, fp) != t_blks ||
+                                                        fgetc (fp) != EOF) {
+        free (ppas);
+        ppas = NULL;
+        goto CLOSE;
+    }
+
+    *written = hdr.written;
+
+CLOSE:
+    fclose (fp);
+    return ppas;
+}
+
+static void fox_dataset_save (struct fox_workload *wl)
+{
+    struct fox_dataset_hdr hdr;
+    struct stat st = {0};
+    char file[FOX_DATASET_DEV_LEN + 16];
+    size_t blk_i, t_blks = wl->blks * wl->luns * wl->channels;
+    FILE *fp;
+
+    if (stat ("dataset", &st) == -1)
+        mkdir ("dataset", S_IRWXU | S_IRWXG | S_IRWXO);
+
+    fox_dataset_file (wl, file);
+    fp = fopen (file, "w");
+    if (!fp)
+        return;
+
+    fox_dataset_hdr (wl, &hdr);
+    hdr.written = time (NULL);
+    if (fwrite (&hdr, sizeof (hdr), 1, fp) != 1)
+        goto ERR;
+
+    for (blk_i = 0; blk_i < t_blks; blk_i++) {
+        if (fwrite (wl->vblks[blk_i]->blks, sizeof (struct nvm_addr),
+                                        wl->stripe, fp) != wl->stripe)
+            goto ERR;
+    }
+
+    if (fclose (fp))
+        unlink (file);
+
+    return;
+
+ERR:
+    fclose (fp);
+    unlink (file);
+}
+
+int fox_alloc_vblks (struct fox_workload *wl, struct fox_node *nodes)
+{
+    struct nvm_addr *reuse = NULL;
+    char file[FOX_DATASET_DEV_LEN + 16];
+    uint64_t written;
+    time_t wtime;
+    int t_blks;
+
+    t_blks = wl->blks * wl->luns * wl->channels;
+
+    wl->vblks = calloc (t_blks, sizeof(struct nvm_vblk *));
+    if (!wl->vblks)
+        return -1;
+
+    if (fox_stripe_init (wl, nodes))
+        goto FREE;
+
+    printf ("\n");
+
+    if (wl->w_factor == 0 && !wl->prefill)
+        reuse = fox_dataset_load (wl, &written);
+
+    if (reuse) {
+        if (!fox_prep_vblks (wl, reuse)) {
+            wtime = written;
+            printf (" - Reusing dataset written %s", ctime (&wtime));
+            free (reuse);
+            return 0;
+        }
+        printf (" - Dataset does not match, preparing blocks again.\n");
+        free (reuse);
+    }
+
+    /* Blocks taken from now on may hold a previous dataset */
+    fox_dataset_file (wl, file);
+    unlink (file);
+
+    if (fox_prep_vblks (wl, NULL))
+        goto STRIPE;
+
+    if (wl->w_factor == 0)
+        fox_dataset_save (wl);
 
     return 0;
+
+STRIPE:
+    free (wl->stripe_lun);
+    wl->stripe_lun = NULL;
+FREE:
+    free (wl->vblks);
+    wl->vblks = NULL;
+    return -1;
 }
 
 void fox_free_vblks (struct fox_workload *wl)
@@ -147,4 +684,5 @@ void fox_free_vblks (struct fox_workload *wl)
         prov_vblk_put(wl->vblks[blk_i]);
 
     free (wl->vblks);
+    free (wl->stripe_lun);
 }
\ No newline at end of file
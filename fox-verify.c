@@ -0,0 +1,187 @@
+/*  - FOX - A tool for testing Open-Channel SSDs
+ *      - Read verification
+ *
+ * Copyright (C) 2016, IT University of Copenhagen. All rights reserved.
+ * Written by Ivan Luiz Picoli <ivpi@itu.dk>
+ *
+ * Funding support provided by CAPES Foundation, Ministry of Education
+ * of Brazil, Brasilia - DF 70040-020, Brazil.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* With -m, completed reads are handed to a pool of --verifiers threads.
+ * The node swaps the slot buffer with the one of a free job and goes on
+ * issuing, while a verifier regenerates the expected data, compares it and
+ * dumps mismatches. Finished jobs are queued back to the node and reaped
+ * with the command completions, so statistics and trace rows keep a single
+ * writer. A node has 'iodepth' jobs, if all of them are being verified the
+ * node waits for one. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "fox.h"
+
+static void fox_verify_job (struct fox_vjob *job, uint8_t *exp)
+{
+    struct fox_node *node = job->node;
+    char filename[64];
+    size_t off = 0;
+
+    job->cmp = fox_wb_cmp (node->wl, job->iter, job->buf, exp, job->count,
+                                                            job->ppa, &off);
+    if (job->cmp) {
+        snprintf (filename, sizeof (filename), "c%dl%db%dp%d-seq%d",
+                job->row.ch, job->row.lun, job->pblk, job->row.pg, job->npgs);
+        fox_flush_corruption (filename, exp, job->buf, job->count, off);
+    }
+
+    pthread_mutex_lock (&node->ioq->q_mutex);
+    TAILQ_INSERT_TAIL (&node->ioq->vdone_head, job, entry);
+    pthread_cond_signal (&node->ioq->q_cond);
+    pthread_mutex_unlock (&node->ioq->q_mutex);
+}
+
+static void *fox_verify_th (void *arg)
+{
+    struct fox_verifier *th = arg;
+    struct fox_verify *v = th->v;
+    struct fox_vjob *job;
+
+    pthread_mutex_lock (&v->mutex);
+
+    while (1) {
+        while (TAILQ_EMPTY (&v->head) && !v->stop)
+            pthread_cond_wait (&v->cond, &v->mutex);
+
+        if (TAILQ_EMPTY (&v->head))
+            break;
+
+        job = TAILQ_FIRST (&v->head);
+        TAILQ_REMOVE (&v->head, job, entry);
+        pthread_mutex_unlock (&v->mutex);
+
+        fox_verify_job (job, th->exp);
+
+        pthread_mutex_lock (&v->mutex);
+    }
+
+    pthread_mutex_unlock (&v->mutex);
+
+    return NULL;
+}
+
+void fox_verify_submit (struct fox_verify *v, struct fox_vjob *job)
+{
+    pthread_mutex_lock (&v->mutex);
+    TAILQ_INSERT_TAIL (&v->head, job, entry);
+    pthread_cond_signal (&v->cond);
+    pthread_mutex_unlock (&v->mutex);
+}
+
+int fox_verify_init (struct fox_workload *wl)
+{
+    struct fox_verify *v;
+    size_t cmd_sz = wl->nppas * wl->geo->sector_nbytes;
+    int i;
+
+    wl->verify = NULL;
+    if (!wl->memcmp || !wl->verifiers)
+        return 0;
+
+    v = calloc (1, sizeof (struct fox_verify));
+    if (!v)
+        return -1;
+
+    v->th = calloc (wl->verifiers, sizeof (struct fox_verifier));
+    if (!v->th)
+        goto FREE_V;
+
+    for (i = 0; i < wl->verifiers; i++) {
+        v->th[i].v = v;
+        v->th[i].exp = aligned_alloc (wl->geo->sector_nbytes, cmd_sz);
+        if (!v->th[i].exp)
+            goto FREE_EXP;
+    }
+
+    TAILQ_INIT (&v->head);
+    pthread_mutex_init (&v->mutex, NULL);
+    pthread_cond_init (&v->cond, NULL);
+
+    for (i = 0; i < wl->verifiers; i++) {
+        if (pthread_create (&v->th[i].tid, NULL, fox_verify_th, &v->th[i])) {
+            printf (" [fox-verify: ERROR. Verifier thread not created.]\n");
+            pthread_mutex_lock (&v->mutex);
+            v->stop = 1;
+            pthread_cond_broadcast (&v->cond);
+            pthread_mutex_unlock (&v->mutex);
+            goto JOIN;
+        }
+        v->nthreads++;
+    }
+
+    wl->verify = v;
+
+    return 0;
+
+JOIN:
+    for (i = 0; i < v->nthreads; i++)
+        pthread_join (v->th[i].tid, NULL);
+    pthread_mutex_destroy (&v->mutex);
+    pthread_cond_destroy (&v->cond);
+    i = wl->verifiers;
+FREE_EXP:
+    while (i--)
+        free (v->th[i].exp);
+    free (v->th);
+FREE_V:
+    free (v);
+    return -1;
+}
+
+/* Nodes drain their jobs before exiting, the queue is empty here */
+void fox_verify_exit (struct fox_workload *wl)
+{
+    struct fox_verify *v = wl->verify;
+    int i;
+
+    if (!v)
+        return;
+
+    pthread_mutex_lock (&v->mutex);
+    v->stop = 1;
+    pthread_cond_broadcast (&v->cond);
+    pthread_mutex_unlock (&v->mutex);
+
+    for (i = 0; i < v->nthreads; i++)
+        pthread_join (v->th[i].tid, NULL);
+
+    for (i = 0; i < wl->verifiers; i++)
+        free (v->th[i].exp);
+    free (v->th);
+    pthread_mutex_destroy (&v->mutex);
+    pthread_cond_destroy (&v->cond);
+    free (v);
+    wl->verify = NULL;
+}
@@ -37,12 +37,14 @@
 
 #define AND64 0xffffffffffffffff
 #define SEC64 (1000000 & AND64)
+#define NSEC64 (1000000000 & AND64)
 
 #define FOX_ENGINE_1  0x1 /* All sequential */
 #define FOX_ENGINE_2  0x2 /* All round-robin */
 #define FOX_ENGINE_3  0x3 /* I/O Isolation */
 
 #define PROV_NBLK_PER_VBLK 0x1
+#define PROV_NBLK_MAX      128  /* blocks of a striped vblk, nvm_vblk blks */
 
 enum {
     FOX_STATS_ERASE_T = 0x1,
@@ -55,19 +57,31 @@ enum {
     FOX_STATS_PGS_R,
     FOX_STATS_BREAD,
     FOX_STATS_BWRITTEN,
-    FOX_STATS_BRW_SEC,
     FOX_STATS_IOPS,
     FOX_STATS_FAIL_CMP,
     FOX_STATS_FAIL_E,
     FOX_STATS_FAIL_R,
-    FOX_STATS_FAIL_W
+    FOX_STATS_FAIL_W,
+    FOX_STATS_QUEUE_T,
+    FOX_STATS_ERASE_IO
 };
 
+/* Latency histograms kept per node and operation */
+enum {
+    FOX_HIST_READ = 0x0,
+    FOX_HIST_WRITE,
+    FOX_HIST_ERASE,
+    FOX_HIST_QUEUE,     /* open-loop: intended to actual issue time */
+    FOX_HIST_OPS
+};
+
+#define FOX_HIST_MAX        (3600 * NSEC64) /* 1 hour, in n-sec */
+
 #define FOX_FLAG_READY      (1 << 0)
 #define FOX_FLAG_DONE       (1 << 1)
 #define FOX_FLAG_MONITOR    (1 << 2)
 
-#define CMDARG_LEN          32
+#define CMDARG_LEN          256
 #define CMDARG_FLAG_D       (1 << 0)
 #define CMDARG_FLAG_T       (1 << 1)
 #define CMDARG_FLAG_C       (1 << 2)
@@ -82,9 +96,39 @@ enum {
 #define CMDARG_FLAG_M       (1 << 11)
 #define CMDARG_FLAG_O       (1 << 12)
 #define CMDARG_FLAG_E       (1 << 13)
+#define CMDARG_FLAG_Q       (1 << 14)
+#define CMDARG_FLAG_H       (1 << 15)
+
+/* Long only options */
+enum {
+    CMDARG_OPT_RATE_IOPS = 0x100,
+    CMDARG_OPT_RATE_BW,
+    CMDARG_OPT_RATE_JOB,
+    CMDARG_OPT_ARRIVAL,
+    CMDARG_OPT_SEED,
+    CMDARG_OPT_COMPRESS,
+    CMDARG_OPT_DEDUP,
+    CMDARG_OPT_VERIFIERS,
+    CMDARG_OPT_REFRESH_BBT,
+    CMDARG_OPT_BBT_AGE,
+    CMDARG_OPT_PREFILL,
+    CMDARG_OPT_ERASE_DEPTH,
+    CMDARG_OPT_ROTATE,
+    CMDARG_OPT_WEAR,
+    CMDARG_OPT_STRIPE
+};
+
+/* I/O arrival. Closed-loop issues the next command when a slot is free,
+ * open-loop follows a schedule at --rate-iops */
+enum {
+    FOX_ARRIVAL_CLOSED  = 0x0,
+    FOX_ARRIVAL_CONST   = 0x1,
+    FOX_ARRIVAL_POISSON = 0x2
+};
 
 #define FOX_RUN_MODE         0x0
 #define FOX_IO_MODE          0x1
+#define FOX_TRACE_MODE       0x2
 
 #define WB_GEO_FILL         0x1
 #define WB_GEO_CMP          0x2
@@ -96,11 +140,13 @@ enum {
     WB_GEOMETRY = 0x3
 };
 
+
 enum cmdtypes {
     CMDARG_RUN      = 1,
     CMDARG_ERASE    = 2,
     CMDARG_WRITE    = 3,
-    CMDARG_READ     = 4
+    CMDARG_READ     = 4,
+    CMDARG_TRACE    = 5
 };
 
 struct fox_argp
@@ -125,6 +171,27 @@ struct fox_argp
     uint8_t     memcmp;
     uint8_t     output;
     uint32_t    engine;
+    uint16_t    iodepth;
+    uint8_t     hlog;
+    uint64_t    rate_iops;
+    uint32_t    rate_bw;    /* MB/s */
+    uint8_t     rate_job;
+    uint8_t     arrival;
+    uint64_t    seed;
+    uint8_t     seed_set;
+    double      compress;
+    uint8_t     dedup;      /* percent */
+    uint8_t     verifiers;
+    uint8_t     verifiers_set;
+    uint8_t     refresh_bbt;
+    uint32_t    bbt_age;    /* seconds */
+    uint8_t     bbt_age_set;
+    uint8_t     prefill;
+    uint16_t    erase_depth;
+    uint8_t     erase_depth_set;
+    uint8_t     rotate;
+    uint8_t     wear;
+    uint8_t     stripe;
 
     /* r/w/e parameters */
     uint8_t     io_ch;
@@ -135,6 +202,10 @@ struct fox_argp
     uint8_t     io_random;
     uint8_t     io_verb;
     uint8_t     io_out;
+
+    /* trace parameters */
+    char        trace_file[CMDARG_LEN];
+    uint8_t     trace_out;
 };
 
 struct fox_node;
@@ -160,22 +231,36 @@ struct fox_engine {
     LIST_ENTRY(fox_engine)  entry;
 };
 
+struct fox_hist {
+    uint64_t        total;
+    uint64_t        min;
+    uint64_t        max;
+    uint64_t        highest;    /* highest trackable value */
+    uint32_t        ncounts;
+    uint64_t        *counts;
+};
+
+/* Node statistics have a single writer, the node thread. Counters are
+ * published with relaxed atomic stores and the monitor reads them without
+ * locking. Aligned to a cache line so nodes do not share lines. */
+#define FOX_CACHE_LINE  64
+
 struct fox_stats {
-    struct timeval  tval;
-    struct timeval  tval_tmp;
+    uint64_t        tstart;     /* n-sec, monotonic */
     uint64_t        runtime;
-    uint64_t        rw_sect; /* r/w time in the last second */
+    uint64_t        rw_sect; /* accumulated r/w busy time */
     uint64_t        read_t;
     uint64_t        write_t;
     uint64_t        erase_t;
+    uint64_t        queue_t;
+    uint64_t        erase_io_t; /* commands overlapping a background erase */
+    uint32_t        erase_io;
     uint32_t        erased_blks;
     uint32_t        pgs_r;
     uint32_t        pgs_w;
     uint32_t        io_count;
     uint64_t        bread;
     uint64_t        bwritten;
-    uint64_t        brw_sec; /* transferred bytes in the last second */
-    uint32_t        iops;
     uint16_t        progress;
     uint32_t        pgs_done;
     uint32_t        fail_cmp;
@@ -183,7 +268,26 @@ struct fox_stats {
     uint32_t        fail_w;
     uint32_t        fail_r;
     uint8_t         flags;
-    pthread_mutex_t s_mutex;
+    struct fox_hist hist[FOX_HIST_OPS];
+} __attribute__ ((aligned (FOX_CACHE_LINE)));
+
+/* Token buckets, tat is the next start time in n-sec */
+struct fox_rate {
+    uint64_t        iops;
+    uint64_t        bw;
+    uint64_t        iops_tat;
+    uint64_t        bw_tat;
+} __attribute__ ((aligned (FOX_CACHE_LINE)));
+
+/* Open-loop schedule of a node */
+struct fox_arrival {
+    uint64_t        next;       /* n-sec */
+    uint64_t        interval;   /* mean, n-sec */
+};
+
+/* xoshiro256** state, one stream per node derived from the workload seed */
+struct fox_prng {
+    uint64_t        s[4];
 };
 
 struct fox_workload {
@@ -198,7 +302,26 @@ struct fox_workload {
     uint16_t                nppas;
     uint32_t                max_delay;
     uint8_t                 memcmp;
+    uint64_t                seed;     /* data and arrival generators */
+    double                  compress; /* target compression ratio */
+    uint8_t                 dedup;    /* percent of duplicated sectors */
+    uint8_t                 *wb_tpl;  /* data profile templates */
+    uint8_t                 verifiers; /* 0: reads verified by the jobs */
+    struct fox_verify       *verify;
+    uint8_t                 prefill;  /* do not reuse a prepared dataset */
+    uint16_t                erase_depth; /* 0: erase all when a pass ends */
+    uint8_t                 rotate;   /* new blocks from the pool each pass */
+    uint8_t                 wear;     /* PROV_WEAR_* */
+    uint8_t                 stripe;   /* physical blocks per vblk */
+    uint16_t                *stripe_lun; /* next LUN of the job, by LUN */
     uint8_t                 output;
+    uint16_t                iodepth;
+    uint8_t                 hlog;
+    uint64_t                rate_iops;
+    uint64_t                rate_bw; /* bytes per second */
+    uint8_t                 rate_job; /* limits apply to each job */
+    uint8_t                 arrival;
+    struct fox_rate         *rate;
     uint64_t                runtime; /* seconds */
     struct fox_engine       *engine;
     struct nvm_dev          *dev;
@@ -211,11 +334,21 @@ struct fox_workload {
     pthread_cond_t          monitor_con;
 };
 
-struct fox_blkbuf {
-    uint8_t     *buf_w;
-    uint8_t     *buf_r;
+/* Asynchronous backend command. 'done' is called when the command completes,
+ * possibly from another thread */
+struct prov_io {
+    uint8_t             type;
+    struct nvm_vblk     *vblk;
+    void                *buf;
+    size_t              count;
+    size_t              offset;
+    ssize_t             ret;
+    void                (*done)(struct prov_io *);
+    void                *ctx;
+    TAILQ_ENTRY(prov_io) entry;
 };
 
+
 struct fox_tgt_blk {
     struct nvm_vblk    *vblk;
     uint16_t           ch;
@@ -223,6 +356,148 @@ struct fox_tgt_blk {
     uint32_t           blk;
 };
 
+/* A command issued by a node. With iodepth > 1, up to 'iodepth' commands
+ * are kept in flight per node and completed when reaped by the node */
+struct fox_io {
+    struct prov_io      pio;
+    struct fox_tgt_blk  tgt;
+    uint8_t             *buf;       /* one command, owned by the slot */
+    uint16_t            pg;
+    uint16_t            npgs;
+    uint64_t            tsched;     /* intended issue time */
+    uint64_t            tstart;
+    uint64_t            tend;
+    uint8_t             erasing;    /* background erase in flight */
+    TAILQ_ENTRY(fox_io) entry;
+};
+
+struct fox_output_row {
+    uint64_t    node_seq;
+    uint16_t    tid;
+    uint16_t    ch;
+    uint16_t    lun;
+    uint32_t    blk;
+    uint32_t    pg;
+    uint64_t    tstart;
+    uint64_t    tend;
+    uint32_t    ulat;
+    uint32_t    qdelay;
+    char        type;
+    uint8_t     failed;
+    uint8_t     datacmp;
+    uint32_t    size;
+};
+
+/* A read handed to the verifier pool. The job owns a command buffer that
+ * is swapped with the one of the completed slot, so the slot is reused at
+ * once while the data is checked. The result goes back to the node, which
+ * accounts it and writes the trace row */
+struct fox_vjob {
+    struct fox_node         *node;
+    uint8_t                 *buf;
+    size_t                  count;
+    struct nvm_addr         ppa;
+    uint32_t                iter;
+    uint32_t                pblk;
+    uint16_t                npgs;
+    int                     cmp;
+    struct fox_output_row   row;
+    TAILQ_ENTRY(fox_vjob)   entry;
+};
+
+/* Background erases, blocks are erased in write order during the next pass */
+#define FOX_ERASE_DEPTH     2       /* default erases in flight per job */
+#define FOX_EBLK_DIRTY      0x1
+#define FOX_EBLK_ERASING    0x2
+
+/* Commands to the block of a node slot since the block was taken, n-sec */
+struct fox_lat {
+    uint32_t            n;
+    uint64_t            t;
+    uint64_t            max;
+};
+
+/* Block of a node slot. A failed write or erase sets 'bad' ('w' or 'e'),
+ * the block is retired once no command targets it. A block kept for lack
+ * of spares is not flagged again */
+#define FOX_BAD_KEPT        'k'
+
+struct fox_blk_hist {
+    uint32_t            wp;         /* pages written in this pass */
+    char                bad;
+    uint32_t            fail_pg;    /* failed command */
+    uint32_t            fail_npgs;
+    uint64_t            fail_t;
+    uint64_t            tfail;      /* since the node started */
+    struct fox_lat      w;
+    struct fox_lat      r;
+    struct fox_lat      e;
+};
+
+/* A block marked bad during the run. 'spare' is set if the slot got a new
+ * block, otherwise the slot keeps using it */
+struct fox_retired {
+    struct nvm_addr     addr;
+    uint16_t            ch;         /* workload slot */
+    uint16_t            lun;
+    uint32_t            blk;
+    uint8_t             spare;
+    uint32_t            erases;     /* as in struct prov_wear */
+    uint32_t            run;
+    uint32_t            last_us;
+    struct fox_blk_hist hist;
+    TAILQ_ENTRY(fox_retired) entry;
+};
+
+struct fox_ioq {
+    uint16_t            depth;
+    uint16_t            inflight;
+    uint16_t            verifying;
+    uint16_t            edepth;
+    uint16_t            erasing;
+    uint32_t            eblks;
+    uint32_t            enext;      /* next dirty block in write order */
+    uint32_t            ndirty;
+    uint8_t             *eblk;      /* FOX_EBLK_* state per node block */
+    struct nvm_vblk     **evblks;   /* erase batch with erase depth 0 */
+    int                 *eerr;
+    uint64_t            *ens;
+    struct fox_blk_hist *bhist;     /* per node block */
+    uint32_t            nbad;       /* blocks to be retired */
+    uint32_t            nremap;
+    uint32_t            nlost;      /* retired, missing from the report */
+    struct fox_io       *eios;
+    uint64_t            busy_end; /* end of the last accounted busy time */
+    struct fox_io       *ios;
+    struct fox_vjob     *vjobs;
+    uint8_t             *exp;       /* expected data for read compare */
+    pthread_mutex_t     q_mutex;
+    pthread_cond_t      q_cond;
+    TAILQ_HEAD(io_free_list, fox_io) free_head;
+    TAILQ_HEAD(io_cmpl_list, fox_io) cmpl_head;
+    TAILQ_HEAD(vjob_free_list, fox_vjob) vfree_head;
+    TAILQ_HEAD(vjob_done_list, fox_vjob) vdone_head;
+    TAILQ_HEAD(io_efree_list, fox_io) efree_head;
+    TAILQ_HEAD(retired_list, fox_retired) retired_head;
+};
+
+/* Verifier thread and its scratch buffer */
+struct fox_verifier {
+    pthread_t           tid;
+    struct fox_verify   *v;
+    uint8_t             *exp;
+};
+
+/* Verifier threads, shared by all nodes */
+struct fox_verify {
+    uint8_t             nthreads;
+    uint8_t             stop;
+    struct fox_verifier *th;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+    TAILQ_HEAD(vjob_list, fox_vjob) head;
+};
+
 struct fox_node {
     uint8_t             nid;
     uint8_t             nchs;
@@ -233,11 +508,16 @@ struct fox_node {
     uint8_t             *lun;
     uint8_t             *blk;
     uint32_t            delay;
+    uint32_t            iter;       /* passes over the blocks (erases) */
     pthread_t           tid;
     struct fox_workload *wl;
     struct fox_stats    stats;
     struct fox_tgt_blk  vblk_tgt;
     struct fox_engine   *engine;
+    struct fox_ioq      *ioq;
+    struct fox_rate     *rate;
+    struct fox_arrival  arrival;
+    struct fox_prng     prng;
     LIST_ENTRY(fox_node) entry;
 };
 
@@ -246,44 +526,115 @@ struct fox_output_row_rt {
     uint16_t    nid;
     long double thpt;
     long double iops;
-    struct fox_stats                stats;
     TAILQ_ENTRY(fox_output_row_rt)  entry;
 };
 
-struct fox_output_row {
-    uint64_t    seq;
-    uint64_t    node_seq;
-    uint16_t    tid;
-    uint16_t    ch;
-    uint16_t    lun;
+/* Binary per-IO trace (fox_io.bin). Little-endian, a header followed by
+ * fixed-size records in the order they were drained from the node rings.
+ * Times are monotonic n-seconds; twall is the wall clock at tbase. Start
+ * times are deltas from the previous record (the first one from tbase).
+ * If a delta does not fit 32 bits a FOX_TRACE_SYNC record carrying the
+ * absolute start time (blk: high, pg: low 32 bits) is written first. */
+#define FOX_TRACE_MAGIC     0x4543415254584f46 /* "FOXTRACE" */
+#define FOX_TRACE_VERSION   0x4
+#define FOX_TRACE_SYNC      'S'
+
+#define FOX_TRACE_CSV       (1 << 0)
+#define FOX_TRACE_LUN       (1 << 1)
+#define FOX_TRACE_PCT       (1 << 2)
+
+struct fox_trace_hdr {
+    uint64_t    magic;
+    uint16_t    version;
+    uint16_t    hdr_sz;
+    uint16_t    rec_sz;
+    uint16_t    rsvd;
+    uint64_t    tbase;      /* n-sec, monotonic */
+    uint64_t    twall;      /* n-sec since epoch at tbase */
+    uint64_t    runtime;
+    /* device geometry */
+    uint32_t    nchannels;
+    uint32_t    nluns;
+    uint32_t    nplanes;
+    uint32_t    nblocks;
+    uint32_t    npages;
+    uint32_t    nsectors;
+    uint32_t    sector_nbytes;
+    uint32_t    page_nbytes;
+    /* workload */
+    uint32_t    blks;
+    uint32_t    pgs;
+    uint32_t    max_delay;
+    uint32_t    engine;
+    uint16_t    nthreads;
+    uint16_t    channels;
+    uint16_t    luns;
+    uint16_t    w_factor;
+    uint16_t    r_factor;
+    uint16_t    nppas;
+    uint16_t    iodepth;
+    uint8_t     memcmp;
+    uint8_t     arrival;
+    uint64_t    seed;
+    char        devname[CMDARG_LEN];
+} __attribute__ ((packed));
+
+struct fox_trace_rec {
+    int32_t     tdelta;     /* start time - previous start time (n-sec) */
+    uint32_t    ulat;       /* n-sec, saturates at ~4.29 sec */
+    uint32_t    qdelay;     /* open-loop: start to actual issue (n-sec) */
+    uint32_t    node_seq;   /* lower 32 bits */
     uint32_t    blk;
     uint32_t    pg;
-    uint64_t    tstart;
-    uint64_t    tend;
-    uint32_t    ulat;
+    uint32_t    size;
+    uint16_t    tid;
+    uint8_t     ch;
+    uint8_t     lun;
     char        type;
     uint8_t     failed;
     uint8_t     datacmp;
-    uint32_t    size;
-    TAILQ_ENTRY(fox_output_row) entry;
-};
+    uint8_t     rsvd;
+} __attribute__ ((packed));
 
 /* Provisioning */
 
+#define PROV_BBT_MAX_AGE    86400   /* seconds a cached BBT is used */
+
+/* Choice of the next free block of a LUN (--wear) */
+enum {
+    PROV_WEAR_FIFO = 0x0,   /* shuffled at start, put blocks go last */
+    PROV_WEAR_LEAST,
+    PROV_WEAR_MOST,
+    PROV_WEAR_RANDOM
+};
+
+struct prov_wear {
+    uint32_t                erases;     /* device life, kept under ./wear */
+    uint32_t                run;
+    uint32_t                last_us;    /* latency of the last erase */
+};
+
 struct prov_vblk{
     struct nvm_addr         addr;
     struct nvm_vblk         *blk;
     uint8_t                 *state;
-    CIRCLEQ_ENTRY(prov_vblk)   entry;
+    uint32_t                used_idx;   /* position in the used pool */
+    uint32_t                free_idx;   /* position in the free ring */
 };
 
+/* Block pools of a LUN. Free blocks are a FIFO ring, shuffled when the LUN
+ * is created, so blocks are handed out in random order and put blocks go
+ * to the tail. Used blocks are an unordered array. Get and put are O(1) */
 struct prov_lun {
     struct nvm_addr         addr;
     uint32_t                nfree_blks;
     uint32_t                nused_blks;
+    uint32_t                free_head;
+    unsigned int            seed;       /* shuffle of the free ring */
+    uint64_t                init_ns;    /* BBT load and pool setup */
     pthread_mutex_t         l_mutex;
-    CIRCLEQ_HEAD(free_blk_list, prov_vblk) free_blk_head;
-    CIRCLEQ_HEAD(used_blk_list, prov_vblk) used_blk_head;
+    struct prov_vblk        **free_blks;
+    struct prov_vblk        **used_blks;
 };
 
 struct prov_v_dev {
@@ -293,10 +644,55 @@ struct prov_v_dev {
     struct prov_vblk        **prov_vblks;
 };
 
+/* A storage backend implements the device operations used by the
+ * provisioning wrappers. The device handle is opaque to FOX, each backend
+ * may keep its own structure behind 'struct nvm_dev *'. The backend is
+ * selected by the device name prefix, e.g: "emu:/tmp/img?ch=8&lun=4".
+ * A backend with no prefix is the default one. */
+
+typedef struct nvm_dev *(fprov_dev_open)(const char *);
+typedef void (fprov_dev_close)(struct nvm_dev *);
+typedef const struct nvm_geo *(fprov_get_geo)(struct nvm_dev *);
+typedef const struct nvm_bbt *(fprov_get_bbt)(struct nvm_dev *,
+                                            struct nvm_addr, struct nvm_ret *);
+typedef int (fprov_bbt_mark)(struct nvm_dev *, struct nvm_addr *, int,
+                                                  uint16_t, struct nvm_ret *);
+typedef int (fprov_set_meta_mode)(struct nvm_dev *, int);
+typedef struct nvm_vblk *(fprov_vblk_alloc)(struct nvm_dev *,
+                                                      struct nvm_addr *, int);
+typedef void (fprov_vblk_free)(struct nvm_vblk *);
+typedef ssize_t (fprov_vblk_pread)(struct nvm_vblk *, void *, size_t, size_t);
+typedef ssize_t (fprov_vblk_pwrite)(struct nvm_vblk *, const void *, size_t,
+                                                                      size_t);
+typedef ssize_t (fprov_vblk_erase)(struct nvm_vblk *);
+typedef int (fprov_vblk_erase_v)(struct nvm_vblk **, int, int *,
+                                                                uint64_t *);
+typedef int (fprov_vblk_submit)(struct prov_io *);
+
+struct prov_backend {
+    char                    *name;
+    char                    *prefix;
+    fprov_dev_open          *dev_open;
+    fprov_dev_close         *dev_close;
+    fprov_get_geo           *get_geo;
+    fprov_get_bbt           *get_bbt;
+    fprov_bbt_mark          *bbt_mark;
+    fprov_set_meta_mode     *set_meta_mode;
+    fprov_vblk_alloc        *vblk_alloc;
+    fprov_vblk_free         *vblk_free;
+    fprov_vblk_pread        *vblk_pread;
+    fprov_vblk_pwrite       *vblk_pwrite;
+    fprov_vblk_erase        *vblk_erase;
+    fprov_vblk_erase_v      *vblk_erase_v; /* NULL if one vblk per call */
+    fprov_vblk_submit       *vblk_submit; /* NULL if synchronous only */
+    LIST_ENTRY(prov_backend) entry;
+};
+
 /* End Provisioning */
 
 #define FOX_READ    0x1
 #define FOX_WRITE   0x2
+#define FOX_ERASE   0x3
 
 /* A workload is a set of parameters that defines the experiment behavior.
  * Check 'struct fox_workload'
@@ -348,8 +744,9 @@ void             fox_set_stats (uint8_t, struct fox_stats *, int64_t);
 void             fox_start_node (struct fox_node *);
 void             fox_end_node (struct fox_node *);
 void             fox_timestamp_start (struct fox_stats *);
-uint64_t         fox_timestamp_tmp_start (struct fox_stats *);
-uint64_t         fox_timestamp_end (uint8_t, struct fox_stats *);
+uint64_t         fox_timestamp_end (struct fox_stats *);
+uint64_t         fox_timestamp_now (void);
+uint64_t         fox_timestamp_wall (void);
 void             fox_show_stats (struct fox_workload *, struct fox_node *);
 void             fox_show_workload (struct fox_workload *);
 void             fox_set_progress (struct fox_stats *, uint16_t);
@@ -358,25 +755,61 @@ void             fox_exit_stats (struct fox_stats *);
 void             fox_wait_for_ready (struct fox_workload *);
 void             fox_wait_for_monitor (struct fox_workload *);
 int              fox_mio_init (struct fox_argp *);
+int              fox_trace_init (struct fox_argp *);
+
+/* fox-hist */
+int              fox_hist_init (struct fox_hist *, uint64_t);
+void             fox_hist_exit (struct fox_hist *);
+void             fox_hist_record (struct fox_hist *, uint64_t);
+void             fox_hist_merge (struct fox_hist *, struct fox_hist *);
+uint64_t         fox_hist_min (struct fox_hist *);
+uint64_t         fox_hist_percentile (struct fox_hist *, double);
+char            *fox_hist_encode (struct fox_hist *);
+
+/* fox-rate */
+int              fox_rate_init (struct fox_workload *);
+void             fox_rate_exit (struct fox_workload *);
+void             fox_rate_pace (struct fox_node *, size_t);
+uint64_t         fox_rate_next (struct fox_node *, size_t);
+void             fox_rate_wait (uint64_t);
+void             fox_arrival_init (struct fox_node *);
+uint64_t         fox_arrival_wait (struct fox_node *);
+
+/* fox-verify */
+int              fox_verify_init (struct fox_workload *);
+void             fox_verify_exit (struct fox_workload *);
+void             fox_verify_submit (struct fox_verify *, struct fox_vjob *);
 
 /* fox-vblk */
-int              fox_alloc_vblks (struct fox_workload *);
+int              fox_alloc_vblks (struct fox_workload *, struct fox_node *);
 void             fox_free_vblks (struct fox_workload *);
 int              fox_vblk_tgt (struct fox_node *, uint16_t, uint16_t, uint32_t);
 uint32_t         fox_vblk_get_pblk (struct fox_workload *, uint16_t,
                                                             uint16_t, uint32_t);
+struct nvm_vblk *fox_vblk_stripe (struct fox_workload *, uint16_t, uint16_t,
+                                            uint8_t, const struct nvm_addr *);
 
 /* fox-buf */
-int              fox_alloc_blk_buf (struct fox_node *, struct fox_blkbuf *);
-void 		 fox_wb_random (uint8_t *, size_t);
+void 		 fox_wb_random (uint8_t *, size_t, uint64_t);
 int              fox_wb_geo (uint8_t *, size_t, const struct nvm_geo *,
                                                       struct nvm_addr, uint8_t);
 void             fox_wb_readable(char *, int, const struct nvm_geo *,
-                                                               struct nvm_addr);
-void             fox_blkbuf_reset (struct fox_node *, struct fox_blkbuf *);
-void             fox_free_blkbuf (struct fox_blkbuf *, int);
-int              fox_blkbuf_cmp (struct fox_node *, struct fox_blkbuf *,
-                                         uint16_t, uint16_t, struct nvm_vblk *);
+                                                     struct nvm_addr, uint64_t);
+void             fox_prng_init (struct fox_prng *, uint64_t, uint64_t);
+int              fox_wb_profile_init (struct fox_workload *);
+void             fox_wb_profile_exit (struct fox_workload *);
+uint64_t         fox_prng_next (struct fox_prng *);
+void             fox_wb_fill (struct fox_workload *, uint32_t, uint8_t *,
+                                                    size_t, struct nvm_addr);
+int              fox_wb_cmp (struct fox_workload *, uint32_t, const uint8_t *,
+                                  uint8_t *, size_t, struct nvm_addr, size_t *);
+
+/* fox-simd */
+void             fox_simd_init (void);
+const char      *fox_simd_name (void);
+void             fox_simd_geo_fill (uint8_t *, size_t, uint64_t, uint64_t);
+ssize_t          fox_simd_geo_cmp (const uint8_t *, size_t, uint64_t,
+                                                                    uint64_t);
 
 /* fox-output */
 int              fox_output_init (struct fox_workload *);
@@ -385,9 +818,12 @@ void             fox_output_append (struct fox_output_row *, int);
 void             fox_output_append_rt(struct fox_output_row_rt *, uint16_t);
 void             fox_output_flush (void);
 void             fox_output_flush_rt (void);
+void             fox_output_trace_stats (uint64_t *, uint64_t *);
 void             fox_print (char *, uint8_t);
-void             fox_flush_corruption (char *, void *, void *, size_t);
-struct fox_output_row       *fox_output_new (void);
+void             fox_print_meta (char *);
+int              fox_flush_corruption (char *, void *, void *, size_t,
+                                                                    size_t);
+int              fox_output_hlog (struct fox_workload *, struct fox_node *);
 struct fox_output_row_rt    *fox_output_new_rt (void);
 
 /* fox-rw */
@@ -397,12 +833,14 @@ int    fox_iterator_next (struct fox_rw_iterator *, uint8_t);
 void   fox_iterator_free (struct fox_rw_iterator *);
 struct fox_rw_iterator *fox_iterator_new (struct fox_node *);
 int    fox_erase_all_vblks (struct fox_node *);
-int    fox_erase_blk (struct fox_tgt_blk *, struct fox_node *);
-int    fox_read_blk (struct fox_tgt_blk *, struct fox_node *,
-                                      struct fox_blkbuf *, uint16_t, uint16_t);
-int    fox_write_blk (struct fox_tgt_blk *, struct fox_node *,
-                                      struct fox_blkbuf *, uint16_t, uint16_t);
+int    fox_read_blk (struct fox_tgt_blk *, struct fox_node *, uint16_t,
+                                                                    uint16_t);
+int    fox_write_blk (struct fox_tgt_blk *, struct fox_node *, uint16_t,
+                                                                    uint16_t);
 int    fox_update_runtime (struct fox_node *);
+int    fox_ioq_init (struct fox_node *);
+void   fox_ioq_exit (struct fox_node *);
+void   fox_ioq_drain (struct fox_node *);
 double fox_check_progress_runtime (struct fox_node *);
 double fox_check_progress_pgs (struct fox_node *);
 
@@ -416,14 +854,21 @@ int                  foxeng_iso_init (struct fox_workload *);
 /* provisioning */
 int     prov_init(struct nvm_dev *dev, const struct nvm_geo *geo);
 int     prov_exit (void);
+void    prov_init_time (uint64_t *, uint64_t *, int *);
+uint64_t prov_lun_init_time (int);
+void    prov_bbt_cache_set(uint8_t refresh, uint32_t max_age);
+uint8_t prov_bbt_cached(void);
+uint32_t prov_bbt_grown(void);
 int 	prov_vblk_list_create(int lun);
 int 	prov_vblk_list_free(int lun);
-int 	prov_vblk_alloc(const struct nvm_bbt *bbt, int lun, int blk);
+int 	prov_vblk_alloc(const uint8_t *bbt, int lun, int blk);
 int 	prov_vblk_free(int lun, int blk);
 
 struct prov_vblk *prov_vblk_rand(int lun);
 struct nvm_dev   *prov_dev_open(const char *dev_path);
 void    	  prov_dev_close(struct nvm_dev *dev);
+int               prov_dev_set_meta_mode(struct nvm_dev *dev, int mode);
+const char       *prov_backend_name(void);
 
 const struct nvm_geo *prov_get_geo(struct nvm_dev *dev);
 const struct nvm_bbt *prov_get_bbt(struct nvm_dev *dev,
@@ -433,10 +878,31 @@ ssize_t prov_vblk_pread(struct nvm_vblk *vblk, void *buf, size_t count,
 ssize_t prov_vblk_pwrite(struct nvm_vblk *vblk, const void *buf,
                                                   size_t count, size_t offset);
 ssize_t prov_vblk_erase(struct nvm_vblk *vblk);
+int     prov_vblk_erase_v(struct nvm_vblk **vblks, int n, int *err,
+                                                                uint64_t *ns);
+struct nvm_vblk *prov_vblk_new(struct nvm_dev *dev, struct nvm_addr *addrs,
+                                                                  int naddrs);
+void    prov_vblk_destroy(struct nvm_vblk *vblk);
+int     prov_io_init(int nworkers);
+void    prov_io_exit(void);
+int     prov_io_submit(struct prov_io *io);
 
 struct nvm_vblk	*prov_vblk_get(int ch, int lun);
+struct nvm_vblk	*prov_vblk_claim(int ch, int lun, int blk);
+struct nvm_vblk	*prov_vblk_next(int ch, int lun);
+void    prov_wear_policy_set(uint8_t policy);
+void    prov_vblk_wear_add(struct nvm_vblk *vblk, uint64_t ns);
+int     prov_vblk_wear(int ch, int lun, int blk, struct prov_wear *w);
 int    	prov_vblk_put(struct nvm_vblk *vblk);
+struct nvm_vblk	*prov_vblk_join(struct nvm_vblk **blks, int n);
+int     prov_vblk_retire(struct nvm_vblk *vblk, uint64_t suspect,
+                                                        struct nvm_addr *bad);
 void 	prov_dev_pr();
 void 	prov_ublk_pr(int lun);
 void 	prov_fblk_pr(int lun);
+
+/* storage backends */
+int     prov_backend_register (struct prov_backend *);
+int     prov_lnvm_init (void);
+int     prov_emu_init (void);
 #endif /* FOX_H */
\ No newline at end of file